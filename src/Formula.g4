@@ -9,7 +9,7 @@ expr
     | (ADD | SUB) expr  # UnaryOp
     | expr (MUL | DIV) expr  # BinaryOp
     | expr (ADD | SUB) expr  # BinaryOp
-    | CELL  # Cell
+    | SHEET? CELL  # Cell
     | NUMBER  # Literal
     ;
 
@@ -27,4 +27,6 @@ SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
 CELL: [A-Z]+[0-9]+ ;
+// the name of another sheet of the workbook, as in Sheet2!B3
+SHEET: [A-Za-z_][A-Za-z0-9_]* '!' ;
 WS: [ \t\n\r]+ -> skip ;
@@ -4,7 +4,10 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <climits>
 #include <cmath>
 #include <memory>
 #include <optional>
@@ -71,13 +74,27 @@ class Expr {
 public:
     virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
-    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(const std::function<double(Position)>& cell_value_getter) const = 0;
+    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const = 0;
+    virtual double Evaluate(const FormulaAST::CellValueGetter& cell_value_getter) const = 0;
+    virtual void EvaluateBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t lanes,
+                               double* results, std::optional<FormulaError>* errors) const = 0;
+
+    // A copy that evaluates to the same values and errors, reading the same cells in the same order,
+    // in fewer steps. changed is set if the copy differs from this expression.
+    virtual std::unique_ptr<Expr> Simplify(bool& changed) const = 0;
+
+    // the value of a number literal
+    virtual std::optional<double> GetConstant() const {
+        return std::nullopt;
+    }
+
+    // Bytes taken by the nodes of the expression.
+    virtual size_t GetMemoryUsage() const = 0;
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
-    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence, Position shift,
                       bool right_child = false) const {
         auto precedence = GetPrecedence();
         auto mask = right_child ? PR_RIGHT : PR_LEFT;
@@ -86,7 +103,7 @@ public:
             out << '(';
         }
 
-        DoPrintFormula(out, precedence);
+        DoPrintFormula(out, precedence, shift);
 
         if (parens_needed) {
             out << ')';
@@ -119,10 +136,10 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-        lhs_->PrintFormula(out, precedence);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const override {
+        lhs_->PrintFormula(out, precedence, shift);
         out << static_cast<char>(type_);
-        rhs_->PrintFormula(out, precedence, /* right_child = */ true);
+        rhs_->PrintFormula(out, precedence, shift, /* right_child = */ true);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -142,10 +159,28 @@ public:
         }
     }
 
-    double Evaluate(const std::function<double(Position)>& cell_value_getter) const override {
+    double Evaluate(const FormulaAST::CellValueGetter& cell_value_getter) const override {
 	    	auto lhs_value = lhs_->Evaluate(cell_value_getter);
 	    	auto rhs_value = rhs_->Evaluate(cell_value_getter);
-	    
+	    	return Apply(type_, lhs_value, rhs_value);
+    }
+
+    void EvaluateBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t lanes,
+                       double* results, std::optional<FormulaError>* errors) const override {
+        std::array<double, FormulaAST::BATCH_SIZE> rhs_values;
+        lhs_->EvaluateBatch(cell_value_getter, lanes, results, errors);
+        rhs_->EvaluateBatch(cell_value_getter, lanes, rhs_values.data(), errors);
+        ApplyBatch(type_, lanes, results, rhs_values.data(), errors);
+    }
+
+    std::unique_ptr<Expr> Simplify(bool& changed) const override;
+
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + lhs_->GetMemoryUsage() + rhs_->GetMemoryUsage();
+    }
+
+    // The result of the operation; an infinite or undefined one is a Div0 error.
+    static double Apply(Type type, double lhs_value, double rhs_value) {
 		auto overflow_check = [](double result) {
 			if (!std::isfinite(result)) {
 				throw FormulaError(FormulaError::Category::Div0);
@@ -153,15 +188,15 @@ public:
 			return result;
 		};
 
-		switch (type_) {
+		switch (type) {
 		case Add:
-			return overflow_check(lhs_value + rhs_value));
+			return overflow_check(lhs_value + rhs_value);
 		case Subtract:
-			return overflow_check(lhs_value - rhs_value));
+			return overflow_check(lhs_value - rhs_value);
 		case Multiply:
-			return overflow_check(lhs_value * rhs_value));
+			return overflow_check(lhs_value * rhs_value);
 		case Divide:
-			return overflow_check(lhs_value / rhs_value));
+			return overflow_check(lhs_value / rhs_value);
 		default:
 			// have to do this because VC++ has a buggy warning
 			assert(false);
@@ -169,12 +204,153 @@ public:
 		}
     }
 
+    // Apply for every lane, with the left operands in results.
+    static void ApplyBatch(Type type, size_t lanes, double* results, const double* rhs_values,
+                           std::optional<FormulaError>* errors) {
+        // branch-free loops over the lanes, which the compiler vectorizes
+        switch (type) {
+        case Add:
+            for (size_t i = 0; i < lanes; ++i) {
+                results[i] += rhs_values[i];
+            }
+            break;
+        case Subtract:
+            for (size_t i = 0; i < lanes; ++i) {
+                results[i] -= rhs_values[i];
+            }
+            break;
+        case Multiply:
+            for (size_t i = 0; i < lanes; ++i) {
+                results[i] *= rhs_values[i];
+            }
+            break;
+        case Divide:
+            for (size_t i = 0; i < lanes; ++i) {
+                results[i] /= rhs_values[i];
+            }
+            break;
+        default:
+            assert(false);
+        }
+
+        // like overflow_check, but an operand's error comes first
+        for (size_t i = 0; i < lanes; ++i) {
+            if (!std::isfinite(results[i]) && !errors[i]) {
+                errors[i] = FormulaError(FormulaError::Category::Div0);
+            }
+        }
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> lhs_;
     std::unique_ptr<Expr> rhs_;
 };
 
+bool IsAdditive(BinaryOpExpr::Type type) {
+    return type == BinaryOpExpr::Add || type == BinaryOpExpr::Subtract;
+}
+
+// A left-leaning run of additions and subtractions, or of multiplications and divisions,
+// like ((A1+B1)-C1)+D1: the operands are computed in turn and applied to the result so far,
+// with the same checks as the nested operations, but without descending into them.
+// Only made by Simplify, so it is evaluated but never printed by the formula.
+class ChainExpr final : public Expr {
+public:
+    using Type = BinaryOpExpr::Type;
+
+    ChainExpr(std::unique_ptr<Expr> first, Type type, std::unique_ptr<Expr> second)
+        : first_(std::move(first)) {
+        Append(type, std::move(second));
+    }
+
+    // True if an operation of the type may continue the chain.
+    bool Continues(Type type) const {
+        return IsAdditive(type) == IsAdditive(rest_.front().first);
+    }
+
+    void Append(Type type, std::unique_ptr<Expr> operand) {
+        rest_.emplace_back(type, std::move(operand));
+    }
+
+    void Print(std::ostream& out) const override {
+        for (size_t i = 0; i < rest_.size(); ++i) {
+            out << '(' << static_cast<char>(rest_[rest_.size() - 1 - i].first) << ' ';
+        }
+        first_->Print(out);
+        for (const auto& [type, operand] : rest_) {
+            out << ' ';
+            operand->Print(out);
+            out << ')';
+        }
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        // a left operand never needs parentheses in a chain
+        first_->PrintFormula(out, GetOperationPrecedence(rest_.front().first), shift);
+        for (const auto& [type, operand] : rest_) {
+            out << static_cast<char>(type);
+            operand->PrintFormula(out, GetOperationPrecedence(type), shift, /* right_child = */ true);
+        }
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return GetOperationPrecedence(rest_.back().first);
+    }
+
+    double Evaluate(const FormulaAST::CellValueGetter& cell_value_getter) const override {
+        double result = first_->Evaluate(cell_value_getter);
+        for (const auto& [type, operand] : rest_) {
+            result = BinaryOpExpr::Apply(type, result, operand->Evaluate(cell_value_getter));
+        }
+        return result;
+    }
+
+    void EvaluateBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t lanes,
+                       double* results, std::optional<FormulaError>* errors) const override {
+        std::array<double, FormulaAST::BATCH_SIZE> operand_values;
+        first_->EvaluateBatch(cell_value_getter, lanes, results, errors);
+        for (const auto& [type, operand] : rest_) {
+            operand->EvaluateBatch(cell_value_getter, lanes, operand_values.data(), errors);
+            BinaryOpExpr::ApplyBatch(type, lanes, results, operand_values.data(), errors);
+        }
+    }
+
+    std::unique_ptr<Expr> Simplify(bool& changed) const override {
+        auto chain = std::make_unique<ChainExpr>(first_->Simplify(changed), rest_.front().first,
+                                                 rest_.front().second->Simplify(changed));
+        for (size_t i = 1; i < rest_.size(); ++i) {
+            chain->Append(rest_[i].first, rest_[i].second->Simplify(changed));
+        }
+        return chain;
+    }
+
+    size_t GetMemoryUsage() const override {
+        size_t result = sizeof(*this) + first_->GetMemoryUsage() + rest_.capacity() * sizeof(rest_[0]);
+        for (const auto& [type, operand] : rest_) {
+            result += operand->GetMemoryUsage();
+        }
+        return result;
+    }
+
+private:
+    static ExprPrecedence GetOperationPrecedence(Type type) {
+        switch (type) {
+            case Type::Add:
+                return EP_ADD;
+            case Type::Subtract:
+                return EP_SUB;
+            case Type::Multiply:
+                return EP_MUL;
+            default:
+                return EP_DIV;
+        }
+    }
+
+    std::unique_ptr<Expr> first_;
+    std::vector<std::pair<Type, std::unique_ptr<Expr>>> rest_;
+};
+
 class UnaryOpExpr final : public Expr {
 public:
     enum Type : char {
@@ -194,16 +370,16 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, Position shift) const override {
         out << static_cast<char>(type_);
-        operand_->PrintFormula(out, precedence);
+        operand_->PrintFormula(out, precedence, shift);
     }
 
     ExprPrecedence GetPrecedence() const override {
         return EP_UNARY;
     }
 
-    double Evaluate(const std::function<double(Position)>& cell_value_getter) const override {
+    double Evaluate(const FormulaAST::CellValueGetter& cell_value_getter) const override {
 		switch (type_) {
 		case UnaryPlus:
 			return operand_->Evaluate(cell_value_getter);
@@ -216,6 +392,22 @@ public:
 		}
     }
 
+    void EvaluateBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t lanes,
+                       double* results, std::optional<FormulaError>* errors) const override {
+        operand_->EvaluateBatch(cell_value_getter, lanes, results, errors);
+        if (type_ == UnaryMinus) {
+            for (size_t i = 0; i < lanes; ++i) {
+                results[i] = -results[i];
+            }
+        }
+    }
+
+    std::unique_ptr<Expr> Simplify(bool& changed) const override;
+
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this) + operand_->GetMemoryUsage();
+    }
+
 private:
     Type type_;
     std::unique_ptr<Expr> operand_;
@@ -223,32 +415,56 @@ private:
 
 class CellExpr final : public Expr {
 public:
-    explicit CellExpr(const Position* cell)
-        : cell_(cell) {
+    // sheet is null for a cell of the formula's own sheet
+    explicit CellExpr(const Position* cell, const std::string* sheet = nullptr)
+        : cell_(cell)
+        , sheet_(sheet) {
     }
 
     void Print(std::ostream& out) const override {
-        if (!cell_->IsValid()) {
+        DoPrintFormula(out, EP_ATOM, {0, 0});
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position shift) const override {
+        if (sheet_) {
+            out << *sheet_ << '!';
+        }
+        Position cell{cell_->row + shift.row, cell_->col + shift.col};
+        char buffer[Position::MAX_STRING_LENGTH];
+        auto [end, ec] = PositionToChars(buffer, buffer + sizeof(buffer), cell);
+        if (ec != std::errc{}) {
             out << FormulaError::Category::Ref;
         } else {
-            out << cell_->ToString();
+            out.write(buffer, end - buffer);
         }
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-        Print(out);
-    }
-
     ExprPrecedence GetPrecedence() const override {
         return EP_ATOM;
     }
 
-    double Evaluate(const std::function<double(Position)>& cell_value_getter) const override {
-        return cell_value_getter(*cell_);
+    double Evaluate(const FormulaAST::CellValueGetter& cell_value_getter) const override {
+        return cell_value_getter(sheet_ ? std::string_view(*sheet_) : std::string_view(), *cell_);
+    }
+
+    void EvaluateBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t /* lanes */,
+                       double* results, std::optional<FormulaError>* errors) const override {
+        cell_value_getter(sheet_ ? std::string_view(*sheet_) : std::string_view(), *cell_, results, errors);
+    }
+
+    std::unique_ptr<Expr> Simplify(bool& /* changed */) const override {
+        // refers to the same cell
+        return std::make_unique<CellExpr>(cell_, sheet_);
+    }
+
+    // the cell itself is kept by the FormulaAST
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
     }
 
 private:
     const Position* cell_;
+    const std::string* sheet_;
 };
 
 class NumberExpr final : public Expr {
@@ -261,7 +477,7 @@ public:
         out << value_;
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, Position /* shift */) const override {
         out << value_;
     }
 
@@ -269,14 +485,104 @@ public:
         return EP_ATOM;
     }
 
-    double Evaluate(const std::function<double(Position)>& /*cell_value_getter*/) const override {
+    double Evaluate(const FormulaAST::CellValueGetter& /*cell_value_getter*/) const override {
         return value_;
     }
 
+    void EvaluateBatch(const FormulaAST::BatchCellValueGetter& /* cell_value_getter */, size_t lanes,
+                       double* results, std::optional<FormulaError>* /* errors */) const override {
+        std::fill(results, results + lanes, value_);
+    }
+
+    std::unique_ptr<Expr> Simplify(bool& /* changed */) const override {
+        return std::make_unique<NumberExpr>(value_);
+    }
+
+    std::optional<double> GetConstant() const override {
+        return value_;
+    }
+
+    size_t GetMemoryUsage() const override {
+        return sizeof(*this);
+    }
+
 private:
     double value_;
 };
 
+// Operations whose operand is the result: x-0, x*1, x/1, 1*x, and x+(-0), -0+x, which keep the sign of a zero x.
+bool IsIdentity(BinaryOpExpr::Type type, double constant, bool constant_is_left) {
+    switch (type) {
+        case BinaryOpExpr::Add:
+            return constant == 0.0 && std::signbit(constant);
+        case BinaryOpExpr::Subtract:
+            return !constant_is_left && constant == 0.0 && !std::signbit(constant);
+        case BinaryOpExpr::Multiply:
+            return constant == 1.0;
+        default:
+            return !constant_is_left && constant == 1.0;
+    }
+}
+
+std::unique_ptr<Expr> UnaryOpExpr::Simplify(bool& changed) const {
+    auto operand = operand_->Simplify(changed);
+    if (type_ == UnaryPlus) {
+        changed = true;
+        return operand;
+    }
+    if (auto value = operand->GetConstant()) {
+        changed = true;
+        return std::make_unique<NumberExpr>(-*value);
+    }
+    // no unary plus is left in a simplified operand
+    if (auto* negation = dynamic_cast<UnaryOpExpr*>(operand.get())) {
+        changed = true;
+        return std::move(negation->operand_);
+    }
+    return std::make_unique<UnaryOpExpr>(type_, std::move(operand));
+}
+
+std::unique_ptr<Expr> BinaryOpExpr::Simplify(bool& changed) const {
+    auto lhs = lhs_->Simplify(changed);
+    auto rhs = rhs_->Simplify(changed);
+    auto lhs_value = lhs->GetConstant();
+    auto rhs_value = rhs->GetConstant();
+
+    if (lhs_value && rhs_value) {
+        try {
+            auto folded = std::make_unique<NumberExpr>(Apply(type_, *lhs_value, *rhs_value));
+            changed = true;
+            return folded;
+        }
+        catch (const FormulaError&) {
+            // an operation of constants that fails, like 1/0, is left to fail when evaluated
+        }
+    }
+    // the other operand is still evaluated, so its error is kept
+    if (rhs_value && IsIdentity(type_, *rhs_value, false)) {
+        changed = true;
+        return lhs;
+    }
+    if (lhs_value && IsIdentity(type_, *lhs_value, true)) {
+        changed = true;
+        return rhs;
+    }
+
+    // operations are never reordered, since rounding and overflow depend on the order
+    if (auto* chain = dynamic_cast<ChainExpr*>(lhs.get()); chain && chain->Continues(type_)) {
+        changed = true;
+        chain->Append(type_, std::move(rhs));
+        return lhs;
+    }
+    if (auto* binary = dynamic_cast<BinaryOpExpr*>(lhs.get()); binary && IsAdditive(binary->type_) == IsAdditive(type_)) {
+        changed = true;
+        auto chain = std::make_unique<ChainExpr>(std::move(binary->lhs_), binary->type_, std::move(binary->rhs_));
+        chain->Append(type_, std::move(rhs));
+        return chain;
+    }
+    return std::make_unique<BinaryOpExpr>(type_, std::move(lhs), std::move(rhs));
+}
+
 class ParseASTListener final : public FormulaBaseListener {
 public:
     std::unique_ptr<Expr> MoveRoot() {
@@ -291,6 +597,10 @@ public:
         return std::move(cells_);
     }
 
+    std::forward_list<SheetPosition> MoveSheetCells() {
+        return std::move(sheet_cells_);
+    }
+
 public:
     void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
         assert(args_.size() >= 1);
@@ -329,8 +639,16 @@ public:
             throw FormulaException("Invalid position: " + value_str);
         }
 
-        cells_.push_front(value);
-        auto node = std::make_unique<CellExpr>(&cells_.front());
+        std::unique_ptr<CellExpr> node;
+        if (auto* sheet = ctx->SHEET()) {
+            // the token includes the trailing '!'
+            auto sheet_str = sheet->getSymbol()->getText();
+            sheet_cells_.push_front({sheet_str.substr(0, sheet_str.size() - 1), value});
+            node = std::make_unique<CellExpr>(&sheet_cells_.front().pos, &sheet_cells_.front().sheet);
+        } else {
+            cells_.push_front(value);
+            node = std::make_unique<CellExpr>(&cells_.front());
+        }
         args_.push_back(std::move(node));
     }
 
@@ -365,6 +683,7 @@ public:
 private:
     std::vector<std::unique_ptr<Expr>> args_;
     std::forward_list<Position> cells_;
+    std::forward_list<SheetPosition> sheet_cells_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -401,7 +720,7 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(), listener.MoveSheetCells());
 }
 
 FormulaAST ParseFormulaAST(const std::string& in_str) {
@@ -419,18 +738,54 @@ void FormulaAST::Print(std::ostream& out) const {
     root_expr_->Print(out);
 }
 
-void FormulaAST::PrintFormula(std::ostream& out) const {
-    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+void FormulaAST::PrintEvaluated(std::ostream& out) const {
+    GetEvaluatedExpr().Print(out);
+}
+
+void FormulaAST::PrintFormula(std::ostream& out, Position shift) const {
+    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM, shift);
+}
+
+double FormulaAST::Execute(const FormulaAST::CellValueGetter& cell_value_getter) const {
+    return GetEvaluatedExpr().Evaluate(cell_value_getter);
 }
 
-double FormulaAST::Execute(const std::function<double(Position)>& cell_value_getter) const {
-    return root_expr_->Evaluate(cell_value_getter);
+void FormulaAST::ExecuteBatch(const FormulaAST::BatchCellValueGetter& cell_value_getter, size_t lanes,
+                              double* results, std::optional<FormulaError>* errors) const {
+    assert(lanes <= BATCH_SIZE);
+    GetEvaluatedExpr().EvaluateBatch(cell_value_getter, lanes, results, errors);
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::forward_list<SheetPosition> sheet_cells)
     : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
+    , cells_(std::move(cells))
+    , sheet_cells_(std::move(sheet_cells)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    sheet_cells_.sort();
+
+    // the cells of the simplified expression point to the same list nodes, which a move keeps
+    bool changed = false;
+    auto simplified = root_expr_->Simplify(changed);
+    if (changed) {
+        simplified_expr_ = std::move(simplified);
+    }
+
+    // a list node holds the element and a link
+    memory_usage_ = sizeof(*this) + root_expr_->GetMemoryUsage();
+    if (simplified_expr_) {
+        memory_usage_ += simplified_expr_->GetMemoryUsage();
+    }
+    for ([[maybe_unused]] Position cell : cells_) {
+        memory_usage_ += sizeof(Position) + sizeof(void*);
+    }
+    for (const SheetPosition& cell : sheet_cells_) {
+        memory_usage_ += sizeof(SheetPosition) + sizeof(void*) + cell.sheet.capacity();
+    }
+}
+
+const ASTImpl::Expr& FormulaAST::GetEvaluatedExpr() const {
+    return simplified_expr_ ? *simplified_expr_ : *root_expr_;
 }
 
 FormulaAST::~FormulaAST() = default;
@@ -5,6 +5,7 @@
 
 #include <forward_list>
 #include <functional>
+#include <optional>
 #include <stdexcept>
 
 namespace ASTImpl {
@@ -17,16 +18,35 @@ class ParsingError : public std::runtime_error {
 
 class FormulaAST {
 public:
+    // Returns the value of a cell; the sheet name is empty for the formula's own sheet.
+    using CellValueGetter = std::function<double(std::string_view sheet, Position pos)>;
+    // Reads a cell for every lane of a batch into values. A lane whose cell holds an error
+    // gets that error in errors unless it already has one, and a value of zero.
+    using BatchCellValueGetter = std::function<void(std::string_view sheet, Position pos, double* values,
+                                                    std::optional<FormulaError>* errors)>;
+
+    // lanes of ExecuteBatch at most
+    static constexpr size_t BATCH_SIZE = 64;
+
     explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+                        std::forward_list<Position> cells,
+                        std::forward_list<SheetPosition> sheet_cells);
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(const std::function<double(Position)>& cell_value_getter) const;
+    double Execute(const CellValueGetter& cell_value_getter) const;
+    // Evaluates the formula for several cells at once, each lane reading its own cells through the getter.
+    // A lane gets the error Execute would throw for it in errors, which must be empty on entry,
+    // and an unspecified result.
+    void ExecuteBatch(const BatchCellValueGetter& cell_value_getter, size_t lanes, double* results,
+                      std::optional<FormulaError>* errors) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
-    void PrintFormula(std::ostream& out) const;
+    // Like Print for the simplified expression that is evaluated.
+    void PrintEvaluated(std::ostream& out) const;
+    // shift is added to the row and the column of every cell printed
+    void PrintFormula(std::ostream& out, Position shift = {0, 0}) const;
 
     inline std::forward_list<Position>& GetCells() {
         return cells_;
@@ -36,13 +56,32 @@ public:
         return cells_;
     }
 
+    // cells of other sheets, sorted
+    inline const std::forward_list<SheetPosition>& GetSheetCells() const {
+        return sheet_cells_;
+    }
+
+    // Bytes taken by both trees and the lists of cells, this object included.
+    size_t GetMemoryUsage() const {
+        return memory_usage_;
+    }
+
 private:
+    const ASTImpl::Expr& GetEvaluatedExpr() const;
+
+    // as written, for printing
     std::unique_ptr<ASTImpl::Expr> root_expr_;
+    // Evaluated instead of the root: constant operations are folded, unary pluses, double negations
+    // and identity operations like x*1 dropped, and runs of like operations merged into chains.
+    // Values, errors and the order in which cells are read stay the same. Null if nothing changed.
+    std::unique_ptr<ASTImpl::Expr> simplified_expr_;
 
     // physically stores cells so that they can be
     // efficiently traversed without going through
     // the whole AST
     std::forward_list<Position> cells_;
+    std::forward_list<SheetPosition> sheet_cells_;
+    size_t memory_usage_ = 0;
 };
 
 FormulaAST ParseFormulaAST(std::istream& in);
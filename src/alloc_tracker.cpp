@@ -0,0 +1,147 @@
+#include "alloc_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace alloc {
+
+namespace {
+// constant-initialized, so operator new can use it before any dynamic initialization
+thread_local Usage thread_usage;
+// set once the thread has given its block back, see SharedUsageRelease
+thread_local bool thread_finished = false;
+
+// The counts of the threads using a block, summed by ProcessUsage. Only the owning thread writes
+// them, and each block has a cache line of its own. Blocks are never freed: one given back by an
+// exiting thread is taken by the next new one, which counts on from there.
+struct alignas(64) SharedUsage {
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<bool> in_use{true};
+    SharedUsage* next = nullptr;
+};
+
+std::atomic<SharedUsage*> shared_usages{nullptr};
+
+// Allocated with malloc, as operator new would count the allocation with the block being taken,
+// and aligned by hand, as malloc aligns to less than a cache line. The slack is never given back,
+// as the block itself.
+SharedUsage* TakeSharedUsage() {
+    for (SharedUsage* usage = shared_usages.load(std::memory_order_acquire); usage; usage = usage->next) {
+        bool in_use = false;
+        if (usage->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+            return usage;
+        }
+    }
+    void* memory = std::malloc(sizeof(SharedUsage) + alignof(SharedUsage) - 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory);
+    const std::uintptr_t aligned = (address + alignof(SharedUsage) - 1) & ~std::uintptr_t{alignof(SharedUsage) - 1};
+    auto* usage = new (reinterpret_cast<void*>(aligned)) SharedUsage;
+    usage->next = shared_usages.load(std::memory_order_relaxed);
+    while (!shared_usages.compare_exchange_weak(usage->next, usage, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return usage;
+}
+
+thread_local SharedUsage* thread_shared_usage = nullptr;
+
+// Gives the block of the thread back when it exits. The destructors of thread_local objects that
+// run after this one may still allocate; those allocations are counted for the thread only, as a
+// block taken then would never be given back.
+struct SharedUsageRelease {
+    ~SharedUsageRelease() {
+        thread_finished = true;
+        if (thread_shared_usage) {
+            thread_shared_usage->in_use.store(false, std::memory_order_release);
+            thread_shared_usage = nullptr;
+        }
+    }
+};
+
+thread_local SharedUsageRelease shared_usage_release;
+
+[[maybe_unused]] void Count(std::size_t size) {
+    ++thread_usage.allocations;
+    thread_usage.bytes += size;
+    if (thread_finished) {
+        return;
+    }
+    SharedUsage* usage = thread_shared_usage;
+    if (!usage) {
+        usage = thread_shared_usage = TakeSharedUsage();
+        // registers the release at the exit of the thread
+        (void)&shared_usage_release;
+    }
+    // no other thread writes them, so there is no need for a read-modify-write
+    usage->allocations.store(usage->allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    usage->bytes.store(usage->bytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+}
+}  // namespace
+
+Usage ThreadUsage() {
+    return thread_usage;
+}
+
+Usage ProcessUsage() {
+    Usage result;
+    for (SharedUsage* usage = shared_usages.load(std::memory_order_acquire); usage; usage = usage->next) {
+        result.allocations += usage->allocations.load(std::memory_order_relaxed);
+        result.bytes += usage->bytes.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+}  // namespace alloc
+
+#ifdef SPREADSHEET_ALLOC_TRACKING
+
+// The default array and nothrow forms of operator new forward to the single-object form of the
+// same alignment, so replacing the plain and the over-aligned single-object forms is enough to see
+// every allocation. Over-aligned types, such as Sheet with its statistics shards, take the latter.
+void* operator new(std::size_t size) {
+    alloc::Count(size);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /* size */) noexcept {
+    std::free(ptr);
+}
+
+// Over-allocates with malloc and keeps the pointer malloc returned right before the aligned block,
+// as the C library has no aligned allocation that every platform provides and free accepts.
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    alloc::Count(size);
+    const std::size_t align = std::max(static_cast<std::size_t>(alignment), alignof(void*));
+    if (void* memory = std::malloc(size + align - 1 + sizeof(void*))) {
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(memory) + sizeof(void*);
+        void* ptr = reinterpret_cast<void*>((address + align - 1) & ~std::uintptr_t{align - 1});
+        static_cast<void**>(ptr)[-1] = memory;
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr, std::align_val_t /* alignment */) noexcept {
+    if (ptr) {
+        std::free(static_cast<void**>(ptr)[-1]);
+    }
+}
+
+void operator delete(void* ptr, std::size_t /* size */, std::align_val_t alignment) noexcept {
+    operator delete(ptr, alignment);
+}
+
+#endif
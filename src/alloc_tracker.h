@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocation accounting.
+// When the project is configured with SPREADSHEET_ALLOC_TRACKING (the default),
+// the global operator new counts every allocation made by the calling thread.
+// Without it the counters stay at zero and ENABLED is false.
+namespace alloc {
+
+#ifdef SPREADSHEET_ALLOC_TRACKING
+inline constexpr bool ENABLED = true;
+#else
+inline constexpr bool ENABLED = false;
+#endif
+
+struct Usage {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+
+    Usage operator-(Usage rhs) const {
+        return {allocations - rhs.allocations, bytes - rhs.bytes};
+    }
+};
+
+// Returns the totals for the calling thread since it started.
+Usage ThreadUsage();
+
+// Returns the totals of all threads since the process started. Each thread counts in its own
+// counters, which are only summed here, so allocating threads never contend on them.
+Usage ProcessUsage();
+
+// Measures the allocations made by the current thread during its lifetime.
+class ScopedCounter {
+public:
+    ScopedCounter()
+        : start_(ThreadUsage()) {
+    }
+
+    Usage Get() const {
+        return ThreadUsage() - start_;
+    }
+
+private:
+    Usage start_;
+};
+
+}  // namespace alloc
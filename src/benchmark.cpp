@@ -0,0 +1,386 @@
+#include "benchmark.h"
+
+#include "alloc_tracker.h"
+#include "common.h"
+#include "formula.h"
+#include "perf_counters.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+using Metrics = std::map<std::string, std::uint64_t>;
+
+struct Result {
+    Metrics metrics;
+    SheetStatistics statistics;
+};
+
+// Every measurement starts with an empty parse cache.
+void StartMeasurement(Sheet& sheet) {
+    perf::Reset();
+    ClearParseCache();
+    sheet.ResetStatistics();
+}
+
+Result Collect(const Sheet& sheet, std::initializer_list<perf::Counter> counters) {
+    Result result;
+    for (perf::Counter counter : counters) {
+        bool allocation_counter = counter == perf::Counter::Allocations || counter == perf::Counter::AllocatedBytes;
+        if (allocation_counter && !alloc::ENABLED) {
+            continue;
+        }
+        result.metrics[std::string(perf::CounterName(counter))] = perf::Get(counter);
+    }
+    result.statistics = sheet.GetStatistics();
+    return result;
+}
+
+// The bytes of every component of the sheet, under the names of SheetMemoryUsage::ComponentName.
+void AddMemoryUsage(Result& result, const Sheet& sheet) {
+    SheetMemoryUsage usage = sheet.MemoryUsage();
+    for (size_t i = 0; i < usage.bytes.size(); ++i) {
+        auto component = static_cast<SheetMemoryUsage::Component>(i);
+        result.metrics[std::string(SheetMemoryUsage::ComponentName(component))] = usage[component];
+    }
+}
+
+void PrintStatistics(const SheetStatistics& statistics) {
+    for (size_t i = 0; i < statistics.entries.size(); ++i) {
+        const SheetStatistics::Entry& entry = statistics.entries[i];
+        if (entry.calls == 0) {
+            continue;
+        }
+        std::cout << "    " << SheetStatistics::ApiName(static_cast<SheetStatistics::Api>(i)) << ": "
+                  << entry.calls << " calls, " << entry.allocations << " allocations, "
+                  << entry.allocated_bytes << " bytes\n";
+    }
+}
+
+std::string Reference(int row, int col) {
+    return Position{row, col}.ToString();
+}
+
+// Allocations are not gated here: they are dominated by the ANTLR runtime,
+// which differs between versions. The memory the sheet holds afterwards is.
+Result BulkLoad() {
+    Sheet sheet;
+
+    StartMeasurement(sheet);
+    for (int row = 0; row < 200; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        for (int col = 1; col < 10; ++col) {
+            sheet.SetCell({row, col}, "="s + Reference(row, col - 1) + "+1");
+        }
+    }
+    Result result = Collect(sheet, {perf::Counter::FormulasParsed, perf::Counter::GraphNodesVisited,
+                                    perf::Counter::CellsEvaluated});
+    AddMemoryUsage(result, sheet);
+    return result;
+}
+
+Result DeepChainRecalc() {
+    constexpr int DEPTH = 500;
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "1");
+    for (int row = 1; row < DEPTH; ++row) {
+        sheet.SetCell({row, 0}, "="s + Reference(row - 1, 0) + "+1");
+    }
+
+    StartMeasurement(sheet);
+    sheet.GetCell({DEPTH - 1, 0})->GetValue();
+    sheet.SetCell({0, 0}, "2");
+    sheet.GetCell({DEPTH - 1, 0})->GetValue();
+    return Collect(sheet, {perf::Counter::CellsEvaluated, perf::Counter::GraphNodesVisited,
+                           perf::Counter::CacheInvalidations, perf::Counter::Allocations});
+}
+
+Result WideFanoutInvalidation() {
+    constexpr int FANOUT = 1000;
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "1");
+    for (int row = 0; row < FANOUT; ++row) {
+        sheet.SetCell({row, 1}, "=A1*"s + std::to_string(row));
+        sheet.GetCell({row, 1})->GetValue();
+    }
+
+    StartMeasurement(sheet);
+    sheet.SetCell({0, 0}, "2");
+    for (int row = 0; row < FANOUT; ++row) {
+        sheet.GetCell({row, 1})->GetValue();
+    }
+    return Collect(sheet, {perf::Counter::GraphNodesVisited, perf::Counter::CacheInvalidations,
+                           perf::Counter::CellsEvaluated, perf::Counter::Allocations});
+}
+
+Result Export() {
+    Sheet sheet;
+    for (int row = 0; row < 100; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        for (int col = 1; col < 7; ++col) {
+            sheet.SetCell({row, col}, "="s + Reference(row, 0) + "*" + std::to_string(col) + "+" + Reference(row, col - 1));
+        }
+        sheet.SetCell({row, 7}, "label");
+    }
+
+    StartMeasurement(sheet);
+    std::ostringstream values;
+    sheet.PrintValues(values);
+    std::ostringstream texts;
+    sheet.PrintTexts(texts);
+    return Collect(sheet, {perf::Counter::CellsEvaluated, perf::Counter::Allocations});
+}
+
+// A few labels repeated all over the sheet, most of them too long for the small string buffer.
+// Texts are stored once per sheet, so text_bytes stays flat as the sheet grows.
+Result LabelLoad() {
+    constexpr int ROWS = 500;
+    constexpr int COLS = 8;
+    const std::string LABELS[] = {"N/A", "Northern and Western Europe", "Southern and Eastern Europe",
+                                  "Central and South America", "status: pending review", "status: approved",
+                                  "status: rejected by owner", "status: escalated to finance"};
+    // the copies passed to SetCell are made before the measurement
+    std::vector<std::string> texts;
+    for (int i = 0; i < ROWS * COLS; ++i) {
+        texts.push_back(LABELS[(i / COLS + i % COLS) % std::size(LABELS)]);
+    }
+    Sheet sheet;
+
+    StartMeasurement(sheet);
+    for (int i = 0; i < ROWS * COLS; ++i) {
+        sheet.SetCell({i / COLS, i % COLS}, std::move(texts[i]));
+    }
+    Result result = Collect(sheet, {perf::Counter::Allocations, perf::Counter::AllocatedBytes});
+    result.metrics["text_bytes"] = sheet.GetTextPool().GetArenaBytes();
+    return result;
+}
+
+// Reads every cell through the views and then through the copying API, whose allocations
+// are shown in the statistics. Only the views are gated: once the formula texts have been
+// printed by the first pass, they must not allocate at all.
+Result ViewReads() {
+    constexpr int ROWS = 200;
+    Sheet sheet;
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        sheet.SetCell({row, 1}, "a label longer than the small string buffer");
+        sheet.SetCell({row, 2}, "="s + Reference(row, 0) + "*2+" + Reference(0, 0));
+    }
+
+    auto read_views = [&sheet] {
+        for (int row = 0; row < ROWS; ++row) {
+            for (int col = 0; col < 3; ++col) {
+                const CellInterface* cell = sheet.GetCell({row, col});
+                cell->GetValueView();
+                cell->GetTextView();
+                cell->GetReferencedCellsView();
+            }
+        }
+    };
+    read_views();
+
+    StartMeasurement(sheet);
+    read_views();
+    // read before the results are stored
+    Result result = Collect(sheet, {perf::Counter::Allocations, perf::Counter::CellsEvaluated});
+
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 0; col < 3; ++col) {
+            const CellInterface* cell = sheet.GetCell({row, col});
+            cell->GetValue();
+            cell->GetText();
+            cell->GetReferencedCells();
+        }
+    }
+    result.statistics = sheet.GetStatistics();
+    return result;
+}
+
+// A data feed writing the same few formula texts to cells all over the sheet, round after round.
+// Each text is parsed once; without the parse cache every new cell of a text would parse it.
+Result FormulaFeed() {
+    constexpr int ROUNDS = 5;
+    constexpr int CELLS = 400;
+    constexpr int TEXTS = 20;
+    std::vector<std::string> texts;
+    for (int i = 0; i < TEXTS; ++i) {
+        texts.push_back("=A1*"s + std::to_string(i) + "+B2/4");
+    }
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "1");
+    sheet.SetCell({1, 1}, "8");
+
+    StartMeasurement(sheet);
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < CELLS; ++i) {
+            sheet.SetCell({2 + i / 10, i % 10}, texts[(i + round) % TEXTS]);
+        }
+    }
+    return Collect(sheet, {perf::Counter::FormulasParsed, perf::Counter::Allocations});
+}
+
+struct Workload {
+    std::string_view name;
+    Result (*run)();
+};
+
+const Workload WORKLOADS[] = {
+    {"bulk_load"sv, BulkLoad},
+    {"deep_chain_recalc"sv, DeepChainRecalc},
+    {"wide_fanout_invalidation"sv, WideFanoutInvalidation},
+    {"export"sv, Export},
+    {"label_load"sv, LabelLoad},
+    {"view_reads"sv, ViewReads},
+    {"formula_feed"sv, FormulaFeed},
+};
+
+// One "workload.metric value" pair per line, '#' starts a comment.
+Metrics LoadBaselines(const std::string& path) {
+    Metrics result;
+    std::ifstream input(path);
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string key;
+        std::uint64_t value;
+        if (fields >> key >> value) {
+            result[key] = value;
+        }
+    }
+    return result;
+}
+
+void SaveBaselines(const std::string& path, const Metrics& baselines) {
+    std::ofstream output(path);
+    output << "# Operation count baselines for the perf_gate CTest entries.\n"
+           << "# Regenerate with: spreadsheet --perf-gate <this file> --update\n";
+    for (const auto& [key, value] : baselines) {
+        output << key << ' ' << value << '\n';
+    }
+}
+
+// Every formula depends on A1, so editing A1 makes the whole grid dirty.
+void BenchmarkConcurrentReads() {
+    constexpr int ROWS = 200;
+    constexpr int COLS = 50;
+    constexpr int WARM_PASSES = 20;
+
+    Sheet sheet;
+    sheet.SetCell({0, 0}, "1");
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 1; col < COLS; ++col) {
+            sheet.SetCell({row, col}, "="s + Reference(row, col - 1) + "+A1");
+        }
+    }
+
+    auto read_all = [&sheet](int passes) {
+        for (int pass = 0; pass < passes; ++pass) {
+            for (int row = 0; row < ROWS; ++row) {
+                for (int col = 1; col < COLS; ++col) {
+                    sheet.GetCell({row, col})->GetValue();
+                }
+            }
+        }
+    };
+    auto run_readers = [&read_all](int threads, int passes) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> readers;
+        for (int i = 0; i < threads; ++i) {
+            readers.emplace_back(read_all, passes);
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::cout << "concurrent GetValue, " << ROWS * (COLS - 1) << " formula cells\n"
+              << "threads  cold ms  evaluated  warm Mreads/s\n";
+    for (int threads : {1, 2, 4, 8}) {
+        sheet.SetCell({0, 0}, std::to_string(threads));
+        perf::Reset();
+        double cold_seconds = run_readers(threads, 1);
+        std::uint64_t evaluated = perf::Get(perf::Counter::CellsEvaluated);
+        double warm_seconds = run_readers(threads, WARM_PASSES);
+        double reads = static_cast<double>(threads) * WARM_PASSES * ROWS * (COLS - 1);
+
+        std::cout << std::setw(7) << threads << std::setw(9) << std::fixed << std::setprecision(2) << cold_seconds * 1e3
+                  << std::setw(11) << evaluated << std::setw(15) << reads / warm_seconds / 1e6 << '\n';
+    }
+}
+
+}  // namespace
+
+int RunBenchmarks() {
+    BenchmarkConcurrentReads();
+    return 0;
+}
+
+int RunPerfGate(const std::string& baseline_path, const std::string& workload, double tolerance, bool update) {
+    Metrics baselines = LoadBaselines(baseline_path);
+    bool found = false;
+    bool failed = false;
+
+    for (const Workload& candidate : WORKLOADS) {
+        if (!workload.empty() && candidate.name != workload) {
+            continue;
+        }
+        found = true;
+
+        // the first run pays for lazily initialized statics (e.g. compiled regexes)
+        candidate.run();
+        Result result = candidate.run();
+        for (const auto& [metric, value] : result.metrics) {
+            std::string key = std::string(candidate.name) + '.' + metric;
+            if (update) {
+                baselines[key] = value;
+                std::cout << key << ": " << value << '\n';
+                continue;
+            }
+
+            auto it = baselines.find(key);
+            if (it == baselines.end()) {
+                std::cout << key << ": " << value << " (no baseline) FAIL\n";
+                failed = true;
+                continue;
+            }
+
+            double limit = static_cast<double>(it->second) * (1.0 + tolerance);
+            std::cout << key << ": " << value << " (baseline " << it->second << ") ";
+            if (static_cast<double>(value) > limit) {
+                std::cout << "REGRESSION\n";
+                failed = true;
+            } else if (static_cast<double>(value) < static_cast<double>(it->second) * (1.0 - tolerance)) {
+                std::cout << "improved, consider updating the baseline\n";
+            } else {
+                std::cout << "OK\n";
+            }
+        }
+        if (alloc::ENABLED) {
+            PrintStatistics(result.statistics);
+        }
+    }
+
+    if (!found) {
+        std::cerr << "Unknown workload: " << workload << std::endl;
+        return 1;
+    }
+    if (update) {
+        SaveBaselines(baseline_path, baselines);
+    }
+    return failed ? 1 : 0;
+}
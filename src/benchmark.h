@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+// Deterministic workloads for the performance regression gate.
+// Each workload reports operation counts (see perf_counters.h) rather than wall time,
+// so results are comparable between machines and CI runs.
+// When allocation tracking is compiled in, the per-API sheet statistics of the measured
+// phase are printed as well (they are informational and not gated).
+
+// Runs the named workload (or every workload when the name is empty) and compares its
+// counts against the baselines stored in baseline_path.
+// A count that exceeds its baseline by more than the tolerance (a fraction, 0.1 = 10%) is a regression.
+// With update set, the baselines of the workloads that ran are rewritten instead.
+// Returns the process exit code: 0 on success, 1 on a regression or a missing baseline.
+int RunPerfGate(const std::string& baseline_path, const std::string& workload, double tolerance, bool update);
+
+// Wall-clock benchmarks that are too noisy to gate, printed as a table to stdout.
+// Currently measures GetValue throughput as the number of concurrent reader threads grows.
+int RunBenchmarks();
@@ -1,226 +1,545 @@
 #include "cell.h"
+#include "perf_counters.h"
+#include "sheet.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <string>
-#include <optional>
 #include <stack>
+#include <thread>
+#include <utility>
 using namespace std::literals;
 
-class Cell::Impl {
-public:
-	enum class CellType {
-		EMPTY,
-		TEXT,
-		FORMULA
-	};
+// Cells keep their content inline and dispatch on its alternative. A formula's cached value
+// lives in the cell's slot of the sheet's value store, and its text is kept by the formula.
 
-	explicit Impl(CellType type)
-		:type_(type)
-	{
+namespace {
+// The number a text is read as by formulas, or the TEXT state.
+void ActivateText(std::string_view value, ValueStore::Slot slot) {
+	if (auto number = ParseNumber(value)) {
+		slot.Store(ValueStore::State::NUMBER, *number);
+	} else {
+		slot.Store(ValueStore::State::TEXT);
 	}
+}
+}  // namespace
 
-	virtual ~Impl() = default;
+Cell::Cell(Sheet& sheet, Position pos):sheet_(sheet), pos_(pos) {}
 
-	virtual CellInterface::Value GetValue() const = 0;
-	virtual std::string GetText() const = 0;
+Cell::Cell(Cell&& other) noexcept
+	: sheet_(other.sheet_)
+	, pos_(other.pos_)
+	, content_(std::exchange(other.content_, std::monostate{}))
+	, links_(std::move(other.links_))
+	, precedent_count_(std::exchange(other.precedent_count_, 0))
+	, links_pending_(std::exchange(other.links_pending_, false)) {
+}
 
-	virtual bool IsCacheValid() const{
-		return true;
+Cell::~Cell() {
+	sheet_.link_bytes_ -= links_.capacity() * sizeof(const Cell*);
+	ReleaseContent(content_);
+	// the slot of an empty cell is EMPTY already; a cell moved from is empty, and the slot is the new cell's
+	if (content_.index() != EMPTY) {
+		sheet_.values_.Clear(pos_);
 	}
+}
 
-	virtual void InvalidateCache() {};
+void Cell::Set(std::string text) {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::SetCell);
+	TRACE_SPAN("Cell::Set");
+	sheet_.StopRecalculation();
+	Content content = MakeContent(text);
+	try {
+		Swap(content);
+	}
+	catch (...) {
+		ReleaseContent(content);
+		throw;
+	}
+	// the journal takes over the previous content; the empty cells created for references are left out
+	if (content.index() != EMPTY || content_.index() != EMPTY) {
+		sheet_.RecordEdit(pos_, std::move(content));
+	}
+}
 
-	virtual std::vector<Position> GetReferencedCells() const {
-		return {};
-	};
+void Cell::Load(const std::string& text) {
+	Content content = MakeContent(text);
+	std::vector<Cell*> precedents;
+	try {
+		precedents = ResolvePrecedents(content);
+	}
+	catch (...) {
+		ReleaseContent(content);
+		throw;
+	}
+	ReleaseContent(content_);
+	content_ = std::move(content);
+	Activate(sheet_.GetValueSlot(pos_));
+	AddNewLinks(precedents);
+	sheet_.MarkChanged(pos_);
+}
 
-private:
-	CellType type_;
-};
+void Cell::Unload() {
+	RemoveInvalidLinks();
+	ReleaseContent(content_);
+	content_ = std::monostate{};
+	sheet_.values_.Clear(pos_);
+}
 
-class Cell::EmptyImpl : public Impl {
-public:
-	EmptyImpl() 
-	: Impl(Impl::CellType::EMPTY) 
-	{
+Cell::Content Cell::MakeContent(const std::string& text) {
+	TRACE_SPAN("Cell::Set/Parse");
+	if (text.size() > 1 && text.front() == FORMULA_SIGN) {
+		return FormulaContent{sheet_.formula_templates_.Parse(text.substr(1), pos_)};
 	}
-
-	virtual CellInterface::Value GetValue() const {
-		return 0.0;
+	if (!text.empty()) {
+		return TextContent{sheet_.text_pool_.Intern(text)};
 	}
+	return std::monostate{};
+}
 
-	virtual std::string GetText() const {
-		return "";
+void Cell::Swap(Content& content) {
+	std::vector<Cell*> precedents;
+	{
+		TRACE_SPAN("Cell::Set/CreateEmptyCells");
+		precedents = ResolvePrecedents(content);
 	}
-};
 
-class Cell::TextImpl : public Impl {
-public:
-	TextImpl(std::string text)
-		: Impl(Impl::CellType::TEXT),
-		text_(std::move(text))
 	{
+		TRACE_SPAN("Cell::Set/IsCircularDependent");
+		if (IsCircularDependent(precedents)) {
+			throw CircularDependencyException("Setting Cell caused circular dependency");
+		}
 	}
 
-	virtual CellInterface::Value GetValue() const {
-		return text_.front() == ESCAPE_SIGN ? text_.substr(1) : text_;
-	}
+	std::swap(content_, content);
+	Activate(sheet_.GetValueSlot(pos_));
 
-	virtual std::string GetText() const {
-		return text_;
+	{
+		TRACE_SPAN("Cell::Set/UpdateLinks");
+		RemoveInvalidLinks();
+		AddNewLinks(precedents);
+		links_pending_ = false;
 	}
-private:
-	std::string text_;
-};
 
-class Cell::FormulaImpl : public Impl {
-public:
-	FormulaImpl(std::string text, SheetInterface& sheet)
-		: Impl(Impl::CellType::FORMULA),
-		formula_(ParseFormula(text)),
-		sheet_(sheet)
 	{
+		TRACE_SPAN("Cell::Set/InvalidateDependentCache");
+		InvalidateDependentCache();
 	}
+	sheet_.MarkChanged(pos_);
+}
 
-	virtual CellInterface::Value GetValue() const {
-		if (cache_.has_value()) {
-			return *cache_;
-		}
-
-		auto evaluation = formula_->Evaluate(sheet_);
-		if (std::holds_alternative<double>(evaluation)) {
-			cache_ = std::get<double>(evaluation);
-		}
+void Cell::ReleaseContent(const Content& content) {
+	if (auto* text = std::get_if<TextContent>(&content)) {
+		sheet_.text_pool_.Release(text->id);
+	}
+}
 
-		return std::visit([this](auto value) {
-			return CellValue(value);
-			}, evaluation);
+void Cell::Activate(ValueStore::Slot slot) const {
+	switch (content_.index()) {
+	case EMPTY:
+		slot.Store(ValueStore::State::EMPTY);
+		break;
+	case TEXT:
+		// stored as the number formulas read it as
+		ActivateText(GetUnescapedText(), slot);
+		break;
+	case FORMULA:
+		slot.Store(ValueStore::State::DIRTY);
+		break;
 	}
+}
 
-	virtual std::string GetText() const {
-		return "=" + formula_->GetExpression();
+std::string_view Cell::GetUnescapedText() const {
+	std::string_view text = sheet_.text_pool_.View(std::get<TextContent>(content_).id);
+	if (text.front() == ESCAPE_SIGN) {
+		text.remove_prefix(1);
 	}
-	virtual bool IsCacheValid() const override {
-		return cache_.has_value();
+	return text;
+}
+
+std::vector<Cell*> Cell::ResolvePrecedents(const Content& content) {
+	const auto* formula = std::get_if<FormulaContent>(&content);
+	if (!formula) {
+		return {};
 	}
 
-	virtual void InvalidateCache() override {
-		cache_.reset();
+	std::vector<std::pair<Sheet*, Position>> targets;
+	for (Position pos : formula->formula->GetReferencedCellsView()) {
+		targets.emplace_back(&sheet_, pos);
+	}
+	// unknown sheets are rejected before anything is created
+	for (const SheetPosition& ref : formula->formula->GetReferencedSheetCells()) {
+		Sheet* sheet = sheet_.FindSheet(ref.sheet);
+		if (!sheet) {
+			throw FormulaException("Unknown sheet: "s + ref.sheet);
+		}
+		targets.emplace_back(sheet, ref.pos);
 	}
 
-	virtual std::vector<Position> GetReferencedCells() const override{
-		return formula_->GetReferencedCells();
-	};
+	std::vector<Cell*> result;
+	result.reserve(targets.size());
+	for (auto [sheet, pos] : targets) {
+		// referenced cells are created empty so that they can be linked
+		if (!sheet->GetCell(pos)) {
+			sheet->SetCell(pos, ""s);
+		}
+		result.push_back(static_cast<Cell*>(sheet->GetCell(pos)));
+	}
+	return result;
+}
 
-private:
-	CellInterface::Value CellValue(double value) const {
-		return value;
+void Cell::RemoveInvalidLinks() {
+	for (const Cell* ref_cell : GetPrecedents()) {
+		auto& links = ref_cell->links_;
+		auto it = std::find(links.begin() + ref_cell->precedent_count_, links.end(), this);
+		// the order of dependents does not matter
+		*it = links.back();
+		links.pop_back();
+		if (&ref_cell->sheet_ != &sheet_) {
+			sheet_.RemoveSheetLink(ref_cell->sheet_);
+		}
 	}
+	links_.erase(links_.begin(), links_.begin() + precedent_count_);
+	precedent_count_ = 0;
+}
 
-	CellInterface::Value CellValue(FormulaError fe) const {
-		return fe;
+void Cell::AddNewLinks(const std::vector<Cell*>& precedents) {
+	for (const Cell* cell : precedents) {
+		Span<const Cell*> linked = GetPrecedents();
+		if (std::find(linked.begin(), linked.end(), cell) != linked.end()) {
+			continue;
+		}
+		size_t capacity = links_.capacity();
+		links_.insert(links_.begin() + precedent_count_++, cell);
+		sheet_.link_bytes_ += (links_.capacity() - capacity) * sizeof(const Cell*);
+		capacity = cell->links_.capacity();
+		cell->links_.push_back(this);
+		cell->sheet_.link_bytes_ += (cell->links_.capacity() - capacity) * sizeof(const Cell*);
+		if (&cell->sheet_ != &sheet_) {
+			sheet_.AddSheetLink(cell->sheet_);
+		} else {
+			// published versions list the dependents of a cell
+			sheet_.MarkChanged(cell->pos_);
+		}
 	}
-	std::unique_ptr<FormulaInterface> formula_;
-	SheetInterface& sheet_;
-	mutable std::optional<double> cache_;
-};
+}
 
+void Cell::RedirectLinks(const Cell* from) const {
+	for (const Cell* ref_cell : GetPrecedents()) {
+		auto& links = ref_cell->links_;
+		std::replace(links.begin() + ref_cell->precedent_count_, links.end(), from, this);
+	}
+	for (const Cell* dep_cell : GetDependents()) {
+		auto& links = dep_cell->links_;
+		std::replace(links.begin(), links.begin() + dep_cell->precedent_count_, from, this);
+	}
+}
 
-Cell::Cell(SheetInterface& sheet):sheet_(sheet) {}
+void Cell::ShrinkLinks() {
+	if (links_.capacity() > 2 * links_.size()) {
+		sheet_.link_bytes_ -= links_.capacity() * sizeof(const Cell*);
+		links_.shrink_to_fit();
+		sheet_.link_bytes_ += links_.capacity() * sizeof(const Cell*);
+	}
+}
 
-Cell::~Cell() {}
+void Cell::CompleteLinks() {
+	if (!links_pending_) {
+		return;
+	}
+	AddNewLinks(ResolvePrecedents(content_));
+	links_pending_ = false;
+}
 
-void Cell::Set(std::string text) {
-	std::unique_ptr<Impl> temp_impl;
-	if (text.size() > 1 && text.front() == FORMULA_SIGN) {
-		temp_impl= std::make_unique<FormulaImpl>(std::move(text.substr(1)), sheet_);
+void Cell::Restore(const SheetSnapshot::CellData& data) {
+	ReleaseContent(content_);
+	ValueStore::Slot slot = sheet_.GetValueSlot(pos_);
+	if (data.formula) {
+		content_ = FormulaContent{data.formula};
+		Activate(slot);
+		if (const double* number = std::get_if<double>(&data.value)) {
+			Store(*number);
+		}
+		else if (const FormulaError* error = std::get_if<FormulaError>(&data.value)) {
+			Store(*error);
+		}
+		links_pending_ = !data.formula->GetReferencedCellsView().empty();
+		return;
 	}
-	else if (!text.empty()) {
-		temp_impl = std::make_unique<TextImpl>(text);
+	if (!data.text.empty()) {
+		content_ = TextContent{sheet_.text_pool_.Intern(data.text)};
 	}
 	else {
-		temp_impl = std::make_unique<EmptyImpl>();
+		content_ = std::monostate{};
 	}
+	Activate(slot);
+}
 
-	CreateEmptyCells(temp_impl);
+std::shared_ptr<const FormulaInterface> Cell::GetFormula() const {
+	const auto* formula = std::get_if<FormulaContent>(&content_);
+	return formula ? formula->formula : nullptr;
+}
 
-	if (std::unordered_set<const Cell*> visited; IsCircularDependent(this, temp_impl, visited)) {
-		throw CircularDependencyException("Setting Cell caused circular dependency");
+std::vector<Position> Cell::GetDependentPositions() const {
+	std::vector<Position> result;
+	for (const Cell* cell : GetDependents()) {
+		if (&cell->sheet_ == &sheet_) {
+			result.push_back(cell->pos_);
+		}
 	}
+	return result;
+}
 
-	impl_ = std::move(temp_impl);
+void Cell::Clear() {
+	Set(""s);
+}
 
-	RemoveInvalidLinks();
-	AddNewLinks();
+Cell::Value Cell::GetValue() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetValue);
+	return CellInterface::GetValue();
+}
 
-	if (IsCacheValid()) {
-		InvalidateCache();
-		InvalidateDependentCache();
-	}
+std::string Cell::GetText() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetText);
+	return CellInterface::GetText();
 }
 
-void Cell::CreateEmptyCells(const std::unique_ptr<Impl>& impl) {
-	for (Position pos : impl->GetReferencedCells()) {
-		const Cell* cell = dynamic_cast<const Cell*>(sheet_.GetCell(pos));
-		if (!cell) {
-			sheet_.SetCell(pos, ""s);
+std::vector<Position> Cell::GetReferencedCells() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetReferencedCells);
+	return CellInterface::GetReferencedCells();
+}
+
+// Safe to call from several threads at once while the sheet is not modified.
+// Cached results of formulas are read with a single acquire load; the first reader of a dirty
+// cell computes it while the others wait for the result instead of repeating the work.
+Cell::ValueView Cell::GetValueView() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetValueView);
+	switch (content_.index()) {
+	case EMPTY:
+		return 0.0;
+	case TEXT:
+		return GetUnescapedText();
+	}
+
+	ValueStore::Slot slot = GetSlot();
+	if (!slot) {
+		// evicted to stay within the sheet's value budget
+		slot = sheet_.ReadmitValueSlot(pos_);
+	}
+	if (!slot) {
+		sheet_.uncached_evaluations_.fetch_add(1, std::memory_order_relaxed);
+		return ComputeUncached();
+	}
+	while (true) {
+		ValueStore::State state = slot.GetState().load(std::memory_order_acquire);
+		switch (state) {
+		case ValueStore::State::VALUE:
+			slot.Touch();
+			return slot.Value().load(std::memory_order_relaxed);
+		case ValueStore::State::FORMULA_ERROR:
+			slot.Touch();
+			return FormulaError(static_cast<FormulaError::Category>(slot.Value().load(std::memory_order_relaxed)));
+		case ValueStore::State::DIRTY:
+			if (slot.GetState().compare_exchange_weak(state, ValueStore::State::COMPUTING, std::memory_order_acquire)) {
+				return Compute();
+			}
+			break;
+		default:
+			std::this_thread::yield();
+			break;
 		}
 	}
 }
 
+std::string_view Cell::GetTextView() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetTextView);
+	switch (content_.index()) {
+	case TEXT:
+		return sheet_.text_pool_.View(std::get<TextContent>(content_).id);
+	case FORMULA:
+		return std::get<FormulaContent>(content_).formula->GetCanonicalText();
+	}
+	return {};
+}
 
-void Cell::RemoveInvalidLinks() {
-	for (auto* ref_cell : referenced_cells_) {
-		ref_cell->dependent_cells_.erase(this);
+Span<Position> Cell::GetReferencedCellsView() const {
+	ApiScope scope(sheet_.statistics_, SheetStatistics::Api::GetReferencedCellsView);
+	const auto* formula = std::get_if<FormulaContent>(&content_);
+	return formula ? formula->formula->GetReferencedCellsView() : Span<Position>{};
+}
+
+bool Cell::IsReferenced() const {
+	return links_.size() > precedent_count_;
+}
+
+void Cell::CollectStaleCells(std::vector<const Cell*>& order, std::unordered_set<const Cell*>& visited) const {
+	// iterative post-order walk; a valid cache means the precedents are valid too
+	std::stack<std::pair<const Cell*, bool>> to_visit;
+	to_visit.push({this, false});
+	while (!to_visit.empty()) {
+		auto [cell, expanded] = to_visit.top();
+		to_visit.pop();
+		if (expanded) {
+			order.push_back(cell);
+			continue;
+		}
+		if (cell->IsCacheValid() || !visited.insert(cell).second) {
+			continue;
+		}
+		to_visit.push({cell, true});
+		for (const Cell* ref_cell : cell->GetPrecedents()) {
+			// other sheets compute their own cells
+			if (&ref_cell->sheet_ == &sheet_) {
+				to_visit.push({ref_cell, false});
+			}
+		}
 	}
-	referenced_cells_.clear();
 }
 
-void Cell::AddNewLinks() {
-	for (Position pos : GetReferencedCells()) {
-		const Cell* cell = dynamic_cast<const Cell*>(sheet_.GetCell(pos));
-		dependent_cells_.insert(cell);
-		cell->referenced_cells_.insert(this);
+bool Cell::IsCacheValid() const {
+	if (content_.index() != FORMULA) {
+		return true;
+	}
+	ValueStore::Slot slot = GetSlot();
+	// an evicted value is not stale, it is computed whenever it is read
+	if (!slot) {
+		return true;
 	}
+	ValueStore::State state = slot.GetState().load(std::memory_order_acquire);
+	return state == ValueStore::State::VALUE || state == ValueStore::State::FORMULA_ERROR;
+}
 
+ValueStore::Slot Cell::GetSlot() const {
+	return sheet_.values_.Find(pos_);
 }
 
-void Cell::Clear() {
-	impl_.reset();
+// The slot of a cell whose value is being computed stays until the value is stored,
+// as chunks are evicted only while no reader runs.
+bool Cell::TryClaim() const {
+	ValueStore::State state = ValueStore::State::DIRTY;
+	ValueStore::Slot slot = GetSlot();
+	return slot && slot.GetState().compare_exchange_strong(state, ValueStore::State::COMPUTING, std::memory_order_acquire);
 }
 
-Cell::Value Cell::GetValue() const {
-	return impl_->GetValue();
+void Cell::Release() const {
+	GetSlot().GetState().store(ValueStore::State::DIRTY, std::memory_order_release);
 }
 
-std::string Cell::GetText() const {
-	return impl_->GetText();
+Cell::ValueView Cell::Store(const FormulaInterface::Value& evaluation) const {
+	if (std::holds_alternative<double>(evaluation)) {
+		GetSlot().Store(ValueStore::State::VALUE, std::get<double>(evaluation));
+		return std::get<double>(evaluation);
+	}
+	FormulaError error = std::get<FormulaError>(evaluation);
+	GetSlot().Store(ValueStore::State::FORMULA_ERROR, static_cast<double>(error.GetCategory()));
+	return error;
 }
 
-std::vector<Position> Cell::GetReferencedCells() const {
-	return impl_->GetReferencedCells();
+namespace {
+// formulas evaluated by the thread so far, nested ones included
+thread_local std::uint32_t evaluations = 0;
+}  // namespace
+
+Cell::ValueView Cell::Compute() const {
+	TRACE_SPAN("Formula::Evaluate");
+	perf::Add(perf::Counter::CellsEvaluated);
+	std::uint32_t first_evaluation = evaluations++;
+	FormulaInterface::Value evaluation;
+	try {
+		evaluation = std::get<FormulaContent>(content_).formula->Evaluate(sheet_);
+	}
+	catch (...) {
+		Release();
+		throw;
+	}
+	// what evicting the value would cost: this evaluation and those of the precedents it computed
+	GetSlot().AddCost(evaluations - first_evaluation);
+	return Store(evaluation);
 }
 
-bool Cell::IsReferenced() const {
-	return dependent_cells_.empty();
+Cell::ValueView Cell::ComputeUncached() const {
+	TRACE_SPAN("Formula::Evaluate");
+	perf::Add(perf::Counter::CellsEvaluated);
+	++evaluations;
+	FormulaInterface::Value evaluation = std::get<FormulaContent>(content_).formula->Evaluate(sheet_);
+	if (const double* number = std::get_if<double>(&evaluation)) {
+		return *number;
+	}
+	return std::get<FormulaError>(evaluation);
 }
 
-bool Cell::IsCacheValid() const {
-	return impl_->IsCacheValid();
+size_t Cell::ComputeBatch(const Cell* const* cells, size_t count) {
+	TRACE_SPAN("Formula::EvaluateBatch");
+	std::array<const Cell*, FORMULA_BATCH_SIZE> claimed;
+	std::array<const FormulaInterface*, FORMULA_BATCH_SIZE> formulas;
+	size_t lanes = 0;
+	for (size_t i = 0; i < count && lanes < FORMULA_BATCH_SIZE; ++i) {
+		const auto* formula = std::get_if<FormulaContent>(&cells[i]->content_);
+		if (formula && cells[i]->TryClaim()) {
+			claimed[lanes] = cells[i];
+			formulas[lanes] = formula->formula.get();
+			++lanes;
+		}
+	}
+	if (lanes == 0) {
+		return 0;
+	}
+
+	perf::Add(perf::Counter::CellsEvaluated, lanes);
+	std::array<FormulaInterface::Value, FORMULA_BATCH_SIZE> results;
+	try {
+		EvaluateFormulaBatch(formulas.data(), lanes, claimed[0]->sheet_, results.data());
+	}
+	catch (...) {
+		for (size_t i = 0; i < lanes; ++i) {
+			claimed[i]->Release();
+		}
+		throw;
+	}
+	for (size_t i = 0; i < lanes; ++i) {
+		claimed[i]->Store(results[i]);
+	}
+	return lanes;
 }
 
 
 void Cell::InvalidateCache() const {
-	impl_->InvalidateCache();
+	if (content_.index() != FORMULA) {
+		return;
+	}
+	ValueStore::Slot slot = GetSlot();
+	// nothing is cached for an evicted value
+	if (!slot) {
+		return;
+	}
+	if (IsCacheValid()) {
+		perf::Add(perf::Counter::CacheInvalidations);
+	}
+	slot.GetState().store(ValueStore::State::DIRTY, std::memory_order_release);
 }
 
 void Cell::InvalidateDependentCache() const {
 	std::unordered_set<const Cell*> visited;
 	std::stack<const Cell*> to_visit;
-	for (const Cell* cell : dependent_cells_) {
-		to_visit.push(cell);
-	}
+	auto push_dependents = [&to_visit](const Cell* cell) {
+		for (const Cell* dep_cell : cell->GetDependents()) {
+			to_visit.push(dep_cell);
+		}
+		// in a fork, the cells not copied from the base yet are linked through the base
+		for (Position pos : cell->sheet_.GetBaseDependents(cell->pos_)) {
+			if (Cell* dep_cell = cell->sheet_.MaterializeDependent(pos)) {
+				to_visit.push(dep_cell);
+			}
+		}
+	};
+	push_dependents(this);
 
 	while (!to_visit.empty()) {
 		const Cell* cell = to_visit.top();
@@ -229,27 +548,62 @@ void Cell::InvalidateDependentCache() const {
 			continue;
 		}
 		visited.insert(cell);
+		perf::Add(perf::Counter::GraphNodesVisited);
+		cell->sheet_.MarkChanged(cell->pos_);
 		if (cell->IsCacheValid()) {
 			cell->InvalidateCache();
 		}
-		for (const Cell* dep_cell : cell->dependent_cells_) {
-			to_visit.push(dep_cell);
-		}
+		push_dependents(cell);
 	}
 }
 
-bool Cell::IsCircularDependent(const Cell* source, const std::unique_ptr<Impl>& current, 
-								std::unordered_set<const Cell*>& visited) const {
-	for (Position pos : current->GetReferencedCells()) {
-		Cell* cell = dynamic_cast<Cell*>(sheet_.GetCell(pos));
-		if (source == cell) {
+bool Cell::IsCircularDependent(const std::vector<Cell*>& precedents) const {
+	if (sheet_.base_) {
+		// a fork has not linked the cells it shares with its base, so they are followed by position
+		std::unordered_set<Position, PositionHasher> visited;
+		std::stack<Position> to_visit;
+		for (const Cell* cell : precedents) {
+			to_visit.push(cell->pos_);
+		}
+		while (!to_visit.empty()) {
+			Position pos = to_visit.top();
+			to_visit.pop();
+			if (pos == pos_) {
+				return true;
+			}
+			if (!visited.insert(pos).second) {
+				continue;
+			}
+			perf::Add(perf::Counter::GraphNodesVisited);
+			if (const CellInterface* cell = sheet_.LookupCell(pos)) {
+				for (Position ref_pos : cell->GetReferencedCellsView()) {
+					to_visit.push(ref_pos);
+				}
+			}
+		}
+		return false;
+	}
+
+	// the new precedents and everything they already refer to, on any sheet
+	std::unordered_set<const Cell*> visited;
+	std::stack<const Cell*> to_visit;
+	for (const Cell* cell : precedents) {
+		to_visit.push(cell);
+	}
+
+	while (!to_visit.empty()) {
+		const Cell* cell = to_visit.top();
+		to_visit.pop();
+		if (cell == this) {
 			return true;
 		}
-		if (visited.count(cell)) {
+		if (!visited.insert(cell).second) {
 			continue;
 		}
-		visited.insert(cell);
-		return cell->IsCircularDependent(source, cell->impl_, visited);
+		perf::Add(perf::Counter::GraphNodesVisited);
+		for (const Cell* ref_cell : cell->GetPrecedents()) {
+			to_visit.push(ref_cell);
+		}
 	}
 	return false;
 }
@@ -2,44 +2,143 @@
 
 #include "common.h"
 #include "formula.h"
+#include "snapshot.h"
+#include "string_pool.h"
+#include "value_store.h"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <string_view>
 #include <unordered_set>
+#include <variant>
+#include <vector>
 
 class Sheet;
 
+// A cell of a Sheet, stored in the sheet's slabs. What the cell holds is a variant dispatched on
+// without virtual calls: nothing, a text interned in the sheet's string pool, or a shared compiled
+// formula whose value is cached in the sheet's value store. The links to other cells are kept in
+// small vectors, as most cells refer to a few others.
 class Cell : public CellInterface {
+    // activates the cells of a value store chunk created again, and moves cells while compacting
+    friend class Sheet;
+
 public:
-    Cell(SheetInterface& sheet);
+    Cell(Sheet& sheet, Position pos);
+    // Leaves other empty and without links; the cells linked to other still point to it
+    // until RedirectLinks is called.
+    Cell(Cell&& other) noexcept;
     ~Cell();
 
     void Set(std::string text) override;
+    // Empties the cell and detaches it from the cells it referenced.
     void Clear();
 
     Value GetValue() const override;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
 
+    // Texts are viewed in the sheet's string pool, formula texts are printed once and kept.
+    ValueView GetValueView() const override;
+    std::string_view GetTextView() const override;
+    Span<Position> GetReferencedCellsView() const override;
+
+    // Returns true if other cells' formulas refer to this cell.
     bool IsReferenced() const;
 
-private:
-    class Impl;
-    class EmptyImpl;
-    class TextImpl;
-    class FormulaImpl;
+    // Takes over the content and the computed value of a cell of a fork's base, sharing its formula.
+    // Links to the precedents are made only once the value has to be computed again.
+    void Restore(const SheetSnapshot::CellData& data);
+    // Links a restored cell to its precedents; does nothing for other cells.
+    void CompleteLinks();
 
-    SheetInterface& sheet_;
-    std::unique_ptr<Impl> impl_;
+    // The compiled formula, shared with snapshots and forks; null unless the cell holds a formula.
+    std::shared_ptr<const FormulaInterface> GetFormula() const;
 
-    mutable std::unordered_set<const Cell*> dependent_cells_;
-    mutable std::unordered_set<const Cell*> referenced_cells_;
+    // Positions of the cells of the same sheet that refer to this one.
+    std::vector<Position> GetDependentPositions() const;
 
-    /* functions */
-    bool IsCircularDependent(const Cell* source, const std::unique_ptr<Impl>& current, std::unordered_set<const Cell*>& visited) const;
+    // False for a formula whose value has to be computed again.
     bool IsCacheValid() const;
+
+    Position GetPosition() const {
+        return pos_;
+    }
+
+    // Computes the stale formulas of cells of the same sheet whose formulas have the same shape
+    // (see HaveSameShape) together, at most FORMULA_BATCH_SIZE of them. Cells that are computed
+    // already or by another thread are left out. Returns the number of cells computed.
+    static size_t ComputeBatch(const Cell* const* cells, size_t count);
+
+    // The cells this cell's formula refers to, without duplicates.
+    Span<const Cell*> GetPrecedents() const {
+        return {links_.data(), precedent_count_};
+    }
+
+    // Appends this cell and its precedents on the same sheet whose values need computing to order,
+    // every cell after the cells it refers to. Cells already in visited are skipped.
+    void CollectStaleCells(std::vector<const Cell*>& order, std::unordered_set<const Cell*>& visited) const;
+
+private:
+    struct TextContent {
+        StringPool::Id id;
+    };
+    struct FormulaContent {
+        std::shared_ptr<const FormulaInterface> formula;
+    };
+    // an empty cell holds std::monostate
+    using Content = std::variant<std::monostate, TextContent, FormulaContent>;
+    // indices of the alternatives
+    enum : size_t { EMPTY, TEXT, FORMULA };
+
+    Sheet& sheet_;
+    Position pos_;
+    Content content_;
+    // the cells this cell's formula refers to, then the cells whose formulas refer to this one
+    mutable std::vector<const Cell*> links_;
+    std::uint32_t precedent_count_ = 0;
+    // set for a cell restored from a fork's base until it is linked to its precedents
+    bool links_pending_ = false;
+
+    /* functions */
+    Span<const Cell*> GetDependents() const {
+        return {links_.data() + precedent_count_, links_.size() - precedent_count_};
+    }
+
+    void ReleaseContent(const Content& content);
+    // Parses a formula or interns a text.
+    Content MakeContent(const std::string& text);
+    // Sets the text of an empty cell of a sheet being loaded (see Sheet::Load): without checking for
+    // a cycle, which the sheet does once for all cells, or invalidating dependents, which are stale anyway.
+    void Load(const std::string& text);
+    // Empties a cell of a sheet whose loading failed, detaching it from its precedents.
+    void Unload();
+    // Makes content the cell's content, linking it to its precedents and invalidating the dependents,
+    // and leaves the previous one, with its text reference, in content. Changes nothing if it throws.
+    void Swap(Content& content);
+    // Publishes what the cell holds to its slot of the sheet's value store.
+    void Activate(ValueStore::Slot slot) const;
+    std::string_view GetUnescapedText() const;
+
+    // The compute-once protocol of a formula's cached value, see GetValueView.
+    ValueStore::Slot GetSlot() const;
+    // Takes over the computation of a dirty value; the caller has to Store or Release it.
+    bool TryClaim() const;
+    void Release() const;
+    ValueView Store(const FormulaInterface::Value& evaluation) const;
+    ValueView Compute() const;
+    // Computes the value of a cell whose chunk has been evicted, without storing it.
+    ValueView ComputeUncached() const;
+
+    std::vector<Cell*> ResolvePrecedents(const Content& content);
+    bool IsCircularDependent(const std::vector<Cell*>& precedents) const;
     void InvalidateCache() const;
     void InvalidateDependentCache() const;
-    void CreateEmptyCells(const std::unique_ptr<Impl>& impl);
     void RemoveInvalidLinks();
-    void AddNewLinks();
+    void AddNewLinks(const std::vector<Cell*>& precedents);
+    // Points the links of the linked cells back to this cell instead of the one it was moved from.
+    void RedirectLinks(const Cell* from) const;
+    // Frees the unused capacity of the links if it is more than their size.
+    void ShrinkLinks();
   };
@@ -0,0 +1,412 @@
+#include "checkpoint.h"
+
+#include "record_io.h"
+#include "sheet.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+using namespace record_io;
+
+namespace {
+// the magic bytes and the version of the format
+constexpr std::string_view HEADER = "SSCKP\0\0\1"sv;
+constexpr std::string_view DELTA_PREFIX = "delta-"sv;
+constexpr std::string_view EXTENSION = ".ckpt"sv;
+constexpr std::string_view TEMPORARY_EXTENSION = ".tmp"sv;
+
+enum CheckpointKind : char { BASE, DELTA };
+
+// The first frame of a checkpoint file; the frames after it hold a tile each: the band of rows and
+// the column as varints, then a record for each cell of the tile with a text.
+struct CheckpointHeader {
+    CheckpointKind kind = BASE;
+    // the checkpoint itself, or the last delta merged into a base image
+    std::uint64_t sequence = 0;
+    // the base image a delta was written on top of
+    std::uint64_t base = 0;
+};
+
+bool EndsWith(std::string_view text, std::string_view suffix) {
+    return text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+}
+
+// The sequence of a delta's file name.
+std::optional<std::uint64_t> ParseDeltaName(std::string_view name) {
+    if (name.size() <= DELTA_PREFIX.size() + EXTENSION.size() || name.substr(0, DELTA_PREFIX.size()) != DELTA_PREFIX
+        || !EndsWith(name, EXTENSION)) {
+        return std::nullopt;
+    }
+    std::string_view digits = name.substr(DELTA_PREFIX.size(), name.size() - DELTA_PREFIX.size() - EXTENSION.size());
+    if (!std::all_of(digits.begin(), digits.end(), [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+    })) {
+        return std::nullopt;
+    }
+    return std::stoull(std::string(digits));
+}
+
+CheckpointHeader ParseHeader(std::string_view payload, const std::string& path) {
+    CheckpointHeader header;
+    if (payload.empty() || (payload.front() != BASE && payload.front() != DELTA)) {
+        throw std::runtime_error("Corrupt checkpoint: "s + path);
+    }
+    header.kind = static_cast<CheckpointKind>(payload.front());
+    payload.remove_prefix(1);
+    if (!GetVarint(payload, header.sequence) || !GetVarint(payload, header.base)) {
+        throw std::runtime_error("Corrupt checkpoint: "s + path);
+    }
+    return header;
+}
+
+// Calls tile with the key and the records of every tile of the checkpoint at path, after checking
+// that it is the one expected: a delta may only be written on top of base or an older base image.
+void ReadCheckpoint(const std::string& path, CheckpointKind kind, std::uint64_t sequence, std::uint64_t base,
+    const std::function<void(std::uint64_t, std::string_view)>& tile) {
+    std::optional<CheckpointHeader> header;
+    std::uint64_t end = ReadFrames(path, HEADER, [&header, &path, kind, sequence, base, &tile](std::string_view payload) {
+        if (!header) {
+            header = ParseHeader(payload, path);
+            if (header->kind != kind || header->sequence != sequence || header->base > base) {
+                throw std::runtime_error("Unexpected checkpoint: "s + path);
+            }
+            return;
+        }
+        std::uint64_t band;
+        std::uint64_t col;
+        if (!GetVarint(payload, band) || !GetVarint(payload, col)) {
+            throw std::runtime_error("Corrupt checkpoint: "s + path);
+        }
+        tile(band << 32 | col, payload);
+    });
+    // the file was renamed into place once complete, so it cannot be torn
+    if (!header || end != std::filesystem::file_size(path)) {
+        throw std::runtime_error("Corrupt checkpoint: "s + path);
+    }
+}
+
+// A checkpoint file written next to its place, which Commit renames over it once synced.
+// Dropped without a commit, the file is removed.
+class CheckpointWriter {
+public:
+    CheckpointWriter(std::string path, const CheckpointHeader& header)
+        : path_(std::move(path))
+        , temporary_(path_ + std::string(TEMPORARY_EXTENSION))
+        , file_(OpenFile(temporary_, true)) {
+        std::string payload(1, header.kind);
+        PutVarint(payload, header.sequence);
+        PutVarint(payload, header.base);
+        Write(std::string(HEADER) + MakeFrame(payload));
+    }
+
+    ~CheckpointWriter() {
+        if (file_ >= 0) {
+            CloseFile(file_);
+            std::error_code ignored;
+            std::filesystem::remove(temporary_, ignored);
+        }
+    }
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    void WriteTile(std::uint64_t key, std::string_view records) {
+        std::string payload;
+        payload.reserve(records.size() + 10);
+        PutVarint(payload, key >> 32);
+        PutVarint(payload, key & 0xFFFFFFFF);
+        payload.append(records);
+        Write(MakeFrame(payload));
+        ++tiles_;
+    }
+
+    void Commit() {
+        SyncFile(file_);
+        CloseFile(file_);
+        file_ = -1;
+        ReplaceFile(temporary_, path_);
+    }
+
+    std::uint64_t GetTileCount() const {
+        return tiles_;
+    }
+
+    std::uint64_t GetSize() const {
+        return size_;
+    }
+
+private:
+    void Write(const std::string& data) {
+        WriteFile(file_, data);
+        size_ += data.size();
+    }
+
+    const std::string path_;
+    const std::string temporary_;
+    int file_;
+    std::uint64_t tiles_ = 0;
+    std::uint64_t size_ = 0;
+};
+}  // namespace
+
+CheckpointStore::CheckpointStore(std::string directory, size_t merge_threshold, ThreadPool& executor)
+    : directory_(std::move(directory))
+    , merge_threshold_(std::max<size_t>(merge_threshold, 1))
+    , executor_(executor) {
+    std::filesystem::create_directories(directory_);
+    std::vector<std::uint64_t> deltas;
+    for (const auto& entry : std::filesystem::directory_iterator(directory_)) {
+        std::string name = entry.path().filename().string();
+        if (EndsWith(name, TEMPORARY_EXTENSION)) {
+            // left by a checkpoint or a merge cut short
+            std::filesystem::remove(entry.path());
+        } else if (std::optional<std::uint64_t> sequence = ParseDeltaName(name)) {
+            deltas.push_back(*sequence);
+        }
+    }
+
+    const std::string base_path = GetBasePath();
+    if (std::filesystem::exists(base_path)) {
+        ReadFrames(base_path, HEADER, [this, &base_path](std::string_view payload) {
+            base_sequence_ = ParseHeader(payload, base_path).sequence;
+        }, 1);
+        has_base_ = true;
+    } else if (!deltas.empty()) {
+        throw std::runtime_error("Checkpoint deltas without a base image in "s + directory_);
+    }
+
+    last_sequence_ = base_sequence_;
+    std::sort(deltas.begin(), deltas.end());
+    for (std::uint64_t sequence : deltas) {
+        if (sequence <= base_sequence_) {
+            // merged already, by a merge cut short before removing it
+            std::filesystem::remove(GetDeltaPath(sequence));
+        } else if (sequence == last_sequence_ + 1) {
+            last_sequence_ = sequence;
+        } else {
+            throw std::runtime_error("Missing checkpoint delta "s + std::to_string(last_sequence_ + 1) + " in "s + directory_);
+        }
+    }
+}
+
+CheckpointStore::~CheckpointStore() {
+    if (merge_.valid()) {
+        merge_.wait();
+    }
+}
+
+void CheckpointStore::Checkpoint(const Sheet& sheet) {
+    TRACE_SPAN("CheckpointStore::Checkpoint");
+    bool has_base;
+    std::uint64_t base;
+    {
+        std::lock_guard lock(mutex_);
+        has_base = has_base_;
+        base = base_sequence_;
+    }
+    const std::uint64_t sequence = last_sequence_ + 1;
+    if (has_base) {
+        WriteDelta(sheet, sequence, base);
+    } else {
+        WriteBase(sheet, sequence);
+    }
+    dirty_.clear();
+
+    std::future<void> finished;
+    {
+        std::lock_guard lock(mutex_);
+        last_sequence_ = sequence;
+        if (!has_base_) {
+            has_base_ = true;
+            base_sequence_ = sequence;
+        }
+        bool merging = merge_.valid() && merge_.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        if (!merging && last_sequence_ - base_sequence_ >= merge_threshold_) {
+            finished = std::move(merge_);
+            merge_ = executor_.Submit([this, sequence] {
+                Merge(sequence);
+            });
+        }
+    }
+    if (finished.valid()) {
+        finished.get();
+    }
+}
+
+void CheckpointStore::WaitForMerge() {
+    if (merge_.valid()) {
+        std::future<void> merge = std::move(merge_);
+        merge.get();
+    }
+}
+
+size_t CheckpointStore::Restore(Sheet& sheet) {
+    TRACE_SPAN("CheckpointStore::Restore");
+    WaitForMerge();
+    std::vector<std::pair<Position, std::string>> cells;
+    auto load = [&cells](std::string_view records) {
+        Record record;
+        while (!records.empty()) {
+            if (!GetRecord(records, record) || record.kind != SET) {
+                throw std::runtime_error("Corrupt checkpoint record"s);
+            }
+            cells.emplace_back(record.pos, std::string(record.text));
+        }
+    };
+
+    if (has_base_) {
+        // the latest version of every tile a delta holds; the deltas are small
+        std::unordered_map<TileKey, std::string> tiles;
+        for (std::uint64_t sequence = base_sequence_ + 1; sequence <= last_sequence_; ++sequence) {
+            ReadCheckpoint(GetDeltaPath(sequence), DELTA, sequence, base_sequence_,
+                [&tiles](TileKey key, std::string_view records) {
+                    tiles[key].assign(records);
+                });
+        }
+        ReadCheckpoint(GetBasePath(), BASE, base_sequence_, base_sequence_,
+            [&tiles, &load](TileKey key, std::string_view records) {
+                if (tiles.count(key) == 0) {
+                    load(records);
+                }
+            });
+        for (const auto& [key, records] : tiles) {
+            load(records);
+        }
+    }
+
+    size_t loaded = cells.size();
+    sheet.Load(std::move(cells));
+    return loaded;
+}
+
+size_t CheckpointStore::GetDeltaCount() const {
+    std::lock_guard lock(mutex_);
+    return static_cast<size_t>(last_sequence_ - base_sequence_);
+}
+
+CheckpointStatistics CheckpointStore::GetStatistics() const {
+    std::lock_guard lock(mutex_);
+    return statistics_;
+}
+
+std::string CheckpointStore::GetBasePath() const {
+    return (std::filesystem::path(directory_) / ("base"s + std::string(EXTENSION))).string();
+}
+
+std::string CheckpointStore::GetDeltaPath(std::uint64_t sequence) const {
+    return (std::filesystem::path(directory_)
+        / (std::string(DELTA_PREFIX) + std::to_string(sequence) + std::string(EXTENSION))).string();
+}
+
+void CheckpointStore::WriteBase(const Sheet& sheet, std::uint64_t sequence) {
+    CheckpointWriter writer(GetBasePath(), {BASE, sequence, sequence});
+    std::uint64_t cells = 0;
+    // the tiles of one band of rows at a time, as the cells come row by row
+    int band = 0;
+    std::map<int, std::string> tiles;
+    auto write_band = [&writer, &band, &tiles] {
+        for (const auto& [col, records] : tiles) {
+            writer.WriteTile(GetTile({band * TILE_ROWS, col}), records);
+        }
+        tiles.clear();
+    };
+    sheet.ForEachText([&band, &tiles, &write_band, &cells](Position pos, std::string_view text) {
+        if (pos.row / TILE_ROWS != band) {
+            write_band();
+            band = pos.row / TILE_ROWS;
+        }
+        PutRecord(tiles[pos.col], SET, pos, text);
+        ++cells;
+    });
+    write_band();
+    writer.Commit();
+
+    std::lock_guard lock(mutex_);
+    ++statistics_.checkpoints;
+    statistics_.tiles += writer.GetTileCount();
+    statistics_.cells += cells;
+    statistics_.bytes += writer.GetSize();
+}
+
+void CheckpointStore::WriteDelta(const Sheet& sheet, std::uint64_t sequence, std::uint64_t base) {
+    std::vector<TileKey> tiles(dirty_.begin(), dirty_.end());
+    std::sort(tiles.begin(), tiles.end());
+    CheckpointWriter writer(GetDeltaPath(sequence), {DELTA, sequence, base});
+    std::uint64_t cells = 0;
+    std::string records;
+    for (TileKey key : tiles) {
+        records.clear();
+        Viewport tile{{static_cast<int>(key >> 32) * TILE_ROWS, static_cast<int>(key & 0xFFFFFFFF)}, {TILE_ROWS, 1}};
+        sheet.ForEachText([&records, &cells](Position pos, std::string_view text) {
+            PutRecord(records, SET, pos, text);
+            ++cells;
+        }, tile);
+        // a tile without records clears the cells of the older ones
+        writer.WriteTile(key, records);
+    }
+    writer.Commit();
+
+    std::lock_guard lock(mutex_);
+    ++statistics_.checkpoints;
+    statistics_.tiles += writer.GetTileCount();
+    statistics_.cells += cells;
+    statistics_.bytes += writer.GetSize();
+}
+
+void CheckpointStore::Merge(std::uint64_t last) {
+    TRACE_SPAN("CheckpointStore::Merge");
+    std::uint64_t base;
+    {
+        std::lock_guard lock(mutex_);
+        base = base_sequence_;
+    }
+    std::map<TileKey, std::string> tiles;
+    for (std::uint64_t sequence = base + 1; sequence <= last; ++sequence) {
+        ReadCheckpoint(GetDeltaPath(sequence), DELTA, sequence, base, [&tiles](TileKey key, std::string_view records) {
+            tiles[key].assign(records);
+        });
+    }
+
+    // both the base image and the deltas' tiles are in order, so the new image is written as the old
+    // one is read, without holding it
+    CheckpointWriter writer(GetBasePath(), {BASE, last, last});
+    auto next = tiles.begin();
+    auto write_deltas_before = [&writer, &tiles, &next](std::optional<TileKey> key) {
+        for (; next != tiles.end() && (!key || next->first <= *key); ++next) {
+            if (!next->second.empty()) {
+                writer.WriteTile(next->first, next->second);
+            }
+        }
+    };
+    ReadCheckpoint(GetBasePath(), BASE, base, base,
+        [&writer, &tiles, &write_deltas_before](TileKey key, std::string_view records) {
+            bool replaced = tiles.count(key) != 0;
+            write_deltas_before(key);
+            if (!replaced) {
+                writer.WriteTile(key, records);
+            }
+        });
+    write_deltas_before(std::nullopt);
+    writer.Commit();
+
+    {
+        std::lock_guard lock(mutex_);
+        base_sequence_ = last;
+        ++statistics_.merges;
+    }
+    for (std::uint64_t sequence = base + 1; sequence <= last; ++sequence) {
+        std::error_code ignored;
+        std::filesystem::remove(GetDeltaPath(sequence), ignored);
+    }
+}
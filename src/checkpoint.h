@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common.h"
+#include "thread_pool.h"
+#include "value_store.h"
+
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+class Sheet;
+
+// What a CheckpointStore has written since it was opened.
+struct CheckpointStatistics {
+    // the first base image included
+    std::uint64_t checkpoints = 0;
+    // what checkpoints wrote; merges rewrite the base image on top of that
+    std::uint64_t tiles = 0;
+    std::uint64_t cells = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t merges = 0;
+};
+
+// Checkpoints of the texts of a sheet's cells in a local directory, from which the sheet can be
+// restored after a restart: a base image of the whole sheet and deltas on top of it.
+// The sheet is divided into tiles of TILE_ROWS rows of one column, the chunks of its value store.
+// The sheet marks the tile of every edited cell dirty (see Sheet::SetCheckpoints), and a checkpoint
+// writes only the dirty tiles with all their cells, so that its cost grows with the cells edited
+// since the previous one rather than with the sheet. Each delta names the base image it was written
+// on top of. Once merge_threshold deltas have piled up, a task of the executor merges them into a
+// new base image; it reads the files only, so the sheet may be edited and checkpointed meanwhile.
+// Every file is written next to its place and renamed over it once synced, so a crash leaves
+// either the previous checkpoint or the new one.
+// Not thread-safe, apart from the merge: only the writer of the sheet may call the methods.
+class CheckpointStore {
+public:
+    static constexpr int TILE_ROWS = ValueStore::CHUNK_ROWS;
+
+    // Opens the checkpoints in directory, creating it if needed. Throws std::runtime_error if some
+    // delta is missing.
+    explicit CheckpointStore(std::string directory, size_t merge_threshold = 8,
+        ThreadPool& executor = ThreadPool::Shared());
+    // Waits for the merge in progress.
+    ~CheckpointStore();
+
+    CheckpointStore(const CheckpointStore&) = delete;
+    CheckpointStore& operator=(const CheckpointStore&) = delete;
+
+    void MarkDirty(Position pos) {
+        dirty_.insert(GetTile(pos));
+    }
+
+    size_t GetDirtyTileCount() const {
+        return dirty_.size();
+    }
+
+    // Writes the dirty tiles of sheet as a delta, or the whole sheet as the base image if there is
+    // none yet, and starts a merge if enough deltas have piled up. The sheet must be the one restored
+    // from the checkpoints, or the one checkpointed first, with its edits marked since. Throws
+    // std::runtime_error if writing fails, leaving the tiles dirty, or if a merge finished since
+    // has failed, after writing.
+    void Checkpoint(const Sheet& sheet);
+
+    // Waits for the merge in progress, if any, and rethrows its failure.
+    void WaitForMerge();
+
+    // Loads the base image with the deltas on top into a sheet without content, with Sheet::Load,
+    // and returns the number of cells loaded. Waits for the merge in progress first. Throws
+    // std::runtime_error for a corrupt checkpoint.
+    size_t Restore(Sheet& sheet);
+
+    // Deltas not merged into the base image yet.
+    size_t GetDeltaCount() const;
+
+    CheckpointStatistics GetStatistics() const;
+
+private:
+    // the band of rows in the high half, the column in the low one, so that keys sort row-major
+    using TileKey = std::uint64_t;
+
+    static TileKey GetTile(Position pos) {
+        return static_cast<TileKey>(pos.row / TILE_ROWS) << 32 | static_cast<std::uint32_t>(pos.col);
+    }
+
+    std::string GetBasePath() const;
+    std::string GetDeltaPath(std::uint64_t sequence) const;
+    void WriteBase(const Sheet& sheet, std::uint64_t sequence);
+    void WriteDelta(const Sheet& sheet, std::uint64_t sequence, std::uint64_t base);
+    // Merges the deltas up to last into the base image; runs on the executor.
+    void Merge(std::uint64_t last);
+
+    const std::string directory_;
+    const size_t merge_threshold_;
+    ThreadPool& executor_;
+    std::unordered_set<TileKey> dirty_;
+    std::future<void> merge_;
+
+    // guards what a merge updates
+    mutable std::mutex mutex_;
+    bool has_base_ = false;
+    // the last checkpoint merged into the base image
+    std::uint64_t base_sequence_ = 0;
+    // the last checkpoint written; deltas follow the base image up to it
+    std::uint64_t last_sequence_ = 0;
+    CheckpointStatistics statistics_;
+};
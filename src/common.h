@@ -1,10 +1,14 @@
 #pragma once
 
+#include <charconv>
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -13,25 +17,214 @@ struct Position {
     int row = 0;
     int col = 0;
 
-    bool operator==(Position rhs) const;
-    bool operator<(Position rhs) const;
+    constexpr bool operator==(Position rhs) const {
+        return row == rhs.row && col == rhs.col;
+    }
+    constexpr bool operator<(Position rhs) const {
+        return row < rhs.row || (row == rhs.row && col < rhs.col);
+    }
 
-    bool IsValid() const;
+    constexpr bool IsValid() const {
+        return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
+    }
     std::string ToString() const;
 
-    static Position FromString(std::string_view str);
+    // Position::NONE unless the whole string is a valid reference, see PositionFromChars.
+    static constexpr Position FromString(std::string_view str);
 
     static const int MAX_ROWS = 16384;
     static const int MAX_COLS = 16384;
+    // the longest reference is XFD16384
+    static const int MAX_LETTERS = 3;
+    static const int MAX_STRING_LENGTH = 8;
     static const Position NONE;
 };
 
+// A valid position packed into 32 bits, the row in the high half. The keys are ordered
+// like the positions, so they serve as compact sort and hash keys.
+class PositionKey {
+public:
+    constexpr PositionKey() = default;
+    constexpr explicit PositionKey(Position pos)
+        : value_(static_cast<std::uint32_t>(pos.row) << 16 | static_cast<std::uint32_t>(pos.col)) {
+    }
+
+    constexpr Position ToPosition() const {
+        return {static_cast<int>(value_ >> 16), static_cast<int>(value_ & 0xFFFF)};
+    }
+    constexpr std::uint32_t GetValue() const {
+        return value_;
+    }
+
+    constexpr bool operator==(PositionKey rhs) const {
+        return value_ == rhs.value_;
+    }
+    constexpr bool operator!=(PositionKey rhs) const {
+        return value_ != rhs.value_;
+    }
+    constexpr bool operator<(PositionKey rhs) const {
+        return value_ < rhs.value_;
+    }
+
+private:
+    std::uint32_t value_ = 0;
+};
+
+// Mixes the packed key, so that tables with a power-of-two number of buckets, which use its low
+// bits, do not put every cell of a column into the same bucket.
+struct PositionHasher {
+    size_t operator()(Position pos) const {
+        return Mix(PositionKey(pos).GetValue());
+    }
+    size_t operator()(PositionKey key) const {
+        return Mix(key.GetValue());
+    }
+
+private:
+    static size_t Mix(std::uint32_t value) {
+        // Fibonacci hashing: the high half of the product depends on every bit of the key
+        return static_cast<size_t>((value * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+};
+
+// A1 notation without allocations, in the manner of std::from_chars and std::to_chars.
+// Unlike those before C++23 they can be evaluated at compile time.
+
+// Reads a reference such as "B12" from the beginning of [first, last): one to three capital
+// letters followed by digits. On success pos is set and ptr points past the digits. Otherwise pos
+// is unchanged and ec is std::errc::invalid_argument with ptr == first, or
+// std::errc::result_out_of_range for a reference beyond the limits of a sheet.
+constexpr std::from_chars_result PositionFromChars(const char* first, const char* last, Position& pos) {
+    const char* it = first;
+    int col = 0;
+    int letters = 0;
+    for (; it != last && *it >= 'A' && *it <= 'Z'; ++it) {
+        if (++letters > Position::MAX_LETTERS) {
+            return {first, std::errc::invalid_argument};
+        }
+        col = col * 26 + (*it - 'A' + 1);
+    }
+    if (letters == 0 || it == last || *it < '0' || *it > '9') {
+        return {first, std::errc::invalid_argument};
+    }
+
+    int row = 0;
+    bool too_large = false;
+    for (; it != last && *it >= '0' && *it <= '9'; ++it) {
+        too_large = too_large || row > Position::MAX_ROWS;
+        row = too_large ? row : row * 10 + (*it - '0');
+    }
+    Position result{row - 1, col - 1};
+    if (too_large || !result.IsValid()) {
+        return {it, std::errc::result_out_of_range};
+    }
+    pos = result;
+    return {it, std::errc{}};
+}
+
+// Writes a valid position to [first, last) without a terminating zero; ec is
+// std::errc::value_too_large with ptr == last if it does not fit, and std::errc::invalid_argument
+// with ptr == first for an invalid position.
+constexpr std::to_chars_result PositionToChars(char* first, char* last, Position pos) {
+    if (!pos.IsValid()) {
+        return {first, std::errc::invalid_argument};
+    }
+    char letters[Position::MAX_LETTERS] = {};
+    int letter_count = 0;
+    for (int col = pos.col; col >= 0; col = col / 26 - 1) {
+        letters[letter_count++] = static_cast<char>('A' + col % 26);
+    }
+    char digits[Position::MAX_STRING_LENGTH] = {};
+    int digit_count = 0;
+    for (int row = pos.row + 1; row > 0; row /= 10) {
+        digits[digit_count++] = static_cast<char>('0' + row % 10);
+    }
+    if (last - first < letter_count + digit_count) {
+        return {last, std::errc::value_too_large};
+    }
+    while (letter_count > 0) {
+        *first++ = letters[--letter_count];
+    }
+    while (digit_count > 0) {
+        *first++ = digits[--digit_count];
+    }
+    return {first, std::errc{}};
+}
+
+inline constexpr Position Position::NONE = {-1, -1};
+
+constexpr Position Position::FromString(std::string_view str) {
+    Position pos = NONE;
+    auto [ptr, ec] = PositionFromChars(str.data(), str.data() + str.size(), pos);
+    return ec == std::errc{} && ptr == str.data() + str.size() ? pos : NONE;
+}
+
+// Reads references separated by separator from [first, last), appending them to positions.
+// Stops at the end, after a reference not followed by separator, or at an invalid reference,
+// whose error is returned; ptr points where reading stopped.
+std::from_chars_result PositionsFromChars(const char* first, const char* last, char separator,
+                                          std::vector<Position>& positions);
+
+// Writes the positions separated by separator to [first, last). Stops at the first position
+// that does not fit or is invalid, with the error of PositionToChars.
+std::to_chars_result PositionsToChars(char* first, char* last, const Position* positions, size_t count,
+                                      char separator);
+
+// A cell of a named sheet of a workbook, written as Sheet2!B3 in formulas.
+struct SheetPosition {
+    std::string sheet;
+    Position pos;
+
+    bool operator==(const SheetPosition& rhs) const;
+    bool operator<(const SheetPosition& rhs) const;
+
+    std::string ToString() const;
+};
+
+// A read-only view of contiguous elements owned elsewhere, like std::span of C++20.
+template <typename T>
+class Span {
+public:
+    constexpr Span() = default;
+    constexpr Span(const T* data, size_t size)
+        : data_(data)
+        , size_(size) {
+    }
+    Span(const std::vector<T>& elements)
+        : data_(elements.data())
+        , size_(elements.size()) {
+    }
+
+    constexpr const T* begin() const {
+        return data_;
+    }
+    constexpr const T* end() const {
+        return data_ + size_;
+    }
+    constexpr const T& operator[](size_t index) const {
+        return data_[index];
+    }
+    constexpr size_t size() const {
+        return size_;
+    }
+    constexpr bool empty() const {
+        return size_ == 0;
+    }
+
+    std::vector<T> ToVector() const {
+        return std::vector<T>(begin(), end());
+    }
+
+private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
 struct Size {
     int rows = 0;
     int cols = 0;
 
     bool operator==(Size rhs) const;
-    Size operator= (Size rhs);
 };
 
 // Describes errors that can occur during formula calculations.
@@ -96,6 +289,8 @@ class CellInterface {
 public:
     // Either the cell's text, the formula's value, or an error message from the formula
     using Value = std::variant<std::string, double, FormulaError>;
+    // Value without a copy of the text.
+    using ValueView = std::variant<std::string_view, double, FormulaError>;
 
     virtual ~CellInterface() = default;
 
@@ -103,16 +298,42 @@ public:
     // Returns the visible value of the cell. 
     // For a text cell, it's the text (without escape characters). 
     // For a formula, it's the numeric value of the formula or an error message
-    virtual Value GetValue() const = 0;
+    virtual Value GetValue() const {
+        return std::visit([](auto value) -> Value {
+            if constexpr (std::is_same_v<decltype(value), std::string_view>) {
+                return std::string(value);
+            } else {
+                return value;
+            }
+        }, GetValueView());
+    }
     // Returns the internal text of the cell as if we started editing it. 
     // For a text cell, it's the text (possibly containing escape characters). 
     // For a formula, it's its expression.
-    virtual std::string GetText() const = 0;
+    virtual std::string GetText() const {
+        return std::string(GetTextView());
+    }
 
     // Returns a list of cells that are directly involved in the formula. 
     // The list is sorted in ascending order and does not contain duplicate cells. 
     // For a text cell, the list is empty.
-    virtual std::vector<Position> GetReferencedCells() const = 0;
+    virtual std::vector<Position> GetReferencedCells() const {
+        return GetReferencedCellsView().ToVector();
+    }
+
+    // The same as the three methods above, without allocating: the views point into the cell
+    // (or its sheet) and stay valid until the cell is modified or the sheet compacted.
+    virtual ValueView GetValueView() const = 0;
+    virtual std::string_view GetTextView() const = 0;
+    virtual Span<Position> GetReferencedCellsView() const = 0;
+
+protected:
+    // A view of a value held by the cell.
+    static ValueView View(const Value& value) {
+        return std::visit([](const auto& alternative) -> ValueView {
+            return alternative;
+        }, value);
+    }
 };
 
 inline constexpr char FORMULA_SIGN = '=';
@@ -152,6 +373,12 @@ public:
     // An empty cell is represented as an empty string in either case.
     virtual void PrintValues(std::ostream& output) const = 0;
     virtual void PrintTexts(std::ostream& output) const = 0;
+
+    // Returns the sheet of the same workbook with the given name, or nullptr.
+    // Formulas use it to evaluate references to other sheets like Sheet2!B3.
+    virtual const SheetInterface* FindSheet(std::string_view name) const {
+        return nullptr;
+    }
 };
 
 // Creates a ready-to-use empty table
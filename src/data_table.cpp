@@ -0,0 +1,205 @@
+#include "data_table.h"
+
+#include "cell.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+// The compiled formula of a cell, shared with the sheet where possible.
+std::shared_ptr<const FormulaInterface> FormulaOf(const CellInterface& cell) {
+    if (auto* sheet_cell = dynamic_cast<const Cell*>(&cell)) {
+        return sheet_cell->GetFormula();
+    }
+    if (auto* snapshot_cell = dynamic_cast<const SheetSnapshot::CellData*>(&cell)) {
+        return snapshot_cell->formula;
+    }
+    std::string_view text = cell.GetTextView();
+    if (text.size() > 1 && text.front() == FORMULA_SIGN) {
+        return ParseFormula(std::string(text.substr(1)));
+    }
+    return nullptr;
+}
+
+// A cell of the overlay holding a value of one tuple.
+class ValueCell final : public CellInterface {
+public:
+    void Set(std::string) override {
+        throw std::logic_error("Data table cells are read-only");
+    }
+    ValueView GetValueView() const override {
+        return View(value);
+    }
+    std::string_view GetTextView() const override {
+        return {};
+    }
+    Span<Position> GetReferencedCellsView() const override {
+        return {};
+    }
+
+    Value value;
+};
+}  // namespace
+
+// The sheet as seen by the formulas of one tuple: the inputs and the affected cells
+// come from the overlay, every other cell from the sheet.
+class DataTable::Overlay final : public SheetInterface {
+public:
+    explicit Overlay(const DataTable& table)
+        : table_(table)
+        , cells_(table.slots_.size()) {
+    }
+
+    ValueCell& operator[](size_t slot) {
+        return cells_[slot];
+    }
+
+    void SetCell(Position, std::string) override {
+        throw std::logic_error("Data table overlays are read-only");
+    }
+    void ClearCell(Position) override {
+        throw std::logic_error("Data table overlays are read-only");
+    }
+
+    const CellInterface* GetCell(Position pos) const override {
+        auto it = table_.slots_.find(pos);
+        return it == table_.slots_.end() ? table_.sheet_.GetCell(pos) : &cells_[it->second];
+    }
+    CellInterface* GetCell(Position pos) override {
+        return const_cast<CellInterface*>(std::as_const(*this).GetCell(pos));
+    }
+
+    Size GetPrintableSize() const override {
+        return table_.sheet_.GetPrintableSize();
+    }
+    void PrintValues(std::ostream&) const override {
+        throw std::logic_error("Data table overlays cannot be printed");
+    }
+    void PrintTexts(std::ostream&) const override {
+        throw std::logic_error("Data table overlays cannot be printed");
+    }
+
+    // other sheets are not affected by the inputs
+    const SheetInterface* FindSheet(std::string_view name) const override {
+        return table_.sheet_.FindSheet(name);
+    }
+
+private:
+    const DataTable& table_;
+    std::vector<ValueCell> cells_;
+};
+
+DataTable::DataTable(const SheetInterface& sheet, std::vector<Position> inputs, std::vector<Position> outputs)
+    : sheet_(sheet)
+    , inputs_(std::move(inputs))
+    , outputs_(std::move(outputs)) {
+    for (Position pos : inputs_) {
+        if (!pos.IsValid()) {
+            throw InvalidPositionException("Invalid data table input");
+        }
+        if (!slots_.emplace(pos, slots_.size()).second) {
+            throw std::invalid_argument("Duplicate data table input: " + pos.ToString());
+        }
+    }
+
+    // Post-order walk from the outputs towards their precedents. A cell is affected
+    // if it is an input or refers to an affected cell; the walk stops at the inputs.
+    std::unordered_map<Position, bool, PositionHasher> affected;
+    std::vector<std::pair<Position, bool>> stack;
+    for (Position pos : outputs_) {
+        if (!pos.IsValid()) {
+            throw InvalidPositionException("Invalid data table output");
+        }
+        stack.emplace_back(pos, false);
+    }
+
+    while (!stack.empty()) {
+        auto [pos, expanded] = stack.back();
+        stack.pop_back();
+        if (affected.count(pos)) {
+            continue;
+        }
+        if (slots_.count(pos)) {
+            affected.emplace(pos, true);
+            continue;
+        }
+
+        const CellInterface* cell = sheet_.GetCell(pos);
+        Span<Position> precedents = cell ? cell->GetReferencedCellsView() : Span<Position>{};
+        if (!expanded) {
+            stack.emplace_back(pos, true);
+            for (Position precedent : precedents) {
+                if (!affected.count(precedent)) {
+                    stack.emplace_back(precedent, false);
+                }
+            }
+            continue;
+        }
+
+        bool is_affected = std::any_of(precedents.begin(), precedents.end(), [&affected](Position precedent) {
+            auto it = affected.find(precedent);
+            return it != affected.end() && it->second;
+        });
+        affected.emplace(pos, is_affected);
+        if (is_affected) {
+            slots_.emplace(pos, slots_.size());
+            affected_.push_back({pos, FormulaOf(*cell)});
+        }
+    }
+}
+
+std::vector<DataTable::Values> DataTable::Evaluate(const std::vector<Values>& tuples, ThreadPool& executor) const {
+    TRACE_SPAN("DataTable::Evaluate");
+    for (const Values& tuple : tuples) {
+        if (tuple.size() != inputs_.size()) {
+            throw std::invalid_argument("A data table tuple must hold a value per input");
+        }
+    }
+
+    std::vector<Values> result(tuples.size());
+    // a few chunks per worker even out tuples of different cost
+    size_t chunk_count = std::min(tuples.size(), executor.Size() * 4);
+    std::vector<std::future<void>> chunks;
+    chunks.reserve(chunk_count);
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        size_t begin = tuples.size() * chunk / chunk_count;
+        size_t end = tuples.size() * (chunk + 1) / chunk_count;
+        chunks.push_back(executor.Submit([this, &tuples, &result, begin, end] {
+            Overlay overlay(*this);
+            for (size_t i = begin; i < end; ++i) {
+                result[i] = EvaluateTuple(tuples[i], overlay);
+            }
+        }));
+    }
+    // every task has to finish before an exception leaves this function
+    for (auto& chunk : chunks) {
+        chunk.wait();
+    }
+    for (auto& chunk : chunks) {
+        chunk.get();
+    }
+    return result;
+}
+
+DataTable::Values DataTable::EvaluateTuple(const Values& tuple, Overlay& overlay) const {
+    for (size_t i = 0; i < tuple.size(); ++i) {
+        overlay[i].value = tuple[i];
+    }
+    for (size_t i = 0; i < affected_.size(); ++i) {
+        overlay[inputs_.size() + i].value = std::visit([](auto value) -> CellInterface::Value {
+            return value;
+        }, affected_[i].formula->Evaluate(overlay));
+    }
+
+    Values outputs;
+    outputs.reserve(outputs_.size());
+    for (Position pos : outputs_) {
+        const CellInterface* cell = overlay.GetCell(pos);
+        outputs.push_back(cell ? cell->GetValue() : CellInterface::Value());
+    }
+    return outputs;
+}
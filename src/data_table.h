@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+#include "thread_pool.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// A what-if table over a sheet: the values of the output cells for each tuple of values
+// of the input cells, as if the inputs had been set to them.
+// The sheet is never modified. The formulas depending on the inputs are found once on construction;
+// each tuple is then evaluated on a private overlay of those cells, so tuples are computed
+// in parallel and the cached values of the sheet stay valid.
+// Like any reader, a table must not be used while the sheet is being modified, and has to be
+// built again after the sheet has changed.
+class DataTable {
+public:
+    using Values = std::vector<CellInterface::Value>;
+
+    // Throws InvalidPositionException if a position is invalid and std::invalid_argument
+    // if an input is given twice.
+    DataTable(const SheetInterface& sheet, std::vector<Position> inputs, std::vector<Position> outputs);
+
+    // Returns a row of output values per tuple, in the order of the outputs.
+    // Each tuple holds a value per input; a text is seen by formulas like the text of a cell.
+    // Throws std::invalid_argument if a tuple does not match the inputs.
+    std::vector<Values> Evaluate(const std::vector<Values>& tuples,
+                                 ThreadPool& executor = ThreadPool::Shared()) const;
+
+    // Formula cells evaluated again for every tuple.
+    size_t GetAffectedCellCount() const {
+        return affected_.size();
+    }
+
+private:
+    class Overlay;
+
+    struct AffectedCell {
+        Position pos;
+        std::shared_ptr<const FormulaInterface> formula;
+    };
+
+    Values EvaluateTuple(const Values& tuple, Overlay& overlay) const;
+
+    const SheetInterface& sheet_;
+    std::vector<Position> inputs_;
+    std::vector<Position> outputs_;
+    // every formula cell after the cells it refers to
+    std::vector<AffectedCell> affected_;
+    // slots of the overlay: the inputs first, then the affected cells
+    std::unordered_map<Position, size_t, PositionHasher> slots_;
+};
@@ -0,0 +1,217 @@
+#include "edit_log.h"
+
+#include "record_io.h"
+#include "sheet.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+using namespace record_io;
+
+namespace {
+// the magic bytes and the version of the format
+constexpr std::string_view HEADER = "SSWAL\0\0\1"sv;
+// snapshots are written in frames of about this size
+constexpr size_t SNAPSHOT_FRAME_SIZE = 1 << 20;
+}  // namespace
+
+EditLog::EditLog(std::string path)
+    : path_(std::move(path)) {
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(path_, error);
+    if (error || size < HEADER.size()) {
+        // a crash may cut the header of a new log short; it holds no records yet
+        file_ = OpenFile(path_, true);
+        WriteFile(file_, HEADER);
+        SyncFile(file_);
+        SyncDirectory(path_);
+        file_size_ = HEADER.size();
+        return;
+    }
+    file_size_ = ReadFrames(path_, HEADER, [](std::string_view) {});
+    if (file_size_ < size) {
+        // a torn frame would hide the frames appended after it
+        std::filesystem::resize_file(path_, file_size_);
+    }
+    Open();
+}
+
+EditLog::~EditLog() {
+    try {
+        Commit();
+    }
+    catch (...) {
+        // the records are lost, as in a crash
+    }
+    Close();
+}
+
+std::uint64_t EditLog::AppendSet(Position pos, std::string_view text) {
+    std::lock_guard lock(mutex_);
+    PutRecord(buffer_, SET, pos, text);
+    ++statistics_.records;
+    return ++appended_;
+}
+
+std::uint64_t EditLog::AppendClear(Position pos) {
+    std::lock_guard lock(mutex_);
+    PutRecord(buffer_, CLEAR, pos);
+    ++statistics_.records;
+    return ++appended_;
+}
+
+void EditLog::Commit() {
+    std::uint64_t sequence;
+    {
+        std::lock_guard lock(mutex_);
+        sequence = appended_;
+    }
+    Commit(sequence);
+}
+
+void EditLog::Commit(std::uint64_t sequence) {
+    std::unique_lock lock(mutex_);
+    sequence = std::min(sequence, appended_);
+    while (durable_ < sequence) {
+        if (failure_) {
+            std::rethrow_exception(failure_);
+        }
+        if (committing_) {
+            // the records appended before that commit started may not cover ours
+            committed_.wait(lock);
+            continue;
+        }
+
+        // writes the records of every thread waiting, and of those appending meanwhile, at once
+        TRACE_SPAN("EditLog::Commit");
+        committing_ = true;
+        std::string frame = MakeFrame(buffer_);
+        buffer_.clear();
+        const std::uint64_t last = appended_;
+        lock.unlock();
+        try {
+            WriteFile(file_, frame);
+            SyncFile(file_);
+        }
+        catch (...) {
+            lock.lock();
+            failure_ = std::current_exception();
+            committing_ = false;
+            committed_.notify_all();
+            throw;
+        }
+        lock.lock();
+        committing_ = false;
+        durable_ = last;
+        file_size_ += frame.size();
+        ++statistics_.commits;
+        statistics_.committed_bytes += frame.size();
+        committed_.notify_all();
+    }
+}
+
+size_t EditLog::Replay(Sheet& sheet) {
+    TRACE_SPAN("EditLog::Replay");
+    Commit();
+    std::unordered_map<Position, std::string, PositionHasher> texts;
+    size_t records = 0;
+    ReadFrames(path_, HEADER, [&texts, &records](std::string_view payload) {
+        Record record;
+        while (!payload.empty()) {
+            if (!GetRecord(payload, record)) {
+                throw std::runtime_error("Corrupt edit log record"s);
+            }
+            if (record.kind == SET) {
+                texts[record.pos].assign(record.text);
+            } else {
+                texts.erase(record.pos);
+            }
+            ++records;
+        }
+    });
+
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(texts.size());
+    for (auto& [pos, text] : texts) {
+        cells.emplace_back(pos, std::move(text));
+    }
+    sheet.Load(std::move(cells));
+    return records;
+}
+
+void EditLog::Compact(const Sheet& sheet) {
+    TRACE_SPAN("EditLog::Compact");
+    std::unique_lock lock(mutex_);
+    committed_.wait(lock, [this] {
+        return !committing_;
+    });
+    if (failure_) {
+        std::rethrow_exception(failure_);
+    }
+
+    const std::string temporary = path_ + ".compact";
+    int file = OpenFile(temporary, true);
+    std::uint64_t size = HEADER.size();
+    try {
+        WriteFile(file, HEADER);
+        std::string payload;
+        auto write_frame = [&payload, &size, file] {
+            std::string frame = MakeFrame(payload);
+            WriteFile(file, frame);
+            size += frame.size();
+            payload.clear();
+        };
+        sheet.ForEachText([&payload, &write_frame](Position pos, std::string_view text) {
+            PutRecord(payload, SET, pos, text);
+            if (payload.size() >= SNAPSHOT_FRAME_SIZE) {
+                write_frame();
+            }
+        });
+        if (!payload.empty()) {
+            write_frame();
+        }
+        SyncFile(file);
+    }
+    catch (...) {
+        CloseFile(file);
+        std::error_code ignored;
+        std::filesystem::remove(temporary, ignored);
+        throw;
+    }
+    CloseFile(file);
+
+    Close();
+    ReplaceFile(temporary, path_);
+    Open();
+    // the snapshot holds what the buffered records would have set
+    buffer_.clear();
+    durable_ = appended_;
+    file_size_ = size;
+    committed_.notify_all();
+}
+
+EditLogStatistics EditLog::GetStatistics() const {
+    std::lock_guard lock(mutex_);
+    return statistics_;
+}
+
+std::uint64_t EditLog::GetFileSize() const {
+    std::lock_guard lock(mutex_);
+    return file_size_;
+}
+
+void EditLog::Open() {
+    file_ = OpenFile(path_, false);
+}
+
+void EditLog::Close() {
+    if (file_ >= 0) {
+        CloseFile(file_);
+        file_ = -1;
+    }
+}
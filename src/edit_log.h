@@ -0,0 +1,83 @@
+#pragma once
+
+#include "common.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+class Sheet;
+
+// What an EditLog has done since it was opened.
+struct EditLogStatistics {
+    std::uint64_t records = 0;
+    // writes of buffered records followed by a sync of the file, each covering a group of records
+    std::uint64_t commits = 0;
+    std::uint64_t committed_bytes = 0;
+};
+
+// An append-only write-ahead log of the texts set to the cells of a sheet, kept in a local file,
+// from which the sheet can be restored after a restart (see Sheet::SetEditLog and Replay).
+// A record takes a kind byte, the row and the column as varints, and for a set cell the length of
+// its text as a varint and the text. Records are buffered until committed; a commit writes them as
+// one frame, which starts with its size and checksum, and syncs the file. Several threads may
+// append and commit at once: the first one to commit writes and syncs the records of all of them,
+// while the others wait for it instead of syncing again. A frame torn by a crash is cut off when
+// the log is opened again.
+class EditLog {
+public:
+    // Opens the log at path, creating it if needed. Throws std::runtime_error if the file cannot be
+    // opened or written, or holds something else than an edit log.
+    explicit EditLog(std::string path);
+    // Commits what is buffered.
+    ~EditLog();
+
+    EditLog(const EditLog&) = delete;
+    EditLog& operator=(const EditLog&) = delete;
+
+    // Return the sequence number of the record, counted from 1 since the log was opened.
+    std::uint64_t AppendSet(Position pos, std::string_view text);
+    std::uint64_t AppendClear(Position pos);
+
+    // Returns once the records up to sequence are on disk; all appended so far without one.
+    // Throws std::runtime_error if writing fails, then and for every later commit.
+    void Commit(std::uint64_t sequence);
+    void Commit();
+
+    // Loads the last text of each cell in the log into a sheet without content, with Sheet::Load.
+    // Returns the number of records read. Commits first, so that appended records are read as well.
+    size_t Replay(Sheet& sheet);
+
+    // Replaces the log with a snapshot of sheet: a record for each cell with a text. The snapshot is
+    // written to a file next to the log and renamed over it once synced, so a crash leaves either
+    // log complete. The sheet must hold every edit appended so far, which the snapshot makes durable;
+    // it must not be modified meanwhile.
+    void Compact(const Sheet& sheet);
+
+    EditLogStatistics GetStatistics() const;
+
+    // Bytes of the log on disk.
+    std::uint64_t GetFileSize() const;
+
+private:
+    void Open();
+    void Close();
+
+    const std::string path_;
+    int file_ = -1;
+    mutable std::mutex mutex_;
+    // signalled when a commit ends
+    std::condition_variable committed_;
+    // records appended and not written yet
+    std::string buffer_;
+    std::uint64_t appended_ = 0;
+    std::uint64_t durable_ = 0;
+    // a thread is writing and syncing a frame
+    bool committing_ = false;
+    std::exception_ptr failure_;
+    std::uint64_t file_size_ = 0;
+    EditLogStatistics statistics_;
+};
@@ -0,0 +1,41 @@
+#include "epoch.h"
+
+#include <algorithm>
+#include <thread>
+
+EpochManager::Guard EpochManager::Pin() {
+    thread_local size_t hint = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    while (true) {
+        for (size_t i = 0; i < MAX_READERS; ++i) {
+            Slot& slot = slots_[(hint + i) % MAX_READERS];
+            std::uint64_t expected = INACTIVE;
+            std::uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+            if (slot.epoch.compare_exchange_strong(expected, epoch, std::memory_order_seq_cst)) {
+                hint += i;
+                return Guard(&slot.epoch);
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::Retire(std::shared_ptr<const void> object) {
+    // readers pinned at this epoch or earlier may still hold the object
+    std::uint64_t epoch = global_epoch_.fetch_add(1, std::memory_order_seq_cst);
+    retired_.emplace_back(epoch, std::move(object));
+}
+
+void EpochManager::Collect() {
+    std::uint64_t oldest_pinned = UINT64_MAX;
+    for (const Slot& slot : slots_) {
+        std::uint64_t epoch = slot.epoch.load(std::memory_order_seq_cst);
+        if (epoch != INACTIVE) {
+            oldest_pinned = std::min(oldest_pinned, epoch);
+        }
+    }
+
+    retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [oldest_pinned](const auto& retired) {
+                       return retired.first < oldest_pinned;
+                   }),
+                   retired_.end());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation for objects that lock-free readers may still be looking at.
+// A reader pins the current epoch before loading a shared pointer and unpins it when done.
+// The writer retires replaced objects; they are destroyed once every reader that could
+// have seen them has unpinned.
+// Pinning is lock-free and may be done from any thread; Retire and Collect belong to the writer.
+class EpochManager {
+public:
+    // The number of readers that can be pinned at once; further readers wait for a free slot.
+    static constexpr size_t MAX_READERS = 128;
+
+    class Guard {
+    public:
+        Guard() = default;
+        Guard(Guard&& other) noexcept
+            : slot_(std::exchange(other.slot_, nullptr)) {
+        }
+        Guard& operator=(Guard&& other) noexcept {
+            Release();
+            slot_ = std::exchange(other.slot_, nullptr);
+            return *this;
+        }
+        ~Guard() {
+            Release();
+        }
+
+    private:
+        friend class EpochManager;
+        explicit Guard(std::atomic<std::uint64_t>* slot)
+            : slot_(slot) {
+        }
+        void Release() {
+            if (slot_) {
+                slot_->store(INACTIVE, std::memory_order_release);
+                slot_ = nullptr;
+            }
+        }
+
+        std::atomic<std::uint64_t>* slot_ = nullptr;
+    };
+
+    EpochManager() = default;
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Must be called before loading the protected pointer.
+    Guard Pin();
+
+    // Hands over an object that has just been unlinked from the shared pointer.
+    void Retire(std::shared_ptr<const void> object);
+
+    // Destroys retired objects that no pinned reader can reach any more.
+    void Collect();
+
+    size_t RetiredCount() const {
+        return retired_.size();
+    }
+
+private:
+    static constexpr std::uint64_t INACTIVE = 0;
+
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{INACTIVE};
+    };
+
+    std::atomic<std::uint64_t> global_epoch_{1};
+    std::array<Slot, MAX_READERS> slots_;
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<const void>>> retired_;
+};
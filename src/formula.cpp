@@ -1,12 +1,19 @@
 #include "formula.h"
 
 #include "FormulaAST.h"
+#include "lru_cache.h"
+#include "perf_counters.h"
+#include "statistics.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
 #include <sstream>
-#include <regex>
+#include <stdexcept>
 
 using namespace std::literals;
 
@@ -14,12 +21,44 @@ std::ostream& operator<<(std::ostream& output, FormulaError fe) {
     return output << fe.ToString();
 }
 
+std::optional<double> ParseNumber(std::string_view text) {
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?
+    auto is_digit = [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c)) != 0;
+    };
+    size_t i = !text.empty() && text[0] == '-' ? 1 : 0;
+    size_t integer_begin = i;
+    while (i < text.size() && is_digit(text[i])) {
+        ++i;
+    }
+    if (i == integer_begin || (i - integer_begin > 1 && text[integer_begin] == '0')) {
+        return std::nullopt;
+    }
+    if (i < text.size() && text[i] == '.') {
+        size_t fraction_begin = ++i;
+        while (i < text.size() && is_digit(text[i])) {
+            ++i;
+        }
+        if (i == fraction_begin) {
+            return std::nullopt;
+        }
+    }
+    if (i != text.size()) {
+        return std::nullopt;
+    }
+
+    double value = std::strtod(std::string(text).c_str(), nullptr);
+    // out of the range of double
+    if (!std::isfinite(value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
 namespace {
-	double CellValueHandler(std::string text) {
-        static const std::regex double_pattern("^(-?)(0|([1-9][0-9]*))(\\.[0-9]+)?$");
-        std::smatch double_match;
-        if (std::regex_match(text, double_match, double_pattern)) {
-            return std::stod(text);
+	double CellValueHandler(std::string_view text) {
+        if (auto number = ParseNumber(text)) {
+            return *number;
         }
 
         throw FormulaError(FormulaError::Category::Value);
@@ -35,55 +74,375 @@ namespace {
 }
 
 namespace {
+// What parsing an expression yields, whatever cell it was written for.
+struct CompiledExpression {
+    explicit CompiledExpression(const std::string& expression)
+        :ast(ParseFormulaAST(expression)), referenced_cells(ast.GetCells().begin(),ast.GetCells().end()),
+        referenced_sheet_cells(ast.GetSheetCells().begin(), ast.GetSheetCells().end())
+    {
+        std::sort(referenced_cells.begin(), referenced_cells.end());
+        referenced_cells.erase(std::unique(referenced_cells.begin(), referenced_cells.end()), 
+                               referenced_cells.end());
+        // the AST keeps them sorted
+        referenced_sheet_cells.erase(std::unique(referenced_sheet_cells.begin(), referenced_sheet_cells.end()),
+                                     referenced_sheet_cells.end());
+    }
+
+    size_t GetMemoryUsage() const {
+        size_t result = sizeof(*this) - sizeof(ast) + ast.GetMemoryUsage()
+            + referenced_cells.capacity() * sizeof(Position)
+            + referenced_sheet_cells.capacity() * sizeof(SheetPosition);
+        for (const SheetPosition& cell : referenced_sheet_cells) {
+            result += cell.sheet.capacity();
+        }
+        return result;
+    }
+
+    FormulaAST ast;
+    std::vector<Position> referenced_cells;
+    std::vector<SheetPosition> referenced_sheet_cells;
+};
+
+// The bytes of a string's buffer, unless the string is short enough to be stored inline.
+size_t GetHeapBytes(const std::string& text) {
+    return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+}
+
+// Shared by every sheet and thread; the texts are expressions without the formula sign.
+ShardedLruCache<std::shared_ptr<const CompiledExpression>>& GetParseCache() {
+    static ShardedLruCache<std::shared_ptr<const CompiledExpression>> cache(PARSE_CACHE_CAPACITY);
+    return cache;
+}
+}  // namespace
+
+struct FormulaTemplates::Template {
+    Template(std::shared_ptr<const CompiledExpression> compiled, Position origin,
+             std::shared_ptr<MemoryCounter> memory_usage = nullptr)
+        : compiled(std::move(compiled))
+        , origin(origin)
+        , memory_usage(std::move(memory_usage))
+        , own_bytes(sizeof(*this) + this->compiled->GetMemoryUsage()) {
+        AddMemory(own_bytes);
+    }
+
+    ~Template() {
+        SubtractMemory(own_bytes);
+    }
+
+    // Counts memory of the template's formulas for the FormulaTemplates that made it, if any.
+    void AddMemory(size_t bytes) const {
+        if (memory_usage) {
+            memory_usage->fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    void SubtractMemory(size_t bytes) const {
+        if (memory_usage) {
+            memory_usage->fetch_sub(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    std::shared_ptr<const CompiledExpression> compiled;
+    // the cell the expression was written for
+    Position origin;
+    std::shared_ptr<MemoryCounter> memory_usage;
+    // the compiled expression is counted by each template sharing it
+    size_t own_bytes;
+};
+
+namespace {
+Position Shifted(Position pos, Position shift) {
+    return {pos.row + shift.row, pos.col + shift.col};
+}
+
+// A compiled formula moved by shift rows and columns from the cell it was parsed for.
 class Formula : public FormulaInterface {
 public:
-// Реализуйте следующие методы:
-    explicit Formula(std::string expression)
-        :ast_(ParseFormulaAST(expression)),referenced_cells_(ast_.GetCells().begin(),ast_.GetCells().end())
-    {
-        std::sort(referenced_cells_.begin(), referenced_cells_.end());
-        referenced_cells_.erase(std::unique(referenced_cells_.begin(), referenced_cells_.end()), 
-                                referenced_cells_.end());
+    using Template = FormulaTemplates::Template;
+
+    Formula(std::shared_ptr<const Template> compiled, Position shift)
+        : template_(std::move(compiled))
+        , shift_(shift) {
+        if (!(shift_ == Position{0, 0})) {
+            // a shift keeps the order
+            referenced_cells_ = template_->compiled->referenced_cells;
+            for (Position& cell : referenced_cells_) {
+                cell = Shifted(cell, shift_);
+            }
+        }
+        template_->AddMemory(GetMemoryUsage());
+    }
+
+    ~Formula() {
+        template_->SubtractMemory(GetMemoryUsage());
     }
 
     Value Evaluate(const SheetInterface& sheet) const override {
         try {
-            auto cell_value = [&sheet](Position pos) {
-                if (auto* cell = sheet.GetCell(pos)) {
+            auto cell_value = [&sheet, shift = shift_](std::string_view sheet_name, Position pos) {
+                pos = Shifted(pos, shift);
+                const SheetInterface* source = &sheet;
+                if (!sheet_name.empty()) {
+                    source = sheet.FindSheet(sheet_name);
+                    if (!source) {
+                        throw FormulaError(FormulaError::Category::Ref);
+                    }
+                }
+                if (auto* cell = source->GetCell(pos)) {
                     return std::visit([](auto value) {
                         return CellValueHandler(value);
-                        }, cell->GetValue());
+                        }, cell->GetValueView());
                 }
                 return 0.0;
             };
-            return ast_.Execute(cell_value);
+            return template_->compiled->ast.Execute(cell_value);
         }
         catch (const FormulaError& formula_error) {
             return formula_error;
         }
     }
     std::vector<Position> GetReferencedCells() const override {
-        return referenced_cells_;
+        return GetReferencedCellsView().ToVector();
+    }
+
+    Span<Position> GetReferencedCellsView() const override {
+        return referenced_cells_.empty() ? template_->compiled->referenced_cells : referenced_cells_;
+    }
+
+    std::vector<SheetPosition> GetReferencedSheetCells() const override {
+        std::vector<SheetPosition> cells = template_->compiled->referenced_sheet_cells;
+        for (SheetPosition& cell : cells) {
+            cell.pos = Shifted(cell.pos, shift_);
+        }
+        return cells;
     }
 
     std::string GetExpression() const override {
         std::ostringstream os;
-        ast_.PrintFormula(os);
+        template_->compiled->ast.PrintFormula(os, shift_);
         return os.str();
     }
 
+    std::string_view GetCanonicalText() const override {
+        std::call_once(text_printed_, [this] {
+            text_ = FORMULA_SIGN + GetExpression();
+            template_->AddMemory(GetHeapBytes(text_));
+        });
+        return text_;
+    }
+
+    const Template* GetTemplate() const {
+        return template_.get();
+    }
+
+    Position GetShift() const {
+        return shift_;
+    }
+
 private:
-    FormulaAST ast_;
+    // the text counts once printed
+    size_t GetMemoryUsage() const {
+        return sizeof(*this) + referenced_cells_.capacity() * sizeof(Position) + GetHeapBytes(text_);
+    }
+
+    std::shared_ptr<const Template> template_;
+    Position shift_;
+    // the template's cells moved by the shift, unless it is zero
     std::vector<Position> referenced_cells_;
+    mutable std::once_flag text_printed_;
+    mutable std::string text_;
 };
+
+// Parses the expression unless the same text is in the parse cache.
+std::shared_ptr<const FormulaTemplates::Template> Compile(const std::string& expression, Position origin,
+                                                          std::shared_ptr<FormulaTemplates::MemoryCounter> memory_usage = nullptr) {
+    auto compiled = GetParseCache().GetOrCreate(expression, [&expression] {
+        perf::Add(perf::Counter::FormulasParsed);
+        try {
+            return std::make_shared<const CompiledExpression>(expression);
+        }
+        catch(std::exception& e){
+            throw FormulaException(e.what());
+        }
+    });
+    return std::make_shared<FormulaTemplates::Template>(std::move(compiled), origin, std::move(memory_usage));
+}
+
+bool IsNameChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// The expression with every reference replaced by its offset from pos, as in [0,-1]+1 for =A1+1 in B1.
+// Returns an empty key for expressions that cannot be shared.
+std::string TemplateKey(const std::string& expression, Position pos) {
+    // the offsets must not be confused with the text around them
+    if (expression.find('[') != std::string::npos) {
+        return {};
+    }
+
+    std::string key;
+    key.reserve(expression.size() + 8);
+    for (size_t i = 0; i < expression.size();) {
+        if (!IsNameChar(expression[i])) {
+            key += expression[i++];
+            continue;
+        }
+        size_t end = i;
+        while (end < expression.size() && IsNameChar(expression[end])) {
+            ++end;
+        }
+        std::string_view word(expression.data() + i, end - i);
+        Position cell = Position::NONE;
+        // a name followed by '!' is a sheet, as in Sheet2!B3
+        if (end == expression.size() || expression[end] != '!') {
+            cell = Position::FromString(word);
+        }
+        if (cell.IsValid()) {
+            key += '[';
+            key += std::to_string(cell.row - pos.row);
+            key += ',';
+            key += std::to_string(cell.col - pos.col);
+            key += ']';
+        } else {
+            key += word;
+        }
+        i = end;
+    }
+    return key;
+}
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
-    try {
-        return std::make_unique<Formula>(std::move(expression));
-    } 
-    catch(std::exception& e){
-        throw FormulaException(e.what());
+    return std::make_unique<Formula>(Compile(expression, {0, 0}), Position{0, 0});
+}
+
+bool HaveSameShape(const FormulaInterface& lhs, const FormulaInterface& rhs) {
+    auto* lhs_formula = dynamic_cast<const Formula*>(&lhs);
+    auto* rhs_formula = dynamic_cast<const Formula*>(&rhs);
+    return lhs_formula && rhs_formula && lhs_formula->GetTemplate() == rhs_formula->GetTemplate();
+}
+
+static_assert(FORMULA_BATCH_SIZE == FormulaAST::BATCH_SIZE);
+
+void EvaluateFormulaBatch(const FormulaInterface* const* formulas, size_t count, const SheetInterface& sheet,
+                          FormulaInterface::Value* results) {
+    if (count == 0) {
+        return;
+    }
+    if (count > FORMULA_BATCH_SIZE) {
+        throw std::invalid_argument("Too many formulas for a batch");
+    }
+    std::array<Position, FORMULA_BATCH_SIZE> shifts;
+    for (size_t i = 0; i < count; ++i) {
+        if (!HaveSameShape(*formulas[0], *formulas[i])) {
+            throw std::invalid_argument("Formulas of a batch must have the same shape");
+        }
+        shifts[i] = static_cast<const Formula*>(formulas[i])->GetShift();
+    }
+
+    // gathers the cell of every lane; an error only stops the lane it occurs in
+    auto cell_values = [&sheet, &shifts, count](std::string_view sheet_name, Position pos, double* values,
+                                                std::optional<FormulaError>* errors) {
+        const SheetInterface* source = sheet_name.empty() ? &sheet : sheet.FindSheet(sheet_name);
+        for (size_t lane = 0; lane < count; ++lane) {
+            values[lane] = 0.0;
+            if (errors[lane]) {
+                continue;
+            }
+            try {
+                if (!source) {
+                    throw FormulaError(FormulaError::Category::Ref);
+                }
+                if (auto* cell = source->GetCell(Shifted(pos, shifts[lane]))) {
+                    values[lane] = std::visit([](auto value) {
+                        return CellValueHandler(value);
+                        }, cell->GetValueView());
+                }
+            }
+            catch (const FormulaError& formula_error) {
+                errors[lane] = formula_error;
+            }
+        }
+    };
+
+    std::array<double, FORMULA_BATCH_SIZE> values;
+    std::array<std::optional<FormulaError>, FORMULA_BATCH_SIZE> errors;
+    auto* compiled = static_cast<const Formula*>(formulas[0])->GetTemplate();
+    compiled->compiled->ast.ExecuteBatch(cell_values, count, values.data(), errors.data());
+    for (size_t i = 0; i < count; ++i) {
+        if (errors[i]) {
+            results[i] = *errors[i];
+        } else {
+            results[i] = values[i];
+        }
+    }
+}
+
+ParseCacheStatistics GetParseCacheStatistics() {
+    auto statistics = GetParseCache().GetStatistics();
+    return {statistics.hits, statistics.misses, statistics.evictions, statistics.size};
+}
+
+void ClearParseCache() {
+    GetParseCache().Clear();
+}
+
+FormulaTemplates::FormulaTemplates()
+    : purge_size_(64)
+    , memory_usage_(std::make_shared<MemoryCounter>(0)) {
+}
+
+FormulaTemplates::~FormulaTemplates() = default;
+
+std::unique_ptr<FormulaInterface> FormulaTemplates::Parse(const std::string& expression, Position pos) {
+    std::string key = TemplateKey(expression, pos);
+    if (key.empty()) {
+        return std::make_unique<Formula>(Compile(expression, pos, memory_usage_), Position{0, 0});
     }
 
+    std::shared_ptr<const Template> compiled;
+    if (auto it = templates_.find(key); it != templates_.end()) {
+        compiled = it->second.lock();
+    }
+    if (!compiled) {
+        compiled = Compile(expression, pos, memory_usage_);
+        if (templates_.size() >= purge_size_) {
+            PurgeExpired();
+        }
+        size_t key_bytes = GetHeapBytes(key);
+        if (auto [it, inserted] = templates_.try_emplace(std::move(key), compiled); inserted) {
+            key_bytes_ += key_bytes;
+        } else {
+            it->second = compiled;
+        }
+    }
+    Position shift{pos.row - compiled->origin.row, pos.col - compiled->origin.col};
+    return std::make_unique<Formula>(std::move(compiled), shift);
+}
+
+size_t FormulaTemplates::GetMemoryUsage() const {
+    return memory_usage_->load(std::memory_order_relaxed) + EstimateHashTableBytes(templates_) + key_bytes_;
+}
+
+void FormulaTemplates::Shrink() {
+    PurgeExpired();
+    ShrinkHashTable(templates_);
+}
+
+void FormulaTemplates::PurgeExpired() {
+    for (auto it = templates_.begin(); it != templates_.end();) {
+        if (it->second.expired()) {
+            key_bytes_ -= GetHeapBytes(it->first);
+            it = templates_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    purge_size_ = std::max<size_t>(64, templates_.size() * 2);
+}
+
+size_t FormulaTemplates::GetSize() const {
+    return std::count_if(templates_.begin(), templates_.end(), [](const auto& entry) {
+        return !entry.second.expired();
+    });
 }
\ No newline at end of file
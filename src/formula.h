@@ -2,12 +2,18 @@
 
 #include "common.h"
 
+#include <atomic>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 // This is a description of a formula that can calculate and update arithmetic expressions with the following supported features:
 // - Simple binary operations and numbers, including parentheses: For example, "1+2*3", "2.5*(2+3.5/7)".
 // - Cell values are used as variables: For example, "A1+B2*C3".
+// - Cells of other sheets of the workbook are prefixed with the sheet name: For example, "Sheet2!B3*2".
 // The cells mentioned in the formula can contain either formulas or text. 
 // If they contain text, but represent a number, they should be treated as numbers. 
 // An empty cell or a cell with empty text is interpreted as the number zero.
@@ -27,11 +33,96 @@ public:
     // It does not contain spaces or unnecessary parentheses.
     virtual std::string GetExpression() const = 0;
 
+    // FORMULA_SIGN followed by the expression: the text of a cell holding the formula.
+    // Printed by the first caller and kept, so it can be viewed as long as the formula.
+    virtual std::string_view GetCanonicalText() const = 0;
+
    // This method returns a list of cells that are directly involved in the formula's calculation. 
    // The list is sorted in ascending order and does not contain duplicate cells.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+    // The same list without a copy, valid as long as the formula.
+    virtual Span<Position> GetReferencedCellsView() const = 0;
+
+    // The cells of other sheets involved in the calculation, sorted and without duplicates.
+    virtual std::vector<SheetPosition> GetReferencedSheetCells() const = 0;
 };
 
+// The number formulas read a text as, like -12.5; nullopt for any other text.
+std::optional<double> ParseNumber(std::string_view text);
+
 // Parses the provided expression and returns a formula object. 
 // It throws a FormulaException if the formula is syntactically incorrect.
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Compiled expressions are kept by their text in a process-wide cache of this many entries,
+// which drops the least recently used ones first, so setting a text parsed before does not
+// parse it again. The cache may be used from several threads at once.
+inline constexpr size_t PARSE_CACHE_CAPACITY = 4096;
+
+struct ParseCacheStatistics {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;  // texts that were parsed
+    std::uint64_t evictions = 0;
+    size_t size = 0;
+};
+
+ParseCacheStatistics GetParseCacheStatistics();
+
+// Drops every cached expression and resets the statistics.
+void ClearParseCache();
+
+// Shares compiled formulas between cells holding the same formula shifted by rows and columns,
+// like the cells of a filled-down column: =A1*B1, =A2*B2, ... Expressions are compared with every
+// cell reference replaced by its offset from the formula's cell, so the later cells of such a column
+// are not parsed at all; their formulas refer to the first one's and only keep their own shift.
+class FormulaTemplates {
+public:
+    FormulaTemplates();
+    ~FormulaTemplates();
+
+    FormulaTemplates(const FormulaTemplates&) = delete;
+    FormulaTemplates& operator=(const FormulaTemplates&) = delete;
+
+    // Like ParseFormula for the formula of the cell at pos.
+    std::unique_ptr<FormulaInterface> Parse(const std::string& expression, Position pos);
+
+    // Compiled formulas currently shared by at least one formula.
+    size_t GetSize() const;
+
+    // Bytes taken by the formulas made here and their templates, whichever sheet or snapshot
+    // holds them now, and by the index of the templates. Formulas update it as they are created,
+    // printed and destroyed, so it may be read at any time.
+    size_t GetMemoryUsage() const;
+
+    // Drops the templates no formula is made from any more and frees the unused buckets of the index.
+    void Shrink();
+
+    // a compiled formula together with the cell it was parsed for; defined in formula.cpp
+    struct Template;
+    using MemoryCounter = std::atomic<size_t>;
+
+private:
+    void PurgeExpired();
+
+    // a template lives as long as the formulas made from it
+    std::unordered_map<std::string, std::weak_ptr<const Template>> templates_;
+    // expired entries are dropped once the map grows this large
+    size_t purge_size_;
+    // shared with the templates, which may outlive this object
+    std::shared_ptr<MemoryCounter> memory_usage_;
+    // the buffers of the keys
+    size_t key_bytes_ = 0;
+};
+
+// True if both formulas were made from one template by FormulaTemplates::Parse,
+// so that they differ only by the cells they refer to.
+bool HaveSameShape(const FormulaInterface& lhs, const FormulaInterface& rhs);
+
+// The number of formulas EvaluateFormulaBatch takes at most.
+inline constexpr size_t FORMULA_BATCH_SIZE = 64;
+
+// Evaluates formulas of the same shape at once: results[i] receives what formulas[i]->Evaluate(sheet)
+// returns. The expression is computed for all of them together, one operation at a time.
+// Throws std::invalid_argument if the shapes differ or there are more than FORMULA_BATCH_SIZE formulas.
+void EvaluateFormulaBatch(const FormulaInterface* const* formulas, size_t count, const SheetInterface& sheet,
+                          FormulaInterface::Value* results);
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// The edits that can be undone and redone, newest last, at most depth of each. The undo entries are
+// kept in a ring, so recording an edit once the journal is full overwrites the oldest one instead
+// of allocating. Entries that are dropped, because the journal is full or a new edit makes the redo
+// entries obsolete, are passed to drop first, so that their owner can release what they refer to.
+// Not thread-safe.
+template <typename Entry>
+class EditJournal {
+public:
+    explicit EditJournal(size_t depth)
+        : depth_(depth) {
+    }
+
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    size_t GetDepth() const {
+        return depth_;
+    }
+
+    // Drops the oldest entries to undo beyond the new depth, then the entries to redo furthest
+    // from the current state, as both together never exceed the depth.
+    template <typename Drop>
+    void SetDepth(size_t depth, Drop drop) {
+        std::vector<Entry> undo;
+        undo.reserve(std::min(undo_count_, depth));
+        for (size_t i = 0; i < undo_count_; ++i) {
+            Entry& entry = undo_[(undo_first_ + i) % undo_.size()];
+            if (undo_count_ - i > depth) {
+                drop(entry);
+            } else {
+                undo.push_back(std::move(entry));
+            }
+        }
+        undo_ = std::move(undo);
+        undo_first_ = 0;
+        undo_count_ = undo_.size();
+
+        if (undo_count_ + redo_.size() > depth) {
+            // the last redo entry is the next one to redo
+            auto kept = redo_.end() - (depth - undo_count_);
+            std::for_each(redo_.begin(), kept, drop);
+            redo_.erase(redo_.begin(), kept);
+        }
+        depth_ = depth;
+    }
+
+    // Records a new edit, which makes the redo entries obsolete.
+    template <typename Drop>
+    void Record(Entry entry, Drop drop) {
+        std::for_each(redo_.begin(), redo_.end(), drop);
+        redo_.clear();
+        if (depth_ == 0) {
+            drop(entry);
+            return;
+        }
+        if (undo_count_ == depth_) {
+            drop(undo_[undo_first_]);
+            undo_[undo_first_] = std::move(entry);
+            undo_first_ = (undo_first_ + 1) % undo_.size();
+            return;
+        }
+        PushUndo(std::move(entry));
+    }
+
+    // The newest entry to undo, taken out of the journal.
+    std::optional<Entry> PopUndo() {
+        if (undo_count_ == 0) {
+            return std::nullopt;
+        }
+        --undo_count_;
+        return std::move(undo_[(undo_first_ + undo_count_) % undo_.size()]);
+    }
+
+    // Puts back an entry taken by PopUndo, or one that has been redone, leaving the redo entries.
+    // There is always room for it, as the entries to undo and to redo come from the same ones.
+    void PushUndo(Entry entry) {
+        if (undo_count_ < undo_.size()) {
+            undo_[(undo_first_ + undo_count_) % undo_.size()] = std::move(entry);
+        } else {
+            // the ring only wraps around once it is as large as the depth
+            undo_.push_back(std::move(entry));
+        }
+        ++undo_count_;
+    }
+
+    std::optional<Entry> PopRedo() {
+        if (redo_.empty()) {
+            return std::nullopt;
+        }
+        std::optional<Entry> result(std::move(redo_.back()));
+        redo_.pop_back();
+        return result;
+    }
+
+    // An entry that has been undone, or one taken by PopRedo and put back.
+    void PushRedo(Entry entry) {
+        redo_.push_back(std::move(entry));
+    }
+
+    size_t GetUndoCount() const {
+        return undo_count_;
+    }
+
+    size_t GetRedoCount() const {
+        return redo_.size();
+    }
+
+private:
+    size_t depth_;
+    // undo_count_ entries from undo_first_ on, wrapping around
+    std::vector<Entry> undo_;
+    size_t undo_first_ = 0;
+    size_t undo_count_ = 0;
+    std::vector<Entry> redo_;
+};
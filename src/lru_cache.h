@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// A bounded map from strings to values that drops the least recently used entries first.
+// Keys are spread over SHARDS independently locked parts, each holding its share of the
+// capacity, so threads looking up different keys rarely wait for each other.
+// Values are copied out, so they should be cheap to copy, like shared pointers.
+template <typename Value, size_t SHARDS = 16>
+class ShardedLruCache {
+public:
+    struct Statistics {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        size_t size = 0;
+    };
+
+    explicit ShardedLruCache(size_t capacity)
+        : shard_capacity_(std::max<size_t>(1, (capacity + SHARDS - 1) / SHARDS)) {
+    }
+
+    ShardedLruCache(const ShardedLruCache&) = delete;
+    ShardedLruCache& operator=(const ShardedLruCache&) = delete;
+
+    // The value of the key, or the one create() returns, which is then stored.
+    // create is called without a lock held, so two threads missing the same key may both call it;
+    // the first value stored is kept. Nothing is stored if create throws.
+    template <typename Create>
+    Value GetOrCreate(std::string_view key, Create create) {
+        Shard& shard = GetShard(key);
+        {
+            std::lock_guard lock(shard.mutex);
+            if (auto it = shard.index.find(key); it != shard.index.end()) {
+                ++shard.statistics.hits;
+                shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+                return it->second->second;
+            }
+            ++shard.statistics.misses;
+        }
+
+        Value value = create();
+        std::lock_guard lock(shard.mutex);
+        if (auto it = shard.index.find(key); it != shard.index.end()) {
+            return it->second->second;
+        }
+        if (shard.entries.size() >= shard_capacity_) {
+            shard.index.erase(shard.entries.back().first);
+            shard.entries.pop_back();
+            ++shard.statistics.evictions;
+        }
+        shard.entries.emplace_front(std::string(key), std::move(value));
+        shard.index.emplace(shard.entries.front().first, shard.entries.begin());
+        return shard.entries.front().second;
+    }
+
+    // Drops every entry and resets the statistics.
+    void Clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            shard.index.clear();
+            shard.entries.clear();
+            shard.statistics = {};
+        }
+    }
+
+    // The sums over all shards, each read under its lock.
+    Statistics GetStatistics() const {
+        Statistics result;
+        for (const Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            result.hits += shard.statistics.hits;
+            result.misses += shard.statistics.misses;
+            result.evictions += shard.statistics.evictions;
+            result.size += shard.entries.size();
+        }
+        return result;
+    }
+
+    size_t GetCapacity() const {
+        return shard_capacity_ * SHARDS;
+    }
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        // the most recently used first
+        std::list<std::pair<std::string, Value>> entries;
+        // the keys view the strings of the entries
+        std::unordered_map<std::string_view, typename std::list<std::pair<std::string, Value>>::iterator> index;
+        Statistics statistics;
+    };
+
+    Shard& GetShard(std::string_view key) {
+        return shards_[std::hash<std::string_view>{}(key) % SHARDS];
+    }
+
+    size_t shard_capacity_;
+    std::array<Shard, SHARDS> shards_;
+};
@@ -1,14 +1,33 @@
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <limits>
+#include <thread>
+#include <unordered_set>
+#include "FormulaAST.h"
+#include "alloc_tracker.h"
+#include "benchmark.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "data_table.h"
+#include "edit_log.h"
 #include "formula.h"
+#include "lru_cache.h"
+#include "perf_counters.h"
+#include "sheet.h"
+#include "trace.h"
+#include "workbook.h"
 #include "test_runner_p.h"
 
+using namespace std::literals;
+
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
 }
 
-inline Position operator"" _pos(const char* str, std::size_t) {
-    return Position::FromString(str);
+constexpr Position operator"" _pos(const char* str, std::size_t size) {
+    return Position::FromString(std::string_view(str, size));
 }
 
 inline std::ostream& operator<<(std::ostream& output, Size size) {
@@ -74,6 +93,794 @@ void TestStringToPositionInvalid() {
     ASSERT(!Position::FromString("ABCDEFGHIJKLMNOPQRS8").IsValid());
 }
 
+void TestPositionCharsConversion() {
+    static_assert("AB12"_pos == Position{11, 27});
+    static_assert(PositionKey("B2"_pos).ToPosition() == "B2"_pos);
+
+    // references are read from the beginning of a buffer
+    std::string_view text = "XFD16384+A1";
+    Position pos;
+    auto [ptr, ec] = PositionFromChars(text.data(), text.data() + text.size(), pos);
+    ASSERT(ec == std::errc{});
+    ASSERT_EQUAL(ptr - text.data(), 8);
+    ASSERT_EQUAL(pos, (Position{Position::MAX_ROWS - 1, Position::MAX_COLS - 1}));
+    for (std::string_view invalid : {"a1", "A", "ABCD1", "1A", ""}) {
+        auto result = PositionFromChars(invalid.data(), invalid.data() + invalid.size(), pos);
+        ASSERT(result.ec == std::errc::invalid_argument && result.ptr == invalid.data());
+    }
+    for (std::string_view too_large : {"XFE1", "A16385", "A99999999999999999999"}) {
+        auto result = PositionFromChars(too_large.data(), too_large.data() + too_large.size(), pos);
+        ASSERT(result.ec == std::errc::result_out_of_range && result.ptr == too_large.data() + too_large.size());
+    }
+
+    char buffer[Position::MAX_STRING_LENGTH];
+    auto written = PositionToChars(buffer, buffer + sizeof(buffer), "XFD16384"_pos);
+    ASSERT(written.ec == std::errc{});
+    ASSERT_EQUAL(std::string_view(buffer, written.ptr - buffer), "XFD16384"sv);
+    ASSERT(PositionToChars(buffer, buffer + 3, "AA10"_pos).ec == std::errc::value_too_large);
+    ASSERT(PositionToChars(buffer, buffer + sizeof(buffer), Position::NONE).ec == std::errc::invalid_argument);
+
+    // lists of references
+    std::vector<Position> positions;
+    std::string_view list = "A1,B2,ZZ300;C3";
+    auto read = PositionsFromChars(list.data(), list.data() + list.size(), ',', positions);
+    ASSERT(read.ec == std::errc{});
+    ASSERT_EQUAL(std::string_view(read.ptr), ";C3"sv);
+    ASSERT_EQUAL(positions, (std::vector<Position>{"A1"_pos, "B2"_pos, "ZZ300"_pos}));
+    std::string_view bad_list = "A1,B0";
+    positions.clear();
+    ASSERT(PositionsFromChars(bad_list.data(), bad_list.data() + bad_list.size(), ',', positions).ec
+           == std::errc::result_out_of_range);
+    ASSERT_EQUAL(positions.size(), 1u);
+
+    char list_buffer[32];
+    std::vector<Position> to_write{"A1"_pos, "B2"_pos, "ZZ300"_pos};
+    auto list_written = PositionsToChars(list_buffer, list_buffer + sizeof(list_buffer), to_write.data(),
+                                         to_write.size(), ' ');
+    ASSERT(list_written.ec == std::errc{});
+    ASSERT_EQUAL(std::string_view(list_buffer, list_written.ptr - list_buffer), "A1 B2 ZZ300"sv);
+    ASSERT(PositionsToChars(list_buffer, list_buffer + 6, to_write.data(), to_write.size(), ' ').ec
+           == std::errc::value_too_large);
+
+    // packed keys order like positions
+    std::vector<Position> sorted{"B1"_pos, "A2"_pos, "XFD1"_pos, "A16384"_pos};
+    std::vector<PositionKey> keys;
+    for (Position position : sorted) {
+        keys.emplace_back(position);
+    }
+    ASSERT(std::is_sorted(keys.begin(), keys.end()) == std::is_sorted(sorted.begin(), sorted.end()));
+    std::sort(sorted.begin(), sorted.end());
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ASSERT_EQUAL(keys[i].ToPosition(), sorted[i]);
+    }
+
+    // the cells of a column spread over the buckets of a power-of-two table
+    constexpr size_t BUCKETS = 1024;
+    std::unordered_set<size_t> buckets;
+    for (int row = 0; row < static_cast<int>(BUCKETS); ++row) {
+        buckets.insert(PositionHasher{}(Position{row, 3}) % BUCKETS);
+    }
+    ASSERT(buckets.size() > BUCKETS / 2);
+}
+
+void TestParseCache() {
+    {
+        ShardedLruCache<int, 1> cache(2);
+        auto value = [](int result) {
+            return [result] { return result; };
+        };
+        ASSERT_EQUAL(cache.GetOrCreate("a", value(1)), 1);
+        ASSERT_EQUAL(cache.GetOrCreate("b", value(2)), 2);
+        ASSERT_EQUAL(cache.GetOrCreate("a", value(10)), 1);
+        // b is the least recently used
+        ASSERT_EQUAL(cache.GetOrCreate("c", value(3)), 3);
+        ASSERT_EQUAL(cache.GetOrCreate("a", value(10)), 1);
+        ASSERT_EQUAL(cache.GetOrCreate("b", value(20)), 20);
+        try {
+            cache.GetOrCreate("d", []() -> int {
+                throw std::runtime_error("failed");
+            });
+            ASSERT(false);
+        } catch (const std::runtime_error&) {
+        }
+        auto statistics = cache.GetStatistics();
+        ASSERT_EQUAL(statistics.hits, 2u);
+        ASSERT_EQUAL(statistics.misses, 5u);
+        ASSERT_EQUAL(statistics.evictions, 2u);
+        ASSERT_EQUAL(statistics.size, 2u);
+        cache.Clear();
+        ASSERT_EQUAL(cache.GetStatistics().size, 0u);
+        ASSERT_EQUAL(cache.GetOrCreate("a", value(100)), 100);
+    }
+
+    // a text set again, in any cell of any sheet, is not parsed again
+    perf::Reset();
+    ClearParseCache();
+    Workbook workbook;
+    Sheet& first = workbook.AddSheet("First");
+    Sheet& second = workbook.AddSheet("Second");
+    first.SetCell("A1"_pos, "1");
+    second.SetCell("A1"_pos, "2");
+    first.SetCell("B1"_pos, "=A1*10+First!A1");
+    first.SetCell("B1"_pos, "=A1*10+First!A1");
+    second.SetCell("C7"_pos, "=A1*10+First!A1");
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 1u);
+    ASSERT_EQUAL(first.GetCell("B1"_pos)->GetValue(), CellInterface::Value(11.0));
+    ASSERT_EQUAL(second.GetCell("C7"_pos)->GetValue(), CellInterface::Value(21.0));
+    ASSERT_EQUAL(second.GetCell("C7"_pos)->GetText(), "=A1*10+First!A1");
+
+    // errors are not cached
+    for (int i = 0; i < 2; ++i) {
+        try {
+            first.SetCell("B2"_pos, "=1+");
+            ASSERT(false);
+        } catch (const FormulaException&) {
+        }
+    }
+    // B1 was set again from the template of the sheet, without looking at the cache
+    ParseCacheStatistics statistics = GetParseCacheStatistics();
+    ASSERT_EQUAL(statistics.hits, 1u);
+    ASSERT_EQUAL(statistics.misses, 3u);
+    ASSERT_EQUAL(statistics.size, 1u);
+
+    // import threads share the cache
+    constexpr int THREADS = 4;
+    constexpr int TEXTS = 50;
+    ClearParseCache();
+    std::vector<std::future<bool>> imports;
+    for (int i = 0; i < THREADS; ++i) {
+        imports.push_back(std::async(std::launch::async, [] {
+            bool ok = true;
+            for (int text = 0; text < TEXTS; ++text) {
+                std::string expression = "B" + std::to_string(text + 1) + "*2";
+                ok = ok && ParseFormula(expression)->GetExpression() == expression;
+            }
+            return ok;
+        }));
+    }
+    for (auto& import : imports) {
+        ASSERT(import.get());
+    }
+    statistics = GetParseCacheStatistics();
+    ASSERT_EQUAL(statistics.hits + statistics.misses, static_cast<std::uint64_t>(THREADS * TEXTS));
+    ASSERT_EQUAL(statistics.size, static_cast<size_t>(TEXTS));
+}
+
+void TestFormulaSimplification() {
+    auto simplified = [](const std::string& expression) {
+        std::ostringstream out;
+        ParseFormulaAST(expression).PrintEvaluated(out);
+        return out.str();
+    };
+    ASSERT_EQUAL(simplified("A1*(60*60*24)"), "(* A1 86400)");
+    ASSERT_EQUAL(simplified("+(+A1)"), "A1");
+    ASSERT_EQUAL(simplified("-(-(-A1))"), "(- A1)");
+    ASSERT_EQUAL(simplified("-(2*3)+A1*1/1-0"), "(+ -6 A1)");
+    ASSERT_EQUAL(simplified("A1+B1-C1+D1*E1*2/F1"), "(+ (- (+ A1 B1) C1) (/ (* (* D1 E1) 2) F1))");
+    // not reordered: A1*2*3 may round differently from A1*6
+    ASSERT_EQUAL(simplified("A1*2*3"), "(* (* A1 2) 3)");
+    // x+0 would turn a negative zero into a positive one
+    ASSERT_EQUAL(simplified("A1+0"), "(+ A1 0)");
+    ASSERT_EQUAL(simplified("1/0+A1"), "(+ (/ 1 0) A1)");
+
+    // printed as written
+    auto formula = ParseFormula("A1*(60*60*24)+(+B1)");
+    ASSERT_EQUAL(formula->GetExpression(), "A1*60*60*24++B1");
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+    sheet->SetCell("B1"_pos, "abc");
+    sheet->SetCell("C1"_pos, "=-A1*0");
+    auto value = [&sheet](std::string_view cell) {
+        return sheet->GetCell(Position::FromString(cell))->GetValue();
+    };
+    sheet->SetCell("D1"_pos, "=A1*(60*60*24)");
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(172800.0));
+    // errors come in the order they would without simplification
+    sheet->SetCell("D2"_pos, "=1/0+B1");
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    sheet->SetCell("D3"_pos, "=B1+1/0");
+    ASSERT_EQUAL(value("D3"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    sheet->SetCell("D4"_pos, "=B1*1");
+    ASSERT_EQUAL(value("D4"), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    sheet->SetCell("D5"_pos, "=A1*1e300*1e300/1e300");
+    ASSERT_EQUAL(value("D5"), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    sheet->SetCell("D6"_pos, "=1e300*1e300");
+    ASSERT_EQUAL(value("D6"), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    sheet->SetCell("D7"_pos, "=C1-0");
+    std::ostringstream negative_zero;
+    negative_zero << std::get<double>(value("D7"));
+    ASSERT_EQUAL(negative_zero.str(), "-0");
+    sheet->SetCell("D8"_pos, "=A1+A1-A1+A1*3/A1");
+    ASSERT_EQUAL(value("D8"), CellInterface::Value(5.0));
+}
+
+void TestMemoryUsage() {
+    using Component = SheetMemoryUsage::Component;
+    ASSERT_EQUAL(SheetMemoryUsage::ComponentName(Component::Table), "table_bytes"sv);
+
+    Sheet sheet;
+    SheetMemoryUsage empty = sheet.MemoryUsage();
+    for (Component component : {Component::Table, Component::Cells, Component::Links, Component::Values}) {
+        ASSERT_EQUAL(empty[component], 0u);
+    }
+
+    sheet.SetCell("B1"_pos, "=A1*2+C1");
+    SheetMemoryUsage one = sheet.MemoryUsage();
+    for (size_t i = 0; i < static_cast<size_t>(Component::COUNT); ++i) {
+        if (static_cast<Component>(i) != Component::Texts) {
+            ASSERT(one.bytes[i] > empty.bytes[i]);
+        }
+    }
+    // the text of a formula counts once printed
+    std::string long_formula = "=A1*2+C1+A1*3+C1*4+A1*5+C1*6";
+    sheet.SetCell("B1"_pos, long_formula);
+    size_t unprinted = sheet.MemoryUsage()[Component::Formulas];
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), long_formula);
+    ASSERT(sheet.MemoryUsage()[Component::Formulas] >= unprinted + long_formula.size());
+
+    // filled-down formulas share their compiled expression
+    constexpr int ROWS = 100;
+    for (int row = 1; row < ROWS; ++row) {
+        std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 0}, "label " + std::to_string(row % 3));
+        sheet.SetCell(Position{row, 1}, "=A" + r + "*2+C" + r + "+A" + r + "*3+C" + r + "*4+A" + r + "*5+C" + r + "*6");
+    }
+    SheetMemoryUsage full = sheet.MemoryUsage();
+    ASSERT(full[Component::Formulas] < unprinted * ROWS / 4);
+    ASSERT(full[Component::Texts] > 0u);
+    ASSERT(full.GetTotal() > one.GetTotal());
+
+    // freed memory is subtracted
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.ClearCell(Position{row, 1});
+    }
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col : {0, 2}) {
+            sheet.ClearCell(Position{row, col});
+        }
+    }
+    SheetMemoryUsage cleared = sheet.MemoryUsage();
+    ASSERT_EQUAL(cleared[Component::Links], 0u);
+    ASSERT(cleared[Component::Formulas] < one[Component::Formulas]);
+    // capacities are kept
+    ASSERT_EQUAL(cleared[Component::Table], full[Component::Table]);
+    ASSERT_EQUAL(cleared[Component::Cells], full[Component::Cells]);
+}
+
+void TestValueBudget() {
+    using Component = SheetMemoryUsage::Component;
+    constexpr int ROWS = ValueStore::CHUNK_ROWS;
+    Sheet sheet;
+    // a chain is expensive to compute again, constants are not
+    sheet.SetCell("D1"_pos, "1");
+    for (int row = 1; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 3}, "=D" + std::to_string(row) + "+1");
+        sheet.SetCell(Position{row, 4}, "=2*" + std::to_string(row));
+    }
+    ASSERT_EQUAL(sheet.GetCell(Position{ROWS - 1, 3})->GetValue(), CellInterface::Value(double(ROWS)));
+    for (int row = 1; row < ROWS; ++row) {
+        sheet.GetCell(Position{row, 4})->GetValue();
+    }
+
+    size_t full = sheet.MemoryUsage()[Component::Values];
+    sheet.SetValueBudget(full - 1);
+    ValueCacheStatistics statistics = sheet.GetValueCacheStatistics();
+    ASSERT_EQUAL(statistics.evicted_chunks, 1u);
+    ASSERT_EQUAL(statistics.evicted_values, static_cast<std::uint64_t>(ROWS - 1));
+    ASSERT(sheet.MemoryUsage()[Component::Values] < full);
+
+    // the constants were evicted; the first read brings them back to be cached again
+    perf::Reset();
+    ASSERT_EQUAL(sheet.GetCell("E10"_pos)->GetValue(), CellInterface::Value(18.0));
+    ASSERT_EQUAL(sheet.GetCell("E10"_pos)->GetValue(), CellInterface::Value(18.0));
+    ASSERT_EQUAL(sheet.GetCell(Position{ROWS - 1, 3})->GetValue(), CellInterface::Value(double(ROWS)));
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 1u);
+    ASSERT_EQUAL(sheet.GetValueCacheStatistics().readmitted_chunks, 1u);
+    ASSERT_EQUAL(sheet.GetValueCacheStatistics().uncached_evaluations, 0u);
+    // the other formulas of the chunk wait to be read
+    ASSERT_EQUAL(sheet.GetStaleCells().size(), static_cast<size_t>(ROWS - 2));
+    ASSERT_EQUAL(sheet.Summarize("E1"_pos, {ROWS, 1}).sum, double(ROWS * (ROWS - 1)));
+
+    // evicted values still follow their precedents
+    sheet.SetValueBudget(full - 1);
+    ASSERT_EQUAL(sheet.GetValueCacheStatistics().evicted_chunks, 2u);
+    sheet.SetCell("E2"_pos, "=D2*100");
+    ASSERT_EQUAL(sheet.GetValueCacheStatistics().restored_chunks, 1u);
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(200.0));
+    ASSERT_EQUAL(sheet.GetCell("E3"_pos)->GetValue(), CellInterface::Value(4.0));
+    sheet.SetValueBudget(0);
+    sheet.SetCell("D1"_pos, "2");
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(300.0));
+    ASSERT_EQUAL(sheet.GetCell(Position{ROWS - 1, 3})->GetValue(), CellInterface::Value(double(ROWS + 1)));
+
+    // readers compute evicted values concurrently
+    std::vector<std::future<double>> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.push_back(std::async(std::launch::async, [&sheet] {
+            double sum = 0.0;
+            for (int row = 1; row < ROWS; ++row) {
+                sum += std::get<double>(std::as_const(sheet).GetCell(Position{row, 4})->GetValue());
+            }
+            return sum;
+        }));
+    }
+    for (auto& reader : readers) {
+        ASSERT_EQUAL(reader.get(), double(ROWS * (ROWS - 1)) - 2.0 + 300.0);
+    }
+
+    std::ostringstream values;
+    sheet.PrintValues(values);
+    sheet.SetValueBudget(std::nullopt);
+    Sheet unlimited;
+    unlimited.SetCell("D1"_pos, "2");
+    for (int row = 1; row < ROWS; ++row) {
+        unlimited.SetCell(Position{row, 3}, "=D" + std::to_string(row) + "+1");
+        unlimited.SetCell(Position{row, 4}, row == 1 ? "=D2*100"s : "=2*" + std::to_string(row));
+    }
+    std::ostringstream expected;
+    unlimited.PrintValues(expected);
+    ASSERT_EQUAL(values.str(), expected.str());
+
+    // a chain reading each precedent twice, one chunk per cell: computed without caching, a read
+    // would take 2^COLS evaluations
+    constexpr int COLS = 24;
+    Sheet diamond;
+    diamond.SetCell("A1"_pos, "1");
+    for (int col = 1; col < COLS; ++col) {
+        std::string precedent = Position{0, col - 1}.ToString();
+        diamond.SetCell(Position{0, col}, "=" + precedent + "+" + precedent);
+    }
+    diamond.SetValueBudget(0);
+    perf::Reset();
+    const CellInterface* last = std::as_const(diamond).GetCell(Position{0, COLS - 1});
+    ASSERT_EQUAL(last->GetValue(), CellInterface::Value(double(1 << (COLS - 1))));
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(COLS - 1));
+    std::uint64_t uncached = diamond.GetValueCacheStatistics().uncached_evaluations;
+    ASSERT_EQUAL(last->GetValue(), CellInterface::Value(double(1 << (COLS - 1))));
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(COLS - 1));
+    ASSERT_EQUAL(diamond.GetValueCacheStatistics().uncached_evaluations, uncached);
+    ASSERT_EQUAL(diamond.GetValueCacheStatistics().readmitted_chunks, static_cast<std::uint64_t>(COLS - 1));
+    // the writer enforces the budget again
+    diamond.SetCell("A2"_pos, "text");
+    ASSERT_EQUAL(diamond.GetValueCacheStatistics().evicted_chunks, static_cast<std::uint64_t>(2 * (COLS - 1)));
+}
+
+void TestCompaction() {
+    using Component = SheetMemoryUsage::Component;
+    constexpr int ROWS = 2048;
+    Sheet sheet;
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row));
+        sheet.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "*2");
+    }
+    sheet.SetCell("F16000"_pos, "far");
+    // leaves E1 behind as an empty cell nothing refers to
+    sheet.SetCell("C1"_pos, "=E1");
+    sheet.SetCell("C1"_pos, "1");
+    ASSERT(sheet.GetCell("E1"_pos) != nullptr);
+
+    // the slabs of the cells keep every fourth cell
+    for (int row = 0; row < ROWS; ++row) {
+        if (row % 4 != 0) {
+            sheet.ClearCell(Position{row, 0});
+            sheet.ClearCell(Position{row, 1});
+        }
+    }
+    sheet.ClearCell("F16000"_pos);
+    std::ostringstream texts;
+    sheet.PrintTexts(texts);
+    SheetMemoryUsage cleared = sheet.MemoryUsage();
+
+    // a zero budget takes one step per call
+    size_t steps = 0;
+    size_t released = 0;
+    for (bool complete = false; !complete; ++steps) {
+        CompactionSlice slice = sheet.Compact(0ns);
+        released += slice.released_bytes;
+        complete = slice.complete;
+    }
+    ASSERT(steps > 16000u);
+    SheetMemoryUsage compacted = sheet.MemoryUsage();
+    ASSERT_EQUAL(cleared.GetTotal() - compacted.GetTotal(), released);
+    ASSERT(compacted[Component::Table] < cleared[Component::Table] / 4);
+    ASSERT(compacted[Component::Cells] <= cleared[Component::Cells] / 2);
+    ASSERT(compacted[Component::Values] < cleared[Component::Values]);
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+    ASSERT(sheet.GetCell("A2"_pos) == nullptr);
+    // nothing is left to release
+    CompactionSlice again = sheet.Compact();
+    ASSERT(again.complete);
+    ASSERT_EQUAL(again.released_bytes, 0u);
+
+    // moved cells keep their contents and links; the cells cleared before are no longer printed as zeros
+    std::ostringstream compacted_texts;
+    sheet.PrintTexts(compacted_texts);
+    ASSERT_EQUAL(compacted_texts.str(), texts.str());
+    Sheet expected;
+    for (int row = 0; row < ROWS; row += 4) {
+        expected.SetCell(Position{row, 0}, std::to_string(row));
+        expected.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "*2");
+    }
+    expected.SetCell("C1"_pos, "1");
+    std::ostringstream values;
+    std::ostringstream expected_values;
+    sheet.PrintValues(values);
+    expected.PrintValues(expected_values);
+    ASSERT_EQUAL(values.str(), expected_values.str());
+    sheet.SetCell("A2045"_pos, "10");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B2045"_pos)->GetValue()), 20.0);
+    bool caught = false;
+    try {
+        sheet.SetCell("A2045"_pos, "=B2045");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // the sheet grows again
+    sheet.SetCell("F16000"_pos, "far");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{16000, 6}));
+
+    // cells referred to from other sheets move as well
+    Workbook workbook;
+    Sheet& prices = workbook.AddSheet("Prices");
+    Sheet& totals = workbook.AddSheet("Totals");
+    constexpr int PRICES = 1024;
+    for (int row = 0; row < PRICES; ++row) {
+        prices.SetCell(Position{row, 0}, std::to_string(row));
+    }
+    for (int row = 0; row < PRICES; row += 2) {
+        prices.ClearCell(Position{row + 1, 0});
+        totals.SetCell(Position{row, 0}, "=Prices!A" + std::to_string(row + 1) + "*2");
+    }
+    size_t slabs = prices.MemoryUsage()[Component::Cells];
+    prices.Compact();
+    ASSERT(prices.MemoryUsage()[Component::Cells] <= slabs / 2);
+    for (int row = 0; row < PRICES; row += 2) {
+        prices.SetCell(Position{row, 0}, "1");
+        ASSERT_EQUAL(std::get<double>(totals.GetCell(Position{row, 0})->GetValue()), 2.0);
+    }
+}
+
+void TestEditJournal() {
+    Sheet sheet;
+    ASSERT_EQUAL(sheet.GetJournalDepth(), 0u);
+    sheet.SetCell("A1"_pos, "1");
+    ASSERT(!sheet.Undo());
+
+    sheet.SetJournalDepth(10);
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("A1"_pos, "5");
+    sheet.ClearCell("B1"_pos);
+    sheet.SetCell("C1"_pos, "text");
+    sheet.GetCell("C1"_pos)->Set("=B1+1");
+    auto value = [&sheet](Position pos) {
+        return std::get<double>(sheet.GetCell(pos)->GetValue());
+    };
+    ASSERT_EQUAL(value("C1"_pos), 1.0);
+
+    // formulas are put back without parsing them again
+    perf::Reset();
+    ASSERT(sheet.Undo());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "text");
+    ASSERT(sheet.Undo());
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+    ASSERT(sheet.Undo());
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=A1*2");
+    ASSERT_EQUAL(value("B1"_pos), 10.0);
+    ASSERT(sheet.Undo());
+    ASSERT_EQUAL(value("B1"_pos), 2.0);
+    ASSERT(sheet.Undo());
+    ASSERT(sheet.GetCell("B1"_pos) == nullptr);
+    ASSERT(!sheet.Undo());
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "1");
+
+    for (int i = 0; i < 5; ++i) {
+        ASSERT(sheet.Redo());
+    }
+    ASSERT(!sheet.Redo());
+    ASSERT_EQUAL(value("C1"_pos), 1.0);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "5");
+    // referred to by C1 again
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "");
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 0u);
+
+    // a new edit drops the undone ones
+    ASSERT(sheet.Undo());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "text");
+    sheet.SetCell("D1"_pos, "new");
+    ASSERT(!sheet.Redo());
+    ASSERT(sheet.Undo());
+    ASSERT(sheet.GetCell("D1"_pos) == nullptr);
+
+    // the oldest edits are dropped beyond the depth, and texts are released with them
+    sheet.SetJournalDepth(2);
+    for (int i = 0; i < 3; ++i) {
+        sheet.SetCell("E1"_pos, "version " + std::to_string(i));
+    }
+    ASSERT(sheet.Undo());
+    ASSERT(sheet.Undo());
+    ASSERT(!sheet.Undo());
+    ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetText(), "version 0");
+    sheet.SetJournalDepth(0);
+    ASSERT(!sheet.Redo());
+    // "5", "text" and "version 0"
+    ASSERT_EQUAL(sheet.GetTextPool().GetSize(), 3u);
+
+    // an edit of another sheet may close a cycle through the content to put back
+    Workbook workbook;
+    Sheet& first = workbook.AddSheet("First");
+    Sheet& second = workbook.AddSheet("Second");
+    first.SetJournalDepth(10);
+    first.SetCell("A1"_pos, "=Second!A1");
+    first.SetCell("A1"_pos, "1");
+    second.SetCell("A1"_pos, "=First!A1");
+    bool caught = false;
+    try {
+        first.Undo();
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(first.GetCell("A1"_pos)->GetText(), "1");
+    second.SetCell("A1"_pos, "2");
+    ASSERT(first.Undo());
+    ASSERT_EQUAL(std::get<double>(first.GetCell("A1"_pos)->GetValue()), 2.0);
+}
+
+void TestEditLog() {
+    const std::string path = (std::filesystem::temp_directory_path() / "spreadsheet_test_edit_log").string();
+    std::filesystem::remove(path);
+    auto texts = [](const Sheet& sheet) {
+        std::ostringstream output;
+        sheet.PrintTexts(output);
+        return output.str();
+    };
+
+    Sheet sheet;
+    {
+        EditLog log(path);
+        sheet.SetEditLog(&log);
+        sheet.SetCell("A1"_pos, "1");
+        for (int row = 1; row < 100; ++row) {
+            sheet.SetCell({row, 0}, "=A" + std::to_string(row) + "+1");
+        }
+        sheet.SetCell("B1"_pos, "text");
+        sheet.ClearCell("B1"_pos);
+        sheet.SetCell("C1"_pos, "=A100*2");
+        // buffered until committed, then written at once
+        ASSERT_EQUAL(log.GetFileSize(), 8u);
+        log.Commit();
+        log.Commit();
+        ASSERT_EQUAL(log.GetStatistics().records, 103u);
+        ASSERT_EQUAL(log.GetStatistics().commits, 1u);
+        ASSERT_EQUAL(log.GetFileSize(), std::filesystem::file_size(path));
+        sheet.SetEditLog(nullptr);
+    }
+
+    {
+        // the chain is linked once and parsed once per template at most
+        EditLog log(path);
+        Sheet replayed;
+        perf::Reset();
+        ASSERT_EQUAL(log.Replay(replayed), 103u);
+        ASSERT_EQUAL(texts(replayed), texts(sheet));
+        ASSERT(perf::Get(perf::Counter::FormulasParsed) <= 2u);
+        ASSERT_EQUAL(std::get<double>(replayed.GetCell("C1"_pos)->GetValue()), 200.0);
+        ASSERT(replayed.GetCell("B1"_pos) == nullptr);
+
+        // a log may only be replayed into a sheet without content
+        bool caught = false;
+        try {
+            log.Replay(replayed);
+        } catch (const std::logic_error&) {
+            caught = true;
+        }
+        ASSERT(caught);
+    }
+
+    {
+        // a frame torn by a crash is cut off, the earlier ones are kept
+        std::ofstream(path, std::ios::binary | std::ios::app) << "\x20\0\0\0torn"s;
+        EditLog log(path);
+        ASSERT_EQUAL(std::filesystem::file_size(path), log.GetFileSize());
+        sheet.SetEditLog(&log);
+        sheet.SetCell("D1"_pos, "after");
+        sheet.SetEditLog(nullptr);
+    }
+    {
+        // so is one whose size field is garbage, without allocating what it claims
+        std::ofstream(path, std::ios::binary | std::ios::app) << "\xF0\xFF\xFF\x7F" "garbage!"s;
+        alloc::ScopedCounter counter;
+        EditLog log(path);
+        ASSERT(counter.Get().bytes < (1u << 20));
+        ASSERT_EQUAL(std::filesystem::file_size(path), log.GetFileSize());
+    }
+    {
+        EditLog log(path);
+        Sheet replayed;
+        ASSERT_EQUAL(log.Replay(replayed), 104u);
+        ASSERT_EQUAL(texts(replayed), texts(sheet));
+
+        // a snapshot keeps one record per cell
+        std::uint64_t size = log.GetFileSize();
+        log.Compact(replayed);
+        ASSERT(log.GetFileSize() < size);
+        ASSERT_EQUAL(std::filesystem::file_size(path), log.GetFileSize());
+    }
+    {
+        EditLog log(path);
+        Sheet replayed;
+        ASSERT_EQUAL(log.Replay(replayed), 102u);
+        ASSERT_EQUAL(texts(replayed), texts(sheet));
+    }
+
+    {
+        // a header cut short by a crash is written again
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << "SSW"s;
+        EditLog log(path);
+        ASSERT_EQUAL(log.GetFileSize(), 8u);
+        ASSERT_EQUAL(std::filesystem::file_size(path), 8u);
+        Sheet replayed;
+        ASSERT_EQUAL(log.Replay(replayed), 0u);
+    }
+
+    {
+        // one thread syncs the records of all the threads committing meanwhile
+        std::filesystem::remove(path);
+        EditLog log(path);
+        constexpr int THREADS = 4;
+        constexpr int RECORDS = 200;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; ++t) {
+            threads.emplace_back([&log, t] {
+                for (int row = 0; row < RECORDS; ++row) {
+                    log.Commit(log.AppendSet({row, t}, std::to_string(row)));
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EditLogStatistics statistics = log.GetStatistics();
+        ASSERT_EQUAL(statistics.records, static_cast<std::uint64_t>(THREADS * RECORDS));
+        ASSERT(statistics.commits <= statistics.records);
+        Sheet replayed;
+        ASSERT_EQUAL(log.Replay(replayed), static_cast<size_t>(THREADS * RECORDS));
+        ASSERT_EQUAL(replayed.GetPrintableSize(), (Size{RECORDS, THREADS}));
+    }
+
+    {
+        // a cycle is found once all the cells are loaded, and leaves nothing behind
+        std::filesystem::remove(path);
+        EditLog log(path);
+        log.AppendSet("A1"_pos, "=B1");
+        log.AppendSet("B1"_pos, "=C1");
+        log.AppendSet("C1"_pos, "=A1");
+        Sheet replayed;
+        bool caught = false;
+        try {
+            log.Replay(replayed);
+        } catch (const CircularDependencyException&) {
+            caught = true;
+        }
+        ASSERT(caught);
+        ASSERT_EQUAL(replayed.GetPrintableSize(), (Size{0, 0}));
+        ASSERT(replayed.GetCell("A1"_pos) == nullptr);
+        replayed.SetCell("A1"_pos, "=B1");
+        ASSERT_EQUAL(replayed.GetCell("A1"_pos)->GetReferencedCells().size(), 1u);
+    }
+    std::filesystem::remove(path);
+}
+
+void TestCheckpoints() {
+    const std::string directory = (std::filesystem::temp_directory_path() / "spreadsheet_test_checkpoints").string();
+    std::filesystem::remove_all(directory);
+    auto texts = [](const Sheet& sheet) {
+        std::ostringstream output;
+        sheet.PrintTexts(output);
+        return output.str();
+    };
+    ThreadPool executor(1);
+
+    Sheet sheet;
+    for (int row = 0; row < 2000; ++row) {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        for (int col = 1; col < 4; ++col) {
+            sheet.SetCell({row, col}, "=A" + std::to_string(row + 1) + "*" + std::to_string(col));
+        }
+    }
+    {
+        CheckpointStore checkpoints(directory, 3, executor);
+        sheet.SetCheckpoints(&checkpoints);
+        // the first checkpoint is the whole sheet
+        checkpoints.Checkpoint(sheet);
+        CheckpointStatistics base = checkpoints.GetStatistics();
+        ASSERT_EQUAL(base.cells, 8000u);
+        ASSERT_EQUAL(checkpoints.GetDeltaCount(), 0u);
+
+        // then only the tiles edited since
+        sheet.SetCell("B10"_pos, "changed");
+        sheet.SetCell("C10"_pos, "=B11");
+        sheet.ClearCell({1500, 3});
+        ASSERT_EQUAL(checkpoints.GetDirtyTileCount(), 3u);
+        checkpoints.Checkpoint(sheet);
+        CheckpointStatistics delta = checkpoints.GetStatistics();
+        ASSERT_EQUAL(delta.tiles - base.tiles, 3u);
+        ASSERT_EQUAL(delta.cells - base.cells, static_cast<std::uint64_t>(3 * CheckpointStore::TILE_ROWS - 1));
+        ASSERT(delta.bytes - base.bytes < base.bytes / 10);
+        ASSERT_EQUAL(checkpoints.GetDirtyTileCount(), 0u);
+        ASSERT_EQUAL(checkpoints.GetDeltaCount(), 1u);
+        sheet.SetCheckpoints(nullptr);
+    }
+
+    {
+        CheckpointStore checkpoints(directory, 3, executor);
+        ASSERT_EQUAL(checkpoints.GetDeltaCount(), 1u);
+        Sheet restored;
+        ASSERT_EQUAL(checkpoints.Restore(restored), 7999u);
+        ASSERT_EQUAL(texts(restored), texts(sheet));
+        ASSERT(restored.GetCell({1500, 3}) == nullptr);
+        ASSERT_EQUAL(std::get<double>(restored.GetCell("D2000"_pos)->GetValue()), 1999.0 * 3);
+
+        // the third delta starts a merge into a new base image
+        restored.SetCheckpoints(&checkpoints);
+        for (int i = 0; i < 2; ++i) {
+            restored.SetCell({i * 300, 1}, "edit " + std::to_string(i));
+            checkpoints.Checkpoint(restored);
+        }
+        checkpoints.WaitForMerge();
+        ASSERT_EQUAL(checkpoints.GetStatistics().merges, 1u);
+        ASSERT_EQUAL(checkpoints.GetDeltaCount(), 0u);
+        ASSERT(!std::filesystem::exists(std::filesystem::path(directory) / "delta-2.ckpt"));
+
+        restored.SetCell("A1"_pos, "100");
+        checkpoints.Checkpoint(restored);
+        restored.SetCheckpoints(nullptr);
+        Sheet merged;
+        checkpoints.Restore(merged);
+        ASSERT_EQUAL(texts(merged), texts(restored));
+        ASSERT_EQUAL(std::get<double>(merged.GetCell("D1"_pos)->GetValue()), 300.0);
+        ASSERT_EQUAL(merged.GetCell("B301"_pos)->GetText(), "edit 1");
+    }
+
+    // a fork is checkpointed tile by tile without working out its size
+    {
+        const std::string fork_directory = directory + "_fork";
+        std::filesystem::remove_all(fork_directory);
+        std::unique_ptr<Sheet> fork = sheet.Fork();
+        CheckpointStore checkpoints(fork_directory, 8, executor);
+        fork->SetCheckpoints(&checkpoints);
+        checkpoints.Checkpoint(*fork);
+        fork->SetCell("B20"_pos, "fork");
+        fork->SetCell({1999, 4}, "last");
+        const std::uint64_t calls = fork->GetStatistics()[SheetStatistics::Api::GetPrintableSize].calls;
+        checkpoints.Checkpoint(*fork);
+        // the tile of B20 is full, the one of E2000 holds that cell only
+        ASSERT_EQUAL(checkpoints.GetStatistics().cells, 7999u + CheckpointStore::TILE_ROWS + 1);
+        ASSERT_EQUAL(fork->GetStatistics()[SheetStatistics::Api::GetPrintableSize].calls, calls);
+        fork->SetCheckpoints(nullptr);
+        Sheet restored;
+        checkpoints.Restore(restored);
+        ASSERT_EQUAL(texts(restored), texts(*fork));
+        std::filesystem::remove_all(fork_directory);
+    }
+
+    // a gap in the deltas is found when opening
+    std::filesystem::copy_file(std::filesystem::path(directory) / "delta-5.ckpt",
+        std::filesystem::path(directory) / "delta-7.ckpt");
+    bool caught = false;
+    try {
+        CheckpointStore checkpoints(directory, 3, executor);
+    } catch (const std::runtime_error&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    std::filesystem::remove_all(directory);
+}
+
 void TestEmpty() {
     auto sheet = CreateSheet();
     ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
@@ -346,13 +1153,1043 @@ void TestCellCircularReferences() {
     ASSERT(caught);
     ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
 }
+
+void TestDependentCacheInvalidation() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    sheet->SetCell("B1"_pos, "=A1+1");
+    sheet->SetCell("C1"_pos, "=B1*2");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+    sheet->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(6.0));
+
+    sheet->SetCell("B1"_pos, "=A1*10");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(40.0));
+
+    sheet->SetCell("A1"_pos, "=5");
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(100.0));
+}
+
+void TestClearReferencedCell() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "3");
+    sheet->SetCell("B1"_pos, "=A1");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+    sheet->ClearCell("A1"_pos);
+    ASSERT(sheet->GetCell("A1"_pos) != nullptr);
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 2}));
+
+    sheet->ClearCell("B1"_pos);
+    ASSERT(sheet->GetCell("B1"_pos) == nullptr);
+    sheet->ClearCell("A1"_pos);
+    ASSERT(sheet->GetCell("A1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
+}
+
+void TestCircularReferenceThroughSecondOperand() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "=B1+C1");
+    sheet->SetCell("B1"_pos, "1");
+    try {
+        sheet->SetCell("C1"_pos, "=A1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+}
+
+void TestPerfCounters() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "1");
+    for (int row = 0; row < 10; ++row) {
+        sheet->SetCell(Position{row, 1}, "=A1");
+    }
+
+    perf::Reset();
+    for (int row = 0; row < 10; ++row) {
+        sheet->GetCell(Position{row, 1})->GetValue();
+        sheet->GetCell(Position{row, 1})->GetValue();
+    }
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 10u);
+
+    perf::Reset();
+    sheet->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(perf::Get(perf::Counter::GraphNodesVisited), 10u);
+    ASSERT_EQUAL(perf::Get(perf::Counter::CacheInvalidations), 10u);
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 0u);
+    if (alloc::ENABLED) {
+        ASSERT(perf::Get(perf::Counter::Allocations) > 0);
+    }
+}
+
+void TestSheetStatistics() {
+    if (!alloc::ENABLED) {
+        return;
+    }
+    using Api = SheetStatistics::Api;
+
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "2");
+    sheet.SetCell("B1"_pos, "=A1*C1");  // creates C1 through a nested SetCell
+    SheetStatistics statistics = sheet.GetStatistics();
+    ASSERT_EQUAL(statistics[Api::SetCell].calls, 2u);
+    ASSERT(statistics[Api::SetCell].allocations > 0);
+    ASSERT(statistics[Api::SetCell].allocated_bytes >= statistics[Api::SetCell].allocations);
+
+    // reading a cached formula value is an allocation-free hot path
+    sheet.GetCell("B1"_pos)->GetValue();
+    sheet.ResetStatistics();
+    for (int i = 0; i < 100; ++i) {
+        sheet.GetCell("B1"_pos)->GetValue();
+    }
+    statistics = sheet.GetStatistics();
+    ASSERT_EQUAL(statistics[Api::GetCell].calls, 100u);
+    ASSERT_EQUAL(statistics[Api::GetCell].allocations, 0u);
+    ASSERT_EQUAL(statistics[Api::GetValue].calls, 100u);
+    ASSERT_EQUAL(statistics[Api::GetValue].allocations, 0u);
+    ASSERT_EQUAL(statistics[Api::SetCell].calls, 0u);
+
+    alloc::ScopedCounter counter;
+    std::vector<int> buffer(16);
+    alloc::Usage usage = counter.Get();
+    ASSERT_EQUAL(usage.allocations, 1u);
+    ASSERT_EQUAL(usage.bytes, 16 * sizeof(int));
+
+    // a sheet is over-aligned and takes the aligned operator new, which counts as well
+    static_assert(alignof(Sheet) > __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    alloc::ScopedCounter sheet_counter;
+    auto allocated = std::make_unique<Sheet>();
+    ASSERT(reinterpret_cast<std::uintptr_t>(allocated.get()) % alignof(Sheet) == 0);
+    ASSERT(sheet_counter.Get().bytes >= sizeof(Sheet));
+    allocated.reset();
+
+    // each thread counts on its own, and the counts of those that exited stay in the total
+    perf::Reset();
+    for (int i = 0; i < 2; ++i) {
+        std::thread([] {
+            std::vector<int> local(8);
+        }).join();
+    }
+    ASSERT(perf::Get(perf::Counter::Allocations) >= 2u);
+    ASSERT(perf::Get(perf::Counter::AllocatedBytes) >= 16 * sizeof(int));
+}
+
+void TestSnapshotIsolation() {
+    Sheet sheet;
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetVersion(), 0u);
+    ASSERT(sheet.ReadSnapshot()->GetCell("A1"_pos) == nullptr);
+
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("C40"_pos, "far away");
+    ASSERT_EQUAL(sheet.PublishSnapshot(), 1u);
+
+    SnapshotReader first = sheet.ReadSnapshot();
+    ASSERT_EQUAL(first->GetCell("B1"_pos)->text, "=A1*2");
+    ASSERT_EQUAL(first->GetCell("B1"_pos)->value, CellInterface::Value(2.0));
+
+    sheet.SetCell("A1"_pos, "5");
+    sheet.ClearCell("C40"_pos);
+    ASSERT_EQUAL(first->GetCell("B1"_pos)->value, CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet.PublishSnapshot(), 2u);
+
+    SnapshotReader second = sheet.ReadSnapshot();
+    ASSERT_EQUAL(first->GetCell("B1"_pos)->value, CellInterface::Value(2.0));
+    ASSERT_EQUAL(first->GetPrintableSize(), (Size{40, 3}));
+    ASSERT_EQUAL(second->GetCell("B1"_pos)->value, CellInterface::Value(10.0));
+    ASSERT(second->GetCell("C40"_pos) == nullptr);
+    ASSERT_EQUAL(second->GetPrintableSize(), (Size{1, 2}));
+
+    std::ostringstream snapshot_values;
+    second->PrintValues(snapshot_values);
+    std::ostringstream sheet_values;
+    sheet.PrintValues(sheet_values);
+    ASSERT_EQUAL(snapshot_values.str(), sheet_values.str());
+
+    if (alloc::ENABLED) {
+        // a change set spanning two tiles side by side copies each of them once, not once per row
+        constexpr int ROWS = SheetSnapshot::TILE_ROWS;
+        constexpr int COLS = SheetSnapshot::TILE_COLS;
+        auto publish = [&sheet](int first_col) {
+            for (int row = 0; row < ROWS; ++row) {
+                for (int col = first_col; col < first_col + 2; ++col) {
+                    sheet.SetCell({row, col}, "x");
+                }
+            }
+            alloc::ScopedCounter counter;
+            sheet.PublishSnapshot();
+            return counter.Get().bytes;
+        };
+        publish(0);
+        publish(COLS - 1);
+        std::uint64_t one_tile = publish(0);
+        std::uint64_t two_tiles = publish(COLS - 1);
+        ASSERT(two_tiles < 2 * one_tile);
+    }
+
+    // the size follows edits that grow it, shrink it at either edge, or leave it as it is
+    Sheet edges;
+    const std::vector<std::pair<Position, std::string>> edits = {
+        {"A1"_pos, "1"}, {"AH70"_pos, "far"}, {"C100"_pos, "low"}, {"AH70"_pos, ""}, {"Z5"_pos, "wide"},
+        {"C100"_pos, ""}, {"B2"_pos, "inner"}, {"Z5"_pos, ""}, {"A1"_pos, ""}, {"B2"_pos, ""},
+    };
+    for (const auto& [pos, text] : edits) {
+        if (text.empty()) {
+            edges.ClearCell(pos);
+        } else {
+            edges.SetCell(pos, text);
+        }
+        edges.PublishSnapshot();
+        ASSERT_EQUAL(edges.ReadSnapshot()->GetPrintableSize(), edges.GetPrintableSize());
+    }
+    ASSERT_EQUAL(edges.ReadSnapshot()->GetPrintableSize(), (Size{0, 0}));
+}
+
+void TestSnapshotConcurrentReaders() {
+    Sheet sheet;
+    for (int col = 0; col < 40; ++col) {
+        sheet.SetCell(Position{0, col}, "0");
+        sheet.SetCell(Position{1, col}, "="s + Position{0, col}.ToString() + "*2");
+    }
+    sheet.PublishSnapshot();
+
+    std::atomic<bool> done = false;
+    std::atomic<int> inconsistencies = 0;
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            while (!done) {
+                SnapshotReader snapshot = sheet.ReadSnapshot();
+                double expected = std::get<double>(snapshot->GetCell(Position{1, 0})->value);
+                for (int col = 0; col < 40; ++col) {
+                    const auto* input = snapshot->GetCell(Position{0, col});
+                    const auto* output = snapshot->GetCell(Position{1, col});
+                    if (std::get<double>(output->value) != expected
+                        || std::get<std::string>(input->value) != std::to_string(static_cast<int>(expected / 2))) {
+                        ++inconsistencies;
+                    }
+                }
+            }
+        });
+    }
+
+    for (int version = 1; version <= 300; ++version) {
+        for (int col = 0; col < 40; ++col) {
+            sheet.SetCell(Position{0, col}, std::to_string(version));
+        }
+        sheet.PublishSnapshot();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    ASSERT_EQUAL(inconsistencies.load(), 0);
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetCell(Position{1, 39})->value, CellInterface::Value(600.0));
+}
+
+void TestConcurrentGetValueComputesOnce() {
+    constexpr int ROWS = 30;
+    constexpr int COLS = 20;
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 1; col < COLS; ++col) {
+            sheet.SetCell(Position{row, col}, "="s + Position{row, col - 1}.ToString() + "+A1");
+        }
+    }
+
+    for (int round = 2; round < 12; ++round) {
+        sheet.SetCell("A1"_pos, std::to_string(round));
+        perf::Reset();
+
+        std::atomic<int> wrong_values = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 8; ++i) {
+            readers.emplace_back([&, i] {
+                // half of the readers walk backwards to collide on the long chains
+                for (int step = 0; step < ROWS * COLS; ++step) {
+                    int index = i % 2 ? ROWS * COLS - 1 - step : step;
+                    Position pos{index / COLS, index % COLS};
+                    if (pos.col == 0) {
+                        continue;
+                    }
+                    double expected = (pos.row == 0 ? 1 : 0) * round + pos.col * round;
+                    if (!(sheet.GetCell(pos)->GetValue() == CellInterface::Value(expected))) {
+                        ++wrong_values;
+                    }
+                }
+            });
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        ASSERT_EQUAL(wrong_values.load(), 0);
+        ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(ROWS * (COLS - 1)));
+    }
+}
+
+void TestAsyncRecalculation() {
+    constexpr int LENGTH = 300;
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    for (int row = 1; row < LENGTH; ++row) {
+        sheet.SetCell(Position{row, 0}, "="s + Position{row - 1, 0}.ToString() + "+1");
+    }
+    // deliberately deep: the worker must not recurse through the chain
+    sheet.SetCell("B1"_pos, "="s + Position{LENGTH - 1, 0}.ToString() + "*2");
+    perf::Reset();
+
+    ThreadPool pool(2);
+    RecalculationHandle recalculation = sheet.RecalculateAsync(pool);
+    ASSERT(recalculation.Wait() == RecalculationStatus::COMPLETED);
+    ASSERT(recalculation.IsDone());
+    ASSERT_EQUAL(recalculation.GetProgress().done, static_cast<size_t>(LENGTH));
+    ASSERT_EQUAL(recalculation.GetProgress().total, static_cast<size_t>(LENGTH));
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(LENGTH));
+    ASSERT_EQUAL(recalculation.GetVersion(), 1u);
+
+    SnapshotReader snapshot = sheet.ReadSnapshot();
+    ASSERT_EQUAL(snapshot->GetCell("B1"_pos)->value, CellInterface::Value(2.0 * LENGTH));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0 * LENGTH));
+    ASSERT_EQUAL(sheet.GetStatistics()[SheetStatistics::Api::Recalculate].calls, 1u);
+
+    // only what the edit invalidated is computed again
+    sheet.SetCell("A300"_pos, "0");
+    perf::Reset();
+    recalculation = sheet.RecalculateAsync(pool);
+    ASSERT(recalculation.Wait() == RecalculationStatus::COMPLETED);
+    ASSERT_EQUAL(recalculation.GetProgress().total, 1u);
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 1u);
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetCell("B1"_pos)->value, CellInterface::Value(0.0));
+}
+
+void TestAsyncRecalculationSupersededByEdit() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.PublishSnapshot();
+    sheet.SetCell("A1"_pos, "2");
+
+    // occupy the only worker so that the recalculation cannot start before the edit
+    ThreadPool pool(1);
+    std::promise<void> release;
+    pool.Submit([blocker = release.get_future()]() mutable {
+        blocker.wait();
+    });
+    RecalculationHandle recalculation = sheet.RecalculateAsync(pool);
+    ASSERT(!recalculation.IsDone());
+
+    std::thread releaser([&release] {
+        std::this_thread::sleep_for(20ms);
+        release.set_value();
+    });
+    // cancels the pending recalculation and waits for it to give up
+    sheet.SetCell("A1"_pos, "3");
+    releaser.join();
+    ASSERT(recalculation.IsDone());
+    ASSERT(recalculation.Wait() == RecalculationStatus::CANCELLED);
+    ASSERT_EQUAL(recalculation.GetProgress().done, 0u);
+
+    // readers keep the last consistent version
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetVersion(), 1u);
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetCell("B1"_pos)->value, CellInterface::Value(2.0));
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(4.0));
+
+    std::promise<void> release_again;
+    pool.Submit([blocker = release_again.get_future()]() mutable {
+        blocker.wait();
+    });
+    recalculation = sheet.RecalculateAsync(pool);
+    recalculation.Cancel();
+    release_again.set_value();
+    ASSERT(recalculation.Wait() == RecalculationStatus::CANCELLED);
+    ASSERT_EQUAL(sheet.ReadSnapshot()->GetVersion(), 1u);
+
+    // listing the stale cells stops a pending recalculation, which works on the same list
+    sheet.SetCell("A1"_pos, "4");
+    std::promise<void> release_last;
+    pool.Submit([blocker = release_last.get_future()]() mutable {
+        blocker.wait();
+    });
+    recalculation = sheet.RecalculateAsync(pool);
+    std::thread last_releaser([&release_last] {
+        std::this_thread::sleep_for(20ms);
+        release_last.set_value();
+    });
+    ASSERT_EQUAL(sheet.GetStaleCells(), (std::vector<Position>{"B1"_pos}));
+    last_releaser.join();
+    ASSERT(recalculation.Wait() == RecalculationStatus::CANCELLED);
+
+    // a handle of no recalculation is done and has nothing to report
+    RecalculationHandle none;
+    none.Cancel();
+    ASSERT(none.IsDone());
+    ASSERT(none.Wait() == RecalculationStatus::CANCELLED);
+    ASSERT_EQUAL(none.GetProgress().total, 0u);
+    ASSERT_EQUAL(none.GetVersion(), 0u);
+}
+
+void TestRecalculateForBudget() {
+    constexpr int LENGTH = 200;
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    for (int row = 1; row < LENGTH; ++row) {
+        sheet.SetCell(Position{row, 0}, "="s + Position{row - 1, 0}.ToString() + "+1");
+    }
+    sheet.SetCell("D1"_pos, "2");
+    sheet.SetCell("D2"_pos, "=D1*10");
+    sheet.SetCell("E2"_pos, "=D2+1");
+    ASSERT_EQUAL(sheet.GetStaleCells().size(), static_cast<size_t>(LENGTH + 1));
+
+    // an exhausted budget still takes one step per call, the viewport before anything else
+    Viewport viewport{"D2"_pos, {1, 2}};
+    RecalculationSlice slice = sheet.RecalculateFor(0ns, viewport);
+    ASSERT(!slice.complete);
+    ASSERT_EQUAL(slice.stale_in_viewport, (std::vector<Position>{"D2"_pos, "E2"_pos}));
+    int calls = 1;
+    size_t computed = slice.computed;
+    while (!slice.stale_in_viewport.empty()) {
+        slice = sheet.RecalculateFor(0ns, viewport);
+        computed += slice.computed;
+        ++calls;
+    }
+    ASSERT(calls <= 6);
+    ASSERT_EQUAL(computed, 2u);
+    ASSERT_EQUAL(sheet.GetStaleCells().size(), static_cast<size_t>(LENGTH - 1));
+
+    // an edit starts the walk over, and the rest is done once the budget allows it
+    sheet.SetCell("D1"_pos, "3");
+    ASSERT_EQUAL(sheet.GetStaleCells().size(), static_cast<size_t>(LENGTH + 1));
+    perf::Reset();
+    slice = sheet.RecalculateFor(10s, viewport);
+    ASSERT(slice.complete);
+    ASSERT(slice.stale_in_viewport.empty());
+    ASSERT_EQUAL(slice.computed, static_cast<size_t>(LENGTH + 1));
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(LENGTH + 1));
+    ASSERT(sheet.GetStaleCells().empty());
+    ASSERT_EQUAL(sheet.GetCell("E2"_pos)->GetValue(), CellInterface::Value(31.0));
+    ASSERT_EQUAL(sheet.GetCell(Position{LENGTH - 1, 0})->GetValue(), CellInterface::Value(static_cast<double>(LENGTH)));
+
+    slice = sheet.RecalculateFor(0ns);
+    ASSERT(slice.complete);
+    ASSERT_EQUAL(slice.computed, 0u);
+}
+
+void TestWorkbookCrossSheetReferences() {
+    Workbook workbook;
+    Sheet& prices = workbook.AddSheet("Prices");
+    Sheet& orders = workbook.AddSheet("Orders_2");
+    ASSERT_EQUAL(workbook.GetSheetNames(), (std::vector<std::string>{"Prices", "Orders_2"}));
+    ASSERT(workbook.GetSheet("Orders_2") == &orders);
+    ASSERT(workbook.GetSheet("Missing") == nullptr);
+
+    prices.SetCell("B3"_pos, "4");
+    orders.SetCell("A1"_pos, "3");
+    orders.SetCell("B1"_pos, "=A1*Prices!B3+Prices!C1");
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetText(), "=A1*Prices!B3+Prices!C1");
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetValue(), CellInterface::Value(12.0));
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetReferencedCells(), std::vector<Position>{"A1"_pos});
+    // referenced cells of other sheets are created empty, like the local ones
+    ASSERT(prices.GetCell("C1"_pos) != nullptr);
+
+    // dependents on other sheets are invalidated, and their cells are kept while referenced
+    prices.SetCell("B3"_pos, "5");
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetValue(), CellInterface::Value(15.0));
+    prices.ClearCell("B3"_pos);
+    ASSERT(prices.GetCell("B3"_pos) != nullptr);
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+    prices.SetCell("C1"_pos, "text");
+    ASSERT_EQUAL(orders.GetCell("B1"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+
+    try {
+        prices.SetCell("B3"_pos, "=Orders_2!B1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    try {
+        orders.SetCell("C1"_pos, "=Missing!A1");
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    ASSERT(orders.GetCell("C1"_pos) == nullptr);
+    try {
+        workbook.AddSheet("Prices");
+        ASSERT(false);
+    } catch (const std::invalid_argument&) {
+    }
+    try {
+        workbook.AddSheet("2nd");
+        ASSERT(false);
+    } catch (const std::invalid_argument&) {
+    }
+
+    // a standalone sheet knows no other sheets
+    Sheet standalone;
+    try {
+        standalone.SetCell("A1"_pos, "=Prices!A1");
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+}
+
+void TestWorkbookRecalculation() {
+    constexpr int SHEETS = 6;
+    constexpr int ROWS = 50;
+    Workbook workbook;
+    workbook.AddSheet("Input");
+    for (int i = 0; i < SHEETS; ++i) {
+        Sheet& sheet = workbook.AddSheet("S" + std::to_string(i));
+        for (int row = 0; row < ROWS; ++row) {
+            // half of the sheets build on the previous one, the others only on the input
+            std::string source = i % 2 && i > 0 ? "S" + std::to_string(i - 1) : "Input"s;
+            sheet.SetCell(Position{row, 0}, "=" + source + "!" + Position{row, 0}.ToString() + "+1");
+        }
+    }
+    Sheet& input = *workbook.GetSheet("Input");
+    for (int row = 0; row < ROWS; ++row) {
+        input.SetCell(Position{row, 0}, std::to_string(row));
+    }
+
+    ThreadPool pool(4);
+    perf::Reset();
+    workbook.Recalculate(pool);
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), static_cast<std::uint64_t>(SHEETS * ROWS));
+    for (int i = 0; i < SHEETS; ++i) {
+        Sheet& sheet = *workbook.GetSheet("S" + std::to_string(i));
+        ASSERT(sheet.GetStaleCells().empty());
+        SnapshotReader snapshot = sheet.ReadSnapshot();
+        double expected = ROWS - 1 + (i % 2 ? 2 : 1);
+        ASSERT_EQUAL(snapshot->GetCell(Position{ROWS - 1, 0})->value, CellInterface::Value(expected));
+    }
+
+    // sheets referring to each other in both directions still settle
+    Sheet& first = *workbook.GetSheet("S0");
+    Sheet& second = *workbook.GetSheet("S1");
+    first.SetCell("B1"_pos, "=S1!A1*10");
+    input.SetCell("A1"_pos, "100");
+    workbook.Recalculate(pool);
+    ASSERT_EQUAL(first.ReadSnapshot()->GetCell("B1"_pos)->value, CellInterface::Value(1020.0));
+    ASSERT_EQUAL(second.ReadSnapshot()->GetCell("A1"_pos)->value, CellInterface::Value(102.0));
+}
+
+void TestSharedFormulaTemplates() {
+    constexpr int ROWS = 1000;
+    Workbook workbook;
+    Sheet& rates = workbook.AddSheet("Rates");
+    Sheet& sheet = workbook.AddSheet("Main");
+    for (int row = 0; row < ROWS; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row));
+        rates.SetCell(Position{row, 0}, "2");
+    }
+
+    perf::Reset();
+    ClearParseCache();
+    for (int row = 0; row < ROWS; ++row) {
+        std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 1}, "=A" + r + "*Rates!A" + r);
+        sheet.SetCell(Position{row, 2}, row ? "=C" + std::to_string(row) + "+B" + r : "=B1"s);
+    }
+    // one parse per shape: the first cell of C differs from the rest
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 3u);
+
+    const CellInterface& cell = *sheet.GetCell("C500"_pos);
+    ASSERT_EQUAL(cell.GetText(), "=C499+B500");
+    ASSERT_EQUAL(cell.GetReferencedCells(), (std::vector<Position>{"C499"_pos, "B500"_pos}));
+    ASSERT_EQUAL(sheet.GetCell("B7"_pos)->GetText(), "=A7*Rates!A7");
+    ASSERT_EQUAL(sheet.GetCell(Position{ROWS - 1, 2})->GetValue(), CellInterface::Value(double(ROWS) * (ROWS - 1)));
+
+    // each cell still depends on its own precedents
+    rates.SetCell("A3"_pos, "3");
+    ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet.GetCell("B4"_pos)->GetValue(), CellInterface::Value(6.0));
+    ASSERT_EQUAL(sheet.GetCell("C4"_pos)->GetValue(), CellInterface::Value(14.0));
+
+    // the same text refers to different cells relative to its own cell; it is parsed once
+    perf::Reset();
+    ClearParseCache();
+    sheet.SetCell("D1"_pos, "=A2+1");
+    sheet.SetCell("D2"_pos, "=A2+1");
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 1u);
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetText(), "=A2+1");
+    ASSERT_EQUAL(sheet.GetCell("D2"_pos)->GetValue(), CellInterface::Value(2.0));
+
+    // shared shapes still report errors in the cell where they occur
+    try {
+        sheet.SetCell("C1"_pos, "=C2+B1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+}
+
+void TestColumnarValues() {
+    constexpr int ROWS = 600;
+    Sheet sheet;
+    for (int row = 0; row < ROWS; ++row) {
+        std::string r = std::to_string(row + 1);
+        sheet.SetCell(Position{row, 0}, std::to_string(row));
+        sheet.SetCell(Position{row, 1}, "=A" + r + "*2");
+    }
+    sheet.SetCell("A6"_pos, "abc");
+    sheet.SetCell("A7"_pos, "'7");
+    sheet.SetCell("D1"_pos, "1.50");
+    sheet.SetCell("D2"_pos, "01");
+
+    // column A: 0..599 without 5 and with 7 for 6, B: twice that with an error in B6, D: 1.5
+    double expected_sum = 3.0 * (ROWS * (ROWS - 1) / 2 - 5 + 1) + 1.5;
+    NumericSummary summary = sheet.Summarize("A1"_pos, {ROWS, 4});
+    ASSERT_EQUAL(summary.count, static_cast<size_t>(2 * ROWS - 2 + 1));
+    ASSERT_EQUAL(summary.errors, 1u);
+    ASSERT_EQUAL(summary.sum, expected_sum);
+    ASSERT_EQUAL(summary.min, 0.0);
+    ASSERT_EQUAL(summary.max, 2.0 * (ROWS - 1));
+    // stale formulas are computed on the way
+    ASSERT(sheet.GetStaleCells().empty());
+
+    std::vector<Position> visited;
+    sheet.ForEachNumber("B299"_pos, {3, 3}, [&visited](Position pos, double value) {
+        ASSERT_EQUAL(value, 2.0 * pos.row);
+        visited.push_back(pos);
+    });
+    ASSERT_EQUAL(visited, (std::vector<Position>{"B299"_pos, "B300"_pos, "B301"_pos}));
+
+    // edits and cleared cells are reflected
+    sheet.SetCell("A1"_pos, "1000");
+    sheet.ClearCell("D1"_pos);
+    summary = sheet.Summarize("A1"_pos, {ROWS, 4});
+    ASSERT_EQUAL(summary.sum, expected_sum + 3000.0 - 1.5);
+    ASSERT_EQUAL(summary.max, 2000.0);
+
+    // a fork reads the cells it has not copied from its base
+    std::unique_ptr<Sheet> fork = sheet.Fork();
+    fork->SetCell("A2"_pos, "=-1");
+    NumericSummary fork_summary = fork->Summarize("A1"_pos, {ROWS, 4});
+    ASSERT_EQUAL(fork_summary.count, summary.count);
+    ASSERT_EQUAL(fork_summary.sum, summary.sum - 6.0);
+    ASSERT_EQUAL(fork_summary.min, -2.0);
+    ASSERT_EQUAL(sheet.Summarize("A1"_pos, {ROWS, 4}).sum, summary.sum);
+}
+
+void TestInternedTexts() {
+    Sheet sheet;
+    for (int row = 0; row < 1000; ++row) {
+        sheet.SetCell(Position{row, 0}, row % 2 ? "status: approved" : "status: pending review");
+    }
+    sheet.SetCell("B1"_pos, "'status: approved");
+    sheet.SetCell("B2"_pos, "=A1");
+    const StringPool& pool = sheet.GetTextPool();
+    ASSERT_EQUAL(pool.GetSize(), 3u);
+    ASSERT(pool.GetArenaBytes() <= StringPool::FIRST_BLOCK_SIZE);
+
+    // the cells repeating a label view the same bytes
+    auto* a2 = static_cast<const Cell*>(sheet.GetCell("A2"_pos));
+    auto* a4 = static_cast<const Cell*>(sheet.GetCell("A4"_pos));
+    ASSERT_EQUAL(a2->GetTextView(), "status: approved"sv);
+    ASSERT(a2->GetTextView().data() == a4->GetTextView().data());
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetTextView(), "=A1"sv);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "'status: approved"s);
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value("status: approved"s));
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+
+    // a text is freed with its last cell, and its id is reused
+    sheet.ClearCell("B1"_pos);
+    ASSERT_EQUAL(pool.GetSize(), 2u);
+    sheet.SetCell("B1"_pos, "N/A");
+    ASSERT_EQUAL(pool.GetSize(), 3u);
+    for (int row = 0; row < 1000; row += 2) {
+        sheet.SetCell(Position{row, 0}, "N/A");
+    }
+    ASSERT_EQUAL(pool.GetSize(), 2u);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value("N/A"s));
+
+    // a fork interns the texts of the cells it copies into its own pool
+    std::unique_ptr<Sheet> fork = sheet.Fork();
+    fork->SetCell("C1"_pos, "=A1");
+    ASSERT_EQUAL(std::as_const(*fork).GetCell("A2"_pos)->GetText(), "status: approved"s);
+    ASSERT_EQUAL(fork->GetTextPool().GetSize(), 1u);
+    ASSERT_EQUAL(static_cast<const Cell*>(fork->GetCell("A1"_pos))->GetTextView(), "N/A"sv);
+    ASSERT_EQUAL(pool.GetSize(), 2u);
+    fork.reset();
+
+    // compaction copies the texts still held into fresh blocks and frees the bytes of the others
+    for (int row = 0; row < 1000; ++row) {
+        sheet.SetCell(Position{row, 2}, "note number " + std::to_string(row));
+    }
+    for (int row = 1; row < 1000; ++row) {
+        sheet.ClearCell(Position{row, 2});
+    }
+    const size_t churned = pool.GetArenaBytes();
+    ASSERT(churned > 8 * StringPool::FIRST_BLOCK_SIZE);
+    sheet.Compact();
+    ASSERT(pool.GetArenaBytes() <= StringPool::FIRST_BLOCK_SIZE);
+    ASSERT_EQUAL(pool.GetLiveBytes(), "N/A"sv.size() + "status: approved"sv.size() + "note number 0"sv.size());
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetText(), "note number 0"s);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value("N/A"s));
+    ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetTextView(), "status: approved"sv);
+    // the moved texts are still found when interned again
+    sheet.SetCell("D1"_pos, "note number 0");
+    ASSERT_EQUAL(pool.GetSize(), 3u);
+}
+
+void TestCellViews() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "'=text");
+    sheet.SetCell("A2"_pos, "12");
+    sheet.SetCell("B1"_pos, "=(C3+A2)*2");
+    sheet.SetCell("B2"_pos, "=A1+1");
+
+    const CellInterface* a1 = sheet.GetCell("A1"_pos);
+    ASSERT(std::get<std::string_view>(a1->GetValueView()) == "=text"sv);
+    ASSERT_EQUAL(a1->GetTextView(), "'=text"sv);
+    ASSERT(a1->GetReferencedCellsView().empty());
+    ASSERT(std::get<std::string_view>(sheet.GetCell("A2"_pos)->GetValueView()) == "12"sv);
+
+    const CellInterface* b1 = sheet.GetCell("B1"_pos);
+    ASSERT_EQUAL(std::get<double>(b1->GetValueView()), 24.0);
+    // the canonical text is kept by the cell
+    ASSERT_EQUAL(b1->GetTextView(), "=(C3+A2)*2"sv);
+    ASSERT(b1->GetTextView().data() == b1->GetTextView().data());
+    ASSERT_EQUAL(b1->GetReferencedCellsView().ToVector(), (std::vector<Position>{"A2"_pos, "C3"_pos}));
+    ASSERT_EQUAL(b1->GetReferencedCellsView().ToVector(), b1->GetReferencedCells());
+    ASSERT_EQUAL(std::get<FormulaError>(sheet.GetCell("B2"_pos)->GetValueView()),
+                 FormulaError(FormulaError::Category::Value));
+    const CellInterface* c3 = sheet.GetCell("C3"_pos);
+    ASSERT_EQUAL(std::get<double>(c3->GetValueView()), 0.0);
+    ASSERT(c3->GetTextView().empty());
+
+    // the views follow edits of the cell
+    sheet.SetCell("B1"_pos, "=A2");
+    ASSERT_EQUAL(b1->GetTextView(), "=A2"sv);
+    ASSERT_EQUAL(b1->GetReferencedCellsView().size(), 1u);
+
+    // snapshot cells and filled-down formulas have views as well
+    sheet.SetCell("D2"_pos, "=A2+C3");
+    sheet.SetCell("D3"_pos, "=A3+C4");
+    sheet.PublishSnapshot();
+    SnapshotReader reader = sheet.ReadSnapshot();
+    const CellInterface* d3 = reader->GetCell("D3"_pos);
+    ASSERT_EQUAL(d3->GetTextView(), "=A3+C4"sv);
+    ASSERT_EQUAL(d3->GetReferencedCellsView().ToVector(), (std::vector<Position>{"A3"_pos, "C4"_pos}));
+    ASSERT_EQUAL(std::get<double>(d3->GetValueView()), 0.0);
+}
+
+void TestCompactCells() {
+    // the content is stored inline, and the links share one vector
+    ASSERT(sizeof(Cell) <= 96);
+
+    Sheet sheet;
+    for (int row = 0; row < 300; ++row) {
+        sheet.SetCell(Position{row, 0}, std::to_string(row));
+        sheet.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "+A1");
+    }
+    auto cell = [&sheet](Position pos) {
+        return static_cast<const Cell*>(sheet.GetCell(pos));
+    };
+    ASSERT_EQUAL(cell("A1"_pos)->GetDependentPositions().size(), 300u);
+    ASSERT_EQUAL(cell("B1"_pos)->GetPrecedents().size(), 1u);
+    ASSERT_EQUAL(cell("B2"_pos)->GetPrecedents().size(), 2u);
+    ASSERT_EQUAL(std::get<double>(cell("B300"_pos)->GetValueView()), 299.0);
+
+    // relinking a cell keeps the links of the others
+    sheet.SetCell("B2"_pos, "=A3");
+    ASSERT_EQUAL(cell("A1"_pos)->GetDependentPositions().size(), 299u);
+    ASSERT_EQUAL(cell("A3"_pos)->GetDependentPositions().size(), 2u);
+    ASSERT(!cell("A2"_pos)->IsReferenced());
+
+    // cells are destroyed when cleared, and their places reused
+    const Cell* removed = cell("B300"_pos);
+    sheet.ClearCell("B300"_pos);
+    ASSERT(sheet.GetCell("B300"_pos) == nullptr);
+    ASSERT_EQUAL(cell("A1"_pos)->GetDependentPositions().size(), 298u);
+    sheet.SetCell("C1"_pos, "=A300*2");
+    ASSERT(cell("C1"_pos) == removed);
+    ASSERT_EQUAL(std::get<double>(cell("C1"_pos)->GetValueView()), 598.0);
+    sheet.SetCell("A300"_pos, "1");
+    ASSERT_EQUAL(std::get<double>(cell("C1"_pos)->GetValueView()), 2.0);
+}
+
+void TestDataTable() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "0.5");
+    sheet.SetCell("A2"_pos, "100");
+    sheet.SetCell("B1"_pos, "=A2*(1+A1)");
+    sheet.SetCell("B2"_pos, "=B1*2");
+    sheet.SetCell("C1"_pos, "=A3+1");
+    sheet.SetCell("D1"_pos, "=B1/A1");
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(300.0));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetValue(), CellInterface::Value(300.0));
+    ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(1.0));
+
+    perf::Reset();
+    DataTable table(sheet, {"A1"_pos, "A2"_pos}, {"B2"_pos, "C1"_pos, "D1"_pos, "A1"_pos});
+    ASSERT_EQUAL(table.GetAffectedCellCount(), 3u);
+
+    constexpr int TUPLES = 1000;
+    std::vector<DataTable::Values> tuples;
+    for (int i = 0; i < TUPLES; ++i) {
+        tuples.push_back({static_cast<double>(i), 10.0});
+    }
+    tuples.push_back({"abc"s, 10.0});
+
+    ThreadPool pool(4);
+    std::vector<DataTable::Values> rows = table.Evaluate(tuples, pool);
+    ASSERT_EQUAL(rows.size(), tuples.size());
+    for (int i = 1; i < TUPLES; ++i) {
+        ASSERT_EQUAL(rows[i][0], CellInterface::Value(20.0 * (1 + i)));
+        ASSERT_EQUAL(rows[i][1], CellInterface::Value(1.0));
+        ASSERT_EQUAL(rows[i][2], CellInterface::Value(10.0 * (1 + i) / i));
+        ASSERT_EQUAL(rows[i][3], CellInterface::Value(static_cast<double>(i)));
+    }
+    ASSERT_EQUAL(rows[0][2], CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    ASSERT_EQUAL(rows[TUPLES][0], CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(rows[TUPLES][3], CellInterface::Value("abc"s));
+
+    // the sheet is neither modified nor reparsed, and its cached values stay valid
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 0u);
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 0u);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "0.5");
+    ASSERT(sheet.GetStaleCells().empty());
+    ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(300.0));
+
+    try {
+        table.Evaluate({{1.0}}, pool);
+        ASSERT(false);
+    } catch (const std::invalid_argument&) {
+    }
+    try {
+        DataTable duplicate(sheet, {"A1"_pos, "A1"_pos}, {"B2"_pos});
+        ASSERT(false);
+    } catch (const std::invalid_argument&) {
+    }
+}
+
+void TestSheetFork() {
+    constexpr int LENGTH = 100;
+    Sheet parent;
+    parent.SetCell("A1"_pos, "1");
+    for (int row = 1; row < LENGTH; ++row) {
+        parent.SetCell(Position{row, 0}, "="s + Position{row - 1, 0}.ToString() + "+1");
+    }
+    parent.SetCell("B1"_pos, "=A100*2");
+    parent.SetCell("C1"_pos, "label");
+    parent.SetCell("C2"_pos, "=A1+A2");
+
+    // forking publishes the parent, which computes its values
+    std::unique_ptr<Sheet> fork = parent.Fork();
+    perf::Reset();
+    const Sheet& view = *fork;
+    ASSERT_EQUAL(view.GetCell("B1"_pos)->GetValue(), CellInterface::Value(200.0));
+    ASSERT_EQUAL(view.GetCell("A50"_pos)->GetText(), "=A49+1");
+    ASSERT_EQUAL(view.GetPrintableSize(), parent.GetPrintableSize());
+    std::ostringstream parent_texts;
+    parent.PrintTexts(parent_texts);
+    std::ostringstream fork_texts;
+    view.PrintTexts(fork_texts);
+    ASSERT_EQUAL(fork_texts.str(), parent_texts.str());
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 0u);
+
+    // only the edited cell and its dependents are recomputed, and no formula is parsed again
+    perf::Reset();
+    fork->SetCell("A91"_pos, "0");
+    ASSERT_EQUAL(view.GetCell("B1"_pos)->GetValue(), CellInterface::Value(18.0));
+    ASSERT_EQUAL(perf::Get(perf::Counter::FormulasParsed), 0u);
+    ASSERT_EQUAL(perf::Get(perf::Counter::CellsEvaluated), 10u);
+    ASSERT_EQUAL(view.GetCell("C2"_pos)->GetValue(), CellInterface::Value(3.0));
+    ASSERT_EQUAL(parent.GetCell("B1"_pos)->GetValue(), CellInterface::Value(200.0));
+
+    // edits of the parent after forking do not leak into the fork and vice versa
+    parent.SetCell("A1"_pos, "11");
+    ASSERT_EQUAL(parent.GetCell("C2"_pos)->GetValue(), CellInterface::Value(23.0));
+    ASSERT_EQUAL(view.GetCell("C2"_pos)->GetValue(), CellInterface::Value(3.0));
+    fork->SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(view.GetCell("C2"_pos)->GetValue(), CellInterface::Value(5.0));
+    ASSERT_EQUAL(view.GetCell("A90"_pos)->GetValue(), CellInterface::Value(91.0));
+    ASSERT_EQUAL(view.GetCell("B1"_pos)->GetValue(), CellInterface::Value(18.0));
+    ASSERT_EQUAL(parent.GetCell("A90"_pos)->GetValue(), CellInterface::Value(100.0));
+
+    // cycles through cells still shared with the base are detected
+    try {
+        fork->SetCell("A1"_pos, "=C2");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(view.GetCell("A1"_pos)->GetText(), "2");
+
+    fork->ClearCell("C1"_pos);
+    ASSERT_EQUAL(view.GetCell("C1"_pos)->GetText(), "");
+    ASSERT_EQUAL(parent.GetCell("C1"_pos)->GetText(), "label");
+    ASSERT_EQUAL(view.GetPrintableSize(), (Size{LENGTH, 3}));
+
+    // a fork of a fork starts from the fork's state
+    std::unique_ptr<Sheet> grandchild = fork->Fork();
+    ASSERT_EQUAL(grandchild->ReadSnapshot()->GetCell("B1"_pos)->value, CellInterface::Value(18.0));
+    try {
+        grandchild->SetCell("A1"_pos, "=A50");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    grandchild->SetCell("A2"_pos, "=A1*100");
+    ASSERT_EQUAL(std::as_const(*grandchild).GetCell("A90"_pos)->GetValue(), CellInterface::Value(288.0));
+    ASSERT_EQUAL(std::as_const(*grandchild).GetCell("C2"_pos)->GetValue(), CellInterface::Value(202.0));
+    ASSERT_EQUAL(view.GetCell("A90"_pos)->GetValue(), CellInterface::Value(91.0));
+
+    std::ostringstream fork_values;
+    fork->PrintValues(fork_values);
+    fork->PublishSnapshot();
+    std::ostringstream snapshot_values;
+    fork->ReadSnapshot()->PrintValues(snapshot_values);
+    ASSERT_EQUAL(snapshot_values.str(), fork_values.str());
+}
+
+void TestFailedSetCellLeavesNoCell() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=B1");
+    try {
+        sheet.SetCell("B1"_pos, "=A1");
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "");
+
+    try {
+        sheet.SetCell("C1"_pos, "=C1");
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+}
+
+size_t CountOccurrences(std::string_view text, std::string_view pattern) {
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != text.npos; pos = text.find(pattern, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+void TestBatchRecalculation() {
+    constexpr int ROWS = 200;
+    auto fill = [](Sheet& sheet) {
+        for (int row = 0; row < ROWS; ++row) {
+            std::string r = std::to_string(row + 1);
+            sheet.SetCell(Position{row, 0}, row == 99 ? "abc"s : std::to_string(row));
+            sheet.SetCell(Position{row, 1}, "=A" + r + "*2+1");
+            sheet.SetCell(Position{row, 2}, "=(A" + r + "-50)/(A" + r + "-50)+Z" + r);
+            sheet.SetCell(Position{row, 3}, "=-B" + r + "/C" + r);
+            // refers to its own column, so it is computed cell by cell
+            sheet.SetCell(Position{row, 4}, row ? "=E" + std::to_string(row) + "+D" + r : "=D1"s);
+        }
+    };
+    Sheet batched;
+    fill(batched);
+    Sheet scalar;
+    fill(scalar);
+
+    trace::Clear();
+    trace::Enable(true);
+    ThreadPool pool(1);
+    ASSERT(batched.RecalculateAsync(pool).Wait() == RecalculationStatus::COMPLETED);
+    trace::Enable(false);
+    std::ostringstream json;
+    trace::DumpChromeTrace(json);
+    trace::Clear();
+    // three columns of 200 cells in blocks of 64
+    ASSERT_EQUAL(CountOccurrences(json.str(), "\"name\":\"Formula::EvaluateBatch\""), 12u);
+    ASSERT_EQUAL(CountOccurrences(json.str(), "\"name\":\"Formula::Evaluate\""), static_cast<size_t>(ROWS));
+
+    // every lane gets the value or the first error a cell computed on its own gets
+    for (int row = 0; row < ROWS; ++row) {
+        for (int col = 1; col < 5; ++col) {
+            ASSERT_EQUAL(batched.GetCell(Position{row, col})->GetValue(), scalar.GetCell(Position{row, col})->GetValue());
+        }
+    }
+    ASSERT_EQUAL(batched.GetCell("B100"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(batched.GetCell("C51"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    ASSERT_EQUAL(batched.GetCell("D100"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    ASSERT_EQUAL(batched.GetCell("D3"_pos)->GetValue(), CellInterface::Value(-5.0));
+}
+
+void TestTraceChromeJson() {
+    trace::Clear();
+    trace::Enable(true);
+    {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "=B1+1");
+        std::ostringstream values;
+        sheet->PrintValues(values);
+    }
+    trace::Enable(false);
+
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "=C1");
+
+    std::ostringstream json;
+    trace::DumpChromeTrace(json);
+    std::string dump = json.str();
+    ASSERT_EQUAL(dump.find("{\"traceEvents\":["), 0u);
+    ASSERT_EQUAL(CountOccurrences(dump, "\"name\":\"Cell::Set\""), 2u);  // A1 and the empty B1
+    ASSERT_EQUAL(CountOccurrences(dump, "\"name\":\"Cell::Set/IsCircularDependent\""), 2u);
+    ASSERT_EQUAL(CountOccurrences(dump, "\"name\":\"Formula::Evaluate\""), 1u);
+    ASSERT_EQUAL(CountOccurrences(dump, "\"name\":\"Sheet::PrintValues\""), 1u);
+    ASSERT_EQUAL(CountOccurrences(dump, "\"ph\":\"X\""), CountOccurrences(dump, "\"dur\":"));
+
+    trace::Clear();
+    std::ostringstream cleared;
+    trace::DumpChromeTrace(cleared);
+    ASSERT_EQUAL(cleared.str(), "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}");
+}
+
+void TestTraceRingBufferOverwritesOldest() {
+    trace::Clear();
+    trace::Enable(true);
+    for (uint64_t i = 0; i < 2 * trace::RING_CAPACITY; ++i) {
+        TRACE_SPAN("Wrap");
+    }
+    trace::Enable(false);
+
+    std::ostringstream json;
+    trace::DumpChromeTrace(json);
+    size_t spans = CountOccurrences(json.str(), "\"name\":\"Wrap\"");
+    ASSERT(spans <= trace::RING_CAPACITY);
+    ASSERT(spans >= trace::RING_CAPACITY - 1);
+    trace::Clear();
+}
 }  // namespace
 
-int main() {
+// Usage:
+//   spreadsheet                   runs the unit tests
+//   spreadsheet --perf-gate <baselines> [--workload <name>] [--tolerance <fraction>] [--update]
+//                                 runs the performance regression gate
+//   spreadsheet --bench           runs the wall-clock benchmarks
+int main(int argc, char* argv[]) {
+    if (argc > 1 && argv[1] == "--bench"sv) {
+        return RunBenchmarks();
+    }
+    if (argc > 2 && argv[1] == "--perf-gate"sv) {
+        std::string workload;
+        double tolerance = 0.1;
+        bool update = false;
+        for (int i = 3; i < argc; ++i) {
+            if (argv[i] == "--workload"sv && i + 1 < argc) {
+                workload = argv[++i];
+            } else if (argv[i] == "--tolerance"sv && i + 1 < argc) {
+                tolerance = std::stod(argv[++i]);
+            } else if (argv[i] == "--update"sv) {
+                update = true;
+            }
+        }
+        return RunPerfGate(argv[2], workload, tolerance, update);
+    }
+
     TestRunner tr;
     RUN_TEST(tr, TestPositionAndStringConversion);
     RUN_TEST(tr, TestPositionToStringInvalid);
     RUN_TEST(tr, TestStringToPositionInvalid);
+    RUN_TEST(tr, TestPositionCharsConversion);
     RUN_TEST(tr, TestEmpty);
     RUN_TEST(tr, TestInvalidPosition);
     RUN_TEST(tr, TestSetCellPlainText);
@@ -369,5 +2206,37 @@ int main() {
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestDependentCacheInvalidation);
+    RUN_TEST(tr, TestClearReferencedCell);
+    RUN_TEST(tr, TestCircularReferenceThroughSecondOperand);
+    RUN_TEST(tr, TestPerfCounters);
+    RUN_TEST(tr, TestSheetStatistics);
+    RUN_TEST(tr, TestSnapshotIsolation);
+    RUN_TEST(tr, TestSnapshotConcurrentReaders);
+    RUN_TEST(tr, TestConcurrentGetValueComputesOnce);
+    RUN_TEST(tr, TestAsyncRecalculation);
+    RUN_TEST(tr, TestAsyncRecalculationSupersededByEdit);
+    RUN_TEST(tr, TestRecalculateForBudget);
+    RUN_TEST(tr, TestSharedFormulaTemplates);
+    RUN_TEST(tr, TestParseCache);
+    RUN_TEST(tr, TestFormulaSimplification);
+    RUN_TEST(tr, TestMemoryUsage);
+    RUN_TEST(tr, TestValueBudget);
+    RUN_TEST(tr, TestCompaction);
+    RUN_TEST(tr, TestEditJournal);
+    RUN_TEST(tr, TestEditLog);
+    RUN_TEST(tr, TestCheckpoints);
+    RUN_TEST(tr, TestBatchRecalculation);
+    RUN_TEST(tr, TestColumnarValues);
+    RUN_TEST(tr, TestInternedTexts);
+    RUN_TEST(tr, TestCellViews);
+    RUN_TEST(tr, TestCompactCells);
+    RUN_TEST(tr, TestDataTable);
+    RUN_TEST(tr, TestSheetFork);
+    RUN_TEST(tr, TestFailedSetCellLeavesNoCell);
+    RUN_TEST(tr, TestWorkbookCrossSheetReferences);
+    RUN_TEST(tr, TestWorkbookRecalculation);
+    RUN_TEST(tr, TestTraceChromeJson);
+    RUN_TEST(tr, TestTraceRingBufferOverwritesOldest);
     return 0;
 }
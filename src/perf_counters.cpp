@@ -0,0 +1,55 @@
+#include "perf_counters.h"
+
+#include "alloc_tracker.h"
+
+using namespace std::literals;
+
+namespace perf {
+
+namespace {
+std::atomic<std::uint64_t>& GetCounter(Counter counter) {
+    return detail::counters[static_cast<size_t>(counter)];
+}
+}  // namespace
+
+std::uint64_t Get(Counter counter) {
+    std::uint64_t value = GetCounter(counter).load(std::memory_order_relaxed);
+    if (counter == Counter::Allocations) {
+        value += alloc::ProcessUsage().allocations;
+    } else if (counter == Counter::AllocatedBytes) {
+        value += alloc::ProcessUsage().bytes;
+    }
+    return value;
+}
+
+void Reset() {
+    for (auto& counter : detail::counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    // the totals are never reset, so the counters start below them; the sums wrap around to zero
+    alloc::Usage usage = alloc::ProcessUsage();
+    GetCounter(Counter::Allocations).store(0 - usage.allocations, std::memory_order_relaxed);
+    GetCounter(Counter::AllocatedBytes).store(0 - usage.bytes, std::memory_order_relaxed);
+}
+
+std::string_view CounterName(Counter counter) {
+    switch (counter) {
+    case Counter::CellsEvaluated:
+        return "cells_evaluated"sv;
+    case Counter::FormulasParsed:
+        return "formulas_parsed"sv;
+    case Counter::GraphNodesVisited:
+        return "graph_nodes_visited"sv;
+    case Counter::CacheInvalidations:
+        return "cache_invalidations"sv;
+    case Counter::Allocations:
+        return "allocations"sv;
+    case Counter::AllocatedBytes:
+        return "allocated_bytes"sv;
+    case Counter::COUNT:
+        break;
+    }
+    return ""sv;
+}
+
+}  // namespace perf
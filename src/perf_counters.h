@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// Process-wide operation counters.
+// Unlike wall time they are deterministic for a given workload,
+// so the performance regression gate can compare them against stored baselines.
+namespace perf {
+
+enum class Counter {
+    CellsEvaluated,      // formula evaluations that missed the value cache
+    FormulasParsed,      // expressions parsed, i.e. misses of the parse cache
+    GraphNodesVisited,   // cells visited by dependency graph traversals
+    CacheInvalidations,  // cached formula values that were dropped
+    Allocations,         // calls to the global operator new, see alloc_tracker.h
+    AllocatedBytes,      // bytes requested from the global operator new
+    COUNT,
+};
+
+namespace detail {
+inline std::array<std::atomic<std::uint64_t>, static_cast<size_t>(Counter::COUNT)> counters{};
+}  // namespace detail
+
+inline void Add(Counter counter, std::uint64_t value = 1) {
+    detail::counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+// The allocation counters are summed from the per-thread counts of alloc::ProcessUsage.
+std::uint64_t Get(Counter counter);
+
+void Reset();
+
+std::string_view CounterName(Counter counter);
+
+}  // namespace perf
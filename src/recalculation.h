@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+enum class RecalculationStatus {
+    COMPLETED,
+    CANCELLED,
+};
+
+// Tracks a background recalculation started by Sheet::RecalculateAsync.
+// Copies refer to the same recalculation; all methods may be called from any thread.
+// A default-constructed handle refers to none: it is done, cancelled, and without progress.
+class RecalculationHandle {
+public:
+    struct Progress {
+        size_t done = 0;
+        // formula cells that needed computing; zero until the worker has collected them
+        size_t total = 0;
+    };
+
+    RecalculationHandle() = default;
+
+    // Cells computed so far out of the dirty ones.
+    Progress GetProgress() const {
+        if (!state_) {
+            return {};
+        }
+        return {state_->done.load(std::memory_order_relaxed), state_->total.load(std::memory_order_relaxed)};
+    }
+
+    // Asks the worker to stop before the next cell. Values computed so far stay cached,
+    // but no new version is published.
+    void Cancel() {
+        if (state_) {
+            state_->cancelled.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    bool IsDone() const {
+        return !state_ || future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    RecalculationStatus Wait() const {
+        return state_ ? future_.get() : RecalculationStatus::CANCELLED;
+    }
+
+    // The published version number once completed, 0 if none was published.
+    std::uint64_t GetVersion() const {
+        if (!state_) {
+            return 0;
+        }
+        future_.wait();
+        return state_->version;
+    }
+
+    // Not valid for a default-constructed handle.
+    const std::shared_future<RecalculationStatus>& GetFuture() const {
+        return future_;
+    }
+
+private:
+    friend class Sheet;
+    friend class Workbook;
+
+    struct State {
+        std::atomic<size_t> done{0};
+        std::atomic<size_t> total{0};
+        std::atomic<bool> cancelled{false};
+        // written by the worker before the future becomes ready
+        std::uint64_t version = 0;
+    };
+
+    RecalculationHandle(std::shared_ptr<State> state, std::shared_future<RecalculationStatus> future)
+        : state_(std::move(state))
+        , future_(std::move(future)) {
+    }
+
+    std::shared_ptr<State> state_;
+    std::shared_future<RecalculationStatus> future_;
+};
+
+// A rectangle of cells, e.g. the part of the sheet visible in a frontend.
+struct Viewport {
+    Position top_left;
+    Size size;
+
+    bool Contains(Position pos) const {
+        return pos.row >= top_left.row && pos.row < top_left.row + size.rows
+            && pos.col >= top_left.col && pos.col < top_left.col + size.cols;
+    }
+};
+
+// The outcome of one Sheet::RecalculateFor call.
+struct RecalculationSlice {
+    // formula cells computed during the call
+    size_t computed = 0;
+    // true if no formula cell of the sheet is stale any more
+    bool complete = false;
+    // formula cells of the viewport still waiting for their values, in row-major order
+    std::vector<Position> stale_in_viewport;
+};
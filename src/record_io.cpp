@@ -0,0 +1,217 @@
+#include "record_io.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+namespace record_io {
+
+namespace {
+// the size and the checksum of the payload
+constexpr size_t FRAME_HEADER_SIZE = 8;
+
+void PutUint32(std::string& output, std::uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        output.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+std::uint32_t GetUint32(const char* input) {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<std::uint32_t>(static_cast<unsigned char>(input[i])) << (8 * i);
+    }
+    return value;
+}
+
+// FNV-1a; it only has to tell a torn frame from a complete one
+std::uint32_t Checksum(std::string_view data) {
+    std::uint32_t hash = 2166136261u;
+    for (char c : data) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+[[noreturn]] void ThrowError(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+}  // namespace
+
+void PutVarint(std::string& output, std::uint64_t value) {
+    while (value >= 0x80) {
+        output.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<char>(value));
+}
+
+bool GetVarint(std::string_view& input, std::uint64_t& value) {
+    value = 0;
+    for (int shift = 0; !input.empty() && shift < 64; shift += 7) {
+        auto byte = static_cast<unsigned char>(input.front());
+        input.remove_prefix(1);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PutRecord(std::string& output, RecordKind kind, Position pos, std::string_view text) {
+    output.push_back(kind);
+    PutVarint(output, static_cast<std::uint64_t>(pos.row));
+    PutVarint(output, static_cast<std::uint64_t>(pos.col));
+    if (kind == SET) {
+        PutVarint(output, text.size());
+        output.append(text);
+    }
+}
+
+bool GetRecord(std::string_view& input, Record& record) {
+    if (input.empty()) {
+        return false;
+    }
+    record.kind = static_cast<RecordKind>(input.front());
+    input.remove_prefix(1);
+    std::uint64_t row;
+    std::uint64_t col;
+    if ((record.kind != CLEAR && record.kind != SET) || !GetVarint(input, row) || !GetVarint(input, col)) {
+        return false;
+    }
+    record.pos = {static_cast<int>(row), static_cast<int>(col)};
+    record.text = {};
+    if (record.kind == SET) {
+        std::uint64_t size;
+        if (!GetVarint(input, size) || size > input.size()) {
+            return false;
+        }
+        record.text = input.substr(0, size);
+        input.remove_prefix(size);
+    }
+    return record.pos.IsValid();
+}
+
+std::string MakeFrame(std::string_view payload) {
+    std::string frame;
+    frame.reserve(FRAME_HEADER_SIZE + payload.size());
+    PutUint32(frame, static_cast<std::uint32_t>(payload.size()));
+    PutUint32(frame, Checksum(payload));
+    frame.append(payload);
+    return frame;
+}
+
+std::uint64_t ReadFrames(const std::string& path, std::string_view header,
+    const std::function<void(std::string_view)>& function, size_t max_frames) {
+    std::ifstream input(path, std::ios::binary);
+    std::string actual_header(header.size(), '\0');
+    if (!input.read(actual_header.data(), actual_header.size()) || actual_header != header) {
+        throw std::runtime_error("Unrecognized file: "s + path);
+    }
+    std::error_code error;
+    const std::uint64_t file_size = std::filesystem::file_size(path, error);
+    if (error) {
+        throw std::runtime_error("Cannot read the size of "s + path);
+    }
+    std::uint64_t end = header.size();
+    std::array<char, FRAME_HEADER_SIZE> frame_header;
+    std::string payload;
+    for (size_t frames = 0; frames < max_frames && input.read(frame_header.data(), frame_header.size()); ++frames) {
+        // the size of a torn frame may be anything, so it is checked before allocating
+        const std::uint32_t size = GetUint32(frame_header.data());
+        if (size > file_size - end - FRAME_HEADER_SIZE) {
+            break;
+        }
+        payload.resize(size);
+        if (!input.read(payload.data(), payload.size()) || Checksum(payload) != GetUint32(frame_header.data() + 4)) {
+            break;
+        }
+        function(payload);
+        end += FRAME_HEADER_SIZE + payload.size();
+    }
+    return end;
+}
+
+int OpenFile(const std::string& path, bool truncate) {
+#ifdef _WIN32
+    int file = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY | (truncate ? _O_TRUNC : 0),
+        _S_IREAD | _S_IWRITE);
+#else
+    int file = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+#endif
+    if (file < 0) {
+        ThrowError("Cannot open "s + path);
+    }
+    return file;
+}
+
+void WriteFile(int file, std::string_view data) {
+    while (!data.empty()) {
+#ifdef _WIN32
+        int written = _write(file, data.data(), static_cast<unsigned>(std::min<size_t>(data.size(), 1 << 30)));
+#else
+        ssize_t written = write(file, data.data(), data.size());
+#endif
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowError("Cannot write a file"s);
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+void SyncFile(int file) {
+#ifdef _WIN32
+    int result = _commit(file);
+#else
+    int result = fsync(file);
+#endif
+    if (result != 0) {
+        ThrowError("Cannot sync a file"s);
+    }
+}
+
+void CloseFile(int file) {
+#ifdef _WIN32
+    _close(file);
+#else
+    close(file);
+#endif
+}
+
+void ReplaceFile(const std::string& from, const std::string& path) {
+    std::filesystem::rename(from, path);
+    SyncDirectory(path);
+}
+
+void SyncDirectory(const std::string& path) {
+#ifndef _WIN32
+    // Windows syncs the entries of directories itself
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    int file = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file >= 0) {
+        fsync(file);
+        close(file);
+    }
+#endif
+}
+
+}  // namespace record_io
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+
+// The binary encoding shared by the files an edit log and checkpoints are kept in.
+// A file starts with a fixed header telling what it holds, followed by frames: the size and
+// the checksum of a payload as little-endian 32-bit numbers, then the payload. A payload holds
+// records of cells: a kind byte, the row and the column as varints, and for a set cell the length
+// of its text as a varint and the text.
+namespace record_io {
+
+enum RecordKind : char { CLEAR, SET };
+
+struct Record {
+    RecordKind kind = CLEAR;
+    Position pos;
+    // points into the parsed payload
+    std::string_view text;
+};
+
+void PutVarint(std::string& output, std::uint64_t value);
+// Takes a varint off the front of input; false if it is cut off.
+bool GetVarint(std::string_view& input, std::uint64_t& value);
+
+void PutRecord(std::string& output, RecordKind kind, Position pos, std::string_view text = {});
+// Takes a record off the front of input; false if it is malformed.
+bool GetRecord(std::string_view& input, Record& record);
+
+std::string MakeFrame(std::string_view payload);
+
+// Calls function with the payload of every complete frame of the file at path, in order, and returns
+// the size of the file up to the end of the last one. Stops at the first frame torn or corrupted,
+// or after max_frames. Throws std::runtime_error if the file does not start with header.
+std::uint64_t ReadFrames(const std::string& path, std::string_view header,
+    const std::function<void(std::string_view)>& function,
+    size_t max_frames = std::numeric_limits<size_t>::max());
+
+// Unbuffered writes to a file descriptor, so that syncing makes them durable.
+// All throw std::system_error on failure.
+int OpenFile(const std::string& path, bool truncate);
+void WriteFile(int file, std::string_view data);
+void SyncFile(int file);
+void CloseFile(int file);
+
+// Renames a synced file over path, and makes the rename durable.
+void ReplaceFile(const std::string& from, const std::string& path);
+// Makes the creation or the renaming of the file at path durable.
+void SyncDirectory(const std::string& path);
+
+}  // namespace record_io
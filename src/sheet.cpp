@@ -1,63 +1,232 @@
 #include "sheet.h"
 
 #include "cell.h"
+#include "checkpoint.h"
 #include "common.h"
+#include "edit_log.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "workbook.h"
 
 #include <algorithm>
+#include <array>
 #include <functional>
 #include <iostream>
 #include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
 
 using namespace std::literals;
 
-Sheet::~Sheet() {}
+Sheet::Sheet()
+	: current_snapshot_(std::make_shared<SheetSnapshot>())
+	, published_snapshot_(current_snapshot_.get()) {
+}
+
+Sheet::Sheet(Workbook& workbook, std::string name)
+	: Sheet() {
+	workbook_ = &workbook;
+	name_ = std::move(name);
+}
+
+Sheet::~Sheet() {
+	StopOwnRecalculation();
+	for (const auto& row : table_) {
+		for (Cell* cell : row) {
+			if (cell) {
+				cells_.Destroy(cell);
+			}
+		}
+	}
+}
 
 void Sheet::SetCell(Position pos, std::string text) {
+	ApiScope scope(statistics_, SheetStatistics::Api::SetCell);
 	if (!pos.IsValid()) {
 		throw InvalidPositionException("Invalid position"s);
 	}
 
+	StopRecalculation();
 	OptionalTableResize(pos);
 
-	if (!table_[pos.row][pos.col]) {
-		table_[pos.row][pos.col] = std::make_unique<Cell>(*this);
+	if (Cell* cell = FindCell(pos); cell || (cell = Materialize(pos))) {
+		cell->Set(std::move(text));
+		EnforceValueBudget();
+		return;
+	}
 
+	Cell* cell = cells_.Create(*this, pos);
+	table_[pos.row][pos.col] = cell;
+	try {
+		cell->Set(std::move(text));
 	}
-	table_[pos.row][pos.col]->Set(std::move(text));
+	catch (...) {
+		// a cell that failed to be set must not stay in the table without content
+		RemoveCell(pos);
+		throw;
+	}
+	EnforceValueBudget();
 }
 
 const CellInterface* Sheet::GetCell(Position pos) const {
-	return const_cast<Sheet*>(this)->GetCell(pos);
+	ApiScope scope(statistics_, SheetStatistics::Api::GetCell);
+	if (!pos.IsValid()) {
+		throw InvalidPositionException("Invalid position"s);
+	}
+
+	return LookupCell(pos);
 }
 
 CellInterface* Sheet::GetCell(Position pos) {
+	ApiScope scope(statistics_, SheetStatistics::Api::GetCell);
 	if (!pos.IsValid()) {
 		throw InvalidPositionException("Invalid position"s);
 	}
 
-	if (static_cast<size_t>(pos.row) >= table_.size()) {
-		return nullptr;
+	if (Cell* cell = FindCell(pos)) {
+		return cell;
 	}
+	// the caller may modify the cell, so a fork needs its own copy
+	return Materialize(pos);
+}
 
-	if (static_cast<size_t>(pos.col) >= table_.at(pos.row).size()) {
-		return nullptr;
+void Sheet::ClearCell(Position pos) {
+	ApiScope scope(statistics_, SheetStatistics::Api::ClearCell);
+	StopRecalculation();
+	if (auto* cell = static_cast<Cell*>(GetCell(pos))) {
+		cell->Clear();
+		// a referenced cell stays as an empty one so that dependents keep a valid link;
+		// in a fork it also hides the base cell
+		RemoveIfUnused(pos);
 	}
+}
 
-	return table_[pos.row][pos.col].get();
+void Sheet::Load(std::vector<std::pair<Position, std::string>> cells) {
+	ApiScope scope(statistics_, SheetStatistics::Api::Load);
+	TRACE_SPAN("Sheet::Load");
+	for (const auto& [pos, text] : cells) {
+		if (!pos.IsValid()) {
+			throw InvalidPositionException("Invalid position"s);
+		}
+	}
+	bool has_content = false;
+	ForEachText([&has_content](Position, std::string_view) {
+		has_content = true;
+	});
+	if (base_ || has_content) {
+		throw std::logic_error("Only a sheet without content can be loaded");
+	}
 
+	StopRecalculation();
+	// row by row, so that the table and the value store grow in order
+	std::stable_sort(cells.begin(), cells.end(), [](const auto& lhs, const auto& rhs) {
+		return lhs.first < rhs.first;
+	});
+	auto is_last = [&cells](size_t i) {
+		return i + 1 == cells.size() || !(cells[i + 1].first == cells[i].first);
+	};
+	try {
+		for (size_t i = 0; i < cells.size(); ++i) {
+			const auto& [pos, text] = cells[i];
+			if (!is_last(i) || text.empty()) {
+				continue;
+			}
+			OptionalTableResize(pos);
+			Cell* cell = FindCell(pos);
+			if (!cell) {
+				cell = cells_.Create(*this, pos);
+				table_[pos.row][pos.col] = cell;
+			}
+			cell->Load(text);
+		}
+		if (HasCircularDependency()) {
+			throw CircularDependencyException("Loaded cells refer to each other in a cycle");
+		}
+	}
+	catch (...) {
+		for (auto& row : table_) {
+			for (Cell* cell : row) {
+				if (cell) {
+					cell->Unload();
+				}
+			}
+		}
+		for (int row = 0; row < static_cast<int>(table_.size()); ++row) {
+			for (int col = 0; col < static_cast<int>(table_[row].size()); ++col) {
+				RemoveIfUnused({row, col});
+			}
+		}
+		throw;
+	}
+
+	for (size_t i = 0; i < cells.size(); ++i) {
+		if (is_last(i) && !cells[i].second.empty()) {
+			LogEdit(cells[i].first);
+		}
+	}
+	EnforceValueBudget();
 }
 
-void Sheet::ClearCell(Position pos) {
-	if (GetCell(pos)) {
-		table_[pos.row][pos.col].reset();
+void Sheet::ForEachText(const std::function<void(Position, std::string_view)>& visitor,
+	std::optional<Viewport> area) const {
+	if (base_) {
+		// the cells a fork has not copied are only in its base, whose size is known; the size of the
+		// fork itself would take a scan of the whole sheet
+		const Size base_size = base_->GetPrintableSize();
+		int first_row = area ? area->top_left.row : 0;
+		int first_col = area ? area->top_left.col : 0;
+		int last_row = std::max(static_cast<int>(table_.size()), base_size.rows);
+		if (area) {
+			last_row = std::min(last_row, first_row + area->size.rows);
+		}
+		for (int row = first_row; row < last_row; ++row) {
+			int last_col = static_cast<size_t>(row) < table_.size() ? static_cast<int>(table_[row].size()) : 0;
+			last_col = std::max(last_col, base_size.cols);
+			if (area) {
+				last_col = std::min(last_col, first_col + area->size.cols);
+			}
+			for (int col = first_col; col < last_col; ++col) {
+				const CellInterface* cell = LookupCell({row, col});
+				if (cell && !cell->GetTextView().empty()) {
+					visitor({row, col}, cell->GetTextView());
+				}
+			}
+		}
+		return;
+	}
+	int first_row = area ? area->top_left.row : 0;
+	int first_col = area ? area->top_left.col : 0;
+	int last_row = static_cast<int>(table_.size());
+	if (area) {
+		last_row = std::min(last_row, first_row + area->size.rows);
+	}
+	for (int row = first_row; row < last_row; ++row) {
+		int last_col = static_cast<int>(table_[row].size());
+		if (area) {
+			last_col = std::min(last_col, first_col + area->size.cols);
+		}
+		for (int col = first_col; col < last_col; ++col) {
+			const Cell* cell = table_[row][col];
+			if (cell && cell->content_.index() != Cell::EMPTY) {
+				visitor({row, col}, cell->GetTextView());
+			}
+		}
 	}
 }
 
 Size Sheet::GetPrintableSize() const {
+	ApiScope scope(statistics_, SheetStatistics::Api::GetPrintableSize);
+	Size base_size = base_ ? base_->GetPrintableSize() : Size{};
 	Size result;
-	for (int row = 0; static_cast<size_t>(row) < table_.size(); ++row) {
-		for (int col = 0; static_cast<size_t>(col) < table_.at(row).size(); ++col) {
-			if (table_[row][col]) {
+	int rows = std::max(static_cast<int>(table_.size()), base_size.rows);
+	for (int row = 0; row < rows; ++row) {
+		int cols = static_cast<size_t>(row) < table_.size() ? static_cast<int>(table_[row].size()) : 0;
+		cols = std::max(cols, base_size.cols);
+		for (int col = 0; col < cols; ++col) {
+			const CellInterface* cell = LookupCell({row, col});
+			if (cell && !cell->GetTextView().empty()) {
 				result.rows = std::max(result.rows, row + 1);
 				result.cols = std::max(result.cols, col + 1);
 			}
@@ -67,29 +236,767 @@ Size Sheet::GetPrintableSize() const {
 }
 
 void Sheet::PrintValues(std::ostream& output) const {
-	auto cell_value = [&output](const std::unique_ptr<CellInterface>& cell) {
+	ApiScope scope(statistics_, SheetStatistics::Api::PrintValues);
+	TRACE_SPAN("Sheet::PrintValues");
+	auto cell_value = [&output](const CellInterface& cell) {
 		std::visit([&output](const auto& value) {
 			output << value;
-			}, cell->GetValue());
+			}, cell.GetValueView());
 	};
 	PrintTable(output, cell_value);
 }
 
 void Sheet::PrintTexts(std::ostream& output) const {
-	auto cell_text = [&output](const std::unique_ptr<CellInterface>& cell) {
-		output <<  cell->GetText();
+	ApiScope scope(statistics_, SheetStatistics::Api::PrintTexts);
+	TRACE_SPAN("Sheet::PrintTexts");
+	auto cell_text = [&output](const CellInterface& cell) {
+		output <<  cell.GetTextView();
 	};
 	PrintTable(output, cell_text);
 }
 
+const Sheet* Sheet::FindSheet(std::string_view name) const {
+	return workbook_ ? workbook_->GetSheet(name) : nullptr;
+}
+
+Sheet* Sheet::FindSheet(std::string_view name) {
+	return workbook_ ? workbook_->GetSheet(name) : nullptr;
+}
+
+std::unique_ptr<Sheet> Sheet::Fork() {
+	if (!precedent_sheets_.empty()) {
+		throw std::logic_error("A sheet referring to other sheets cannot be forked");
+	}
+
+	// the fork starts from the current state, published as an immutable version
+	PublishSnapshot();
+	auto fork = std::make_unique<Sheet>();
+	fork->base_ = current_snapshot_;
+	fork->current_snapshot_ = current_snapshot_;
+	fork->published_snapshot_.store(fork->current_snapshot_.get(), std::memory_order_seq_cst);
+	return fork;
+}
+
+SheetStatistics Sheet::GetStatistics() const {
+	return statistics_.Get();
+}
+
+void Sheet::ResetStatistics() {
+	statistics_.Reset();
+}
+
+void Sheet::SetValueBudget(std::optional<size_t> bytes) {
+	StopRecalculation();
+	value_budget_ = bytes;
+	EnforceValueBudget();
+}
+
+ValueCacheStatistics Sheet::GetValueCacheStatistics() const {
+	ValueCacheStatistics result = value_cache_statistics_;
+	result.readmitted_chunks = readmitted_chunks_.load(std::memory_order_relaxed);
+	result.uncached_evaluations = uncached_evaluations_.load(std::memory_order_relaxed);
+	return result;
+}
+
+void Sheet::EnforceValueBudget() {
+	if (!value_budget_ || values_.GetMemoryUsage() <= *value_budget_) {
+		return;
+	}
+	ValueStore::EvictionResult evicted = values_.Evict(*value_budget_);
+	value_cache_statistics_.evicted_chunks += evicted.chunks;
+	value_cache_statistics_.evicted_values += evicted.values;
+}
+
+ValueStore::Slot Sheet::GetValueSlot(Position pos) {
+	if (!values_.IsEvicted(pos)) {
+		return values_.At(pos);
+	}
+	ValueStore::Slot slot = values_.At(pos);
+	++value_cache_statistics_.restored_chunks;
+	const int first_row = pos.row / ValueStore::CHUNK_ROWS * ValueStore::CHUNK_ROWS;
+	for (int row = first_row; row < first_row + ValueStore::CHUNK_ROWS; ++row) {
+		if (Cell* cell = FindCell({row, pos.col}); cell && row != pos.row) {
+			cell->Activate(values_.Find({row, pos.col}));
+		}
+	}
+	return slot;
+}
+
+ValueStore::Slot Sheet::ReadmitValueSlot(Position pos) {
+	bool readmitted = values_.Readmit(pos, [this](Position cell_pos, ValueStore::Slot slot) {
+		if (const Cell* cell = FindCell(cell_pos)) {
+			cell->Activate(slot);
+		}
+	});
+	if (readmitted) {
+		readmitted_chunks_.fetch_add(1, std::memory_order_relaxed);
+	}
+	// another reader may have been first
+	return values_.Find(pos);
+}
+
+SheetMemoryUsage Sheet::MemoryUsage() const {
+	using Component = SheetMemoryUsage::Component;
+	SheetMemoryUsage usage;
+	auto set = [&usage](Component component, size_t bytes) {
+		usage.bytes[static_cast<size_t>(component)] = bytes;
+	};
+	set(Component::Table, table_bytes_);
+	set(Component::Cells, cells_.GetCapacityBytes());
+	set(Component::Formulas, formula_templates_.GetMemoryUsage());
+	set(Component::Links, link_bytes_ + EstimateHashTableBytes(precedent_sheets_));
+	set(Component::Values, values_.GetMemoryUsage());
+	set(Component::Texts, text_pool_.GetMemoryUsage());
+	return usage;
+}
+
+bool Sheet::Undo() {
+	ApiScope scope(statistics_, SheetStatistics::Api::Undo);
+	StopRecalculation();
+	std::optional<JournalEntry> entry = journal_.PopUndo();
+	if (!entry) {
+		return false;
+	}
+	try {
+		ApplyJournalEntry(*entry);
+	}
+	catch (...) {
+		journal_.PushUndo(std::move(*entry));
+		throw;
+	}
+	journal_.PushRedo(std::move(*entry));
+	EnforceValueBudget();
+	return true;
+}
+
+bool Sheet::Redo() {
+	ApiScope scope(statistics_, SheetStatistics::Api::Redo);
+	StopRecalculation();
+	std::optional<JournalEntry> entry = journal_.PopRedo();
+	if (!entry) {
+		return false;
+	}
+	try {
+		ApplyJournalEntry(*entry);
+	}
+	catch (...) {
+		journal_.PushRedo(std::move(*entry));
+		throw;
+	}
+	journal_.PushUndo(std::move(*entry));
+	EnforceValueBudget();
+	return true;
+}
+
+void Sheet::SetJournalDepth(size_t depth) {
+	journal_.SetDepth(depth, [this](JournalEntry& entry) {
+		ReleaseJournalEntry(entry);
+	});
+}
+
+CompactionSlice Sheet::Compact(std::optional<std::chrono::nanoseconds> budget) {
+	ApiScope scope(statistics_, SheetStatistics::Api::Compact);
+	TRACE_SPAN("Sheet::Compact");
+	// recalculations hold pointers to cells, which may move
+	StopRecalculation();
+	const auto start = std::chrono::steady_clock::now();
+	const size_t before = MemoryUsage().GetTotal();
+
+	CompactionSlice result;
+	do {
+		if (!CompactionStep()) {
+			result.complete = true;
+			break;
+		}
+	} while (!budget || std::chrono::steady_clock::now() - start < *budget);
+
+	const size_t after = MemoryUsage().GetTotal();
+	result.released_bytes = before > after ? before - after : 0;
+	return result;
+}
+
+bool Sheet::CompactionStep() {
+	switch (compaction_phase_) {
+	case CompactionPhase::ROWS:
+		if (compaction_cursor_ < table_.size()) {
+			CompactRow(static_cast<int>(compaction_cursor_++));
+			return true;
+		}
+		CompactTable();
+		compaction_phase_ = CompactionPhase::VALUES;
+		compaction_cursor_ = 0;
+		return true;
+	case CompactionPhase::VALUES:
+		if (compaction_cursor_ < static_cast<size_t>(values_.GetColumnCount())) {
+			values_.Compact(static_cast<int>(compaction_cursor_++));
+			return true;
+		}
+		compaction_phase_ = CompactionPhase::SLABS;
+		return true;
+	case CompactionPhase::SLABS:
+		if (cells_.ReleaseSparsest([this](Cell* from, Cell* to) {
+			table_[to->pos_.row][to->pos_.col] = to;
+			to->RedirectLinks(from);
+		})) {
+			return true;
+		}
+		break;
+	}
+	compaction_phase_ = CompactionPhase::ROWS;
+	compaction_cursor_ = 0;
+	return false;
+}
+
+void Sheet::CompactRow(int row) {
+	auto& cells = table_[row];
+	for (size_t col = 0; col < cells.size(); ++col) {
+		Cell* cell = cells[col];
+		if (!cell) {
+			continue;
+		}
+		const Position pos{row, static_cast<int>(col)};
+		// left behind by formulas that referred to them, see ClearCell
+		if (RemoveIfUnused(pos)) {
+			MarkChanged(pos);
+		} else {
+			cell->ShrinkLinks();
+		}
+	}
+
+	while (!cells.empty() && !cells.back()) {
+		cells.pop_back();
+	}
+	if (cells.capacity() > 2 * cells.size()) {
+		table_bytes_ -= cells.capacity() * sizeof(Cell*);
+		cells.shrink_to_fit();
+		table_bytes_ += cells.capacity() * sizeof(Cell*);
+	}
+}
+
+void Sheet::CompactTable() {
+	while (!table_.empty() && table_.back().empty()) {
+		table_bytes_ -= table_.back().capacity() * sizeof(Cell*);
+		table_.pop_back();
+	}
+	if (table_.capacity() > 2 * table_.size()) {
+		table_bytes_ -= table_.capacity() * sizeof(Table::value_type);
+		table_.shrink_to_fit();
+		table_bytes_ += table_.capacity() * sizeof(Table::value_type);
+	}
+	ShrinkHashTable(precedent_sheets_);
+	formula_templates_.Shrink();
+	text_pool_.Shrink();
+}
+
+std::uint64_t Sheet::PublishSnapshot() {
+	ApiScope scope(statistics_, SheetStatistics::Api::PublishSnapshot);
+	StopOwnRecalculation();
+	return Publish();
+}
+
+SnapshotReader Sheet::ReadSnapshot() const {
+	// the epoch has to be pinned before the pointer is loaded
+	EpochManager::Guard guard = epochs_.Pin();
+	return SnapshotReader(std::move(guard), published_snapshot_.load(std::memory_order_seq_cst));
+}
+
+RecalculationHandle Sheet::RecalculateAsync(ThreadPool& executor) {
+	StopOwnRecalculation();
+	auto state = std::make_shared<RecalculationHandle::State>();
+	std::shared_future<RecalculationStatus> future = executor.Submit([this, state] {
+		return Recalculate(*state);
+	});
+	recalculation_ = RecalculationHandle(std::move(state), std::move(future));
+	return recalculation_;
+}
+
+std::uint64_t Sheet::Publish() {
+	TRACE_SPAN("Sheet::PublishSnapshot");
+	DeduplicateChanged();
+	std::shared_ptr<const SheetSnapshot> snapshot = current_snapshot_->Update(changed_, [this](Position pos) {
+		std::shared_ptr<const SheetSnapshot::CellData> result;
+		if (const Cell* cell = FindCell(pos)) {
+			std::vector<Position> dependents = cell->GetDependentPositions();
+			const std::vector<Position>& base_dependents = GetBaseDependents(pos);
+			dependents.insert(dependents.end(), base_dependents.begin(), base_dependents.end());
+			std::sort(dependents.begin(), dependents.end());
+			dependents.erase(std::unique(dependents.begin(), dependents.end()), dependents.end());
+			result = std::make_shared<SheetSnapshot::CellData>(cell->GetText(), cell->GetValue(), cell->GetFormula(),
+				std::move(dependents));
+		}
+		return result;
+	});
+	changed_.clear();
+	changed_unique_count_ = 0;
+
+	published_snapshot_.store(snapshot.get(), std::memory_order_seq_cst);
+	epochs_.Retire(std::move(current_snapshot_));
+	current_snapshot_ = std::move(snapshot);
+	epochs_.Collect();
+	return current_snapshot_->GetVersion();
+}
+
+RecalculationStatus Sheet::Recalculate(RecalculationHandle::State& state) {
+	ApiScope scope(statistics_, SheetStatistics::Api::Recalculate);
+	TRACE_SPAN("Sheet::Recalculate");
+	// the writer waits for this task before touching the sheet, so it is ours until we return
+	DeduplicateChanged();
+	// column by column, so that the cells of a filled-down column come after their precedents
+	// in other columns and can be computed in batches
+	std::vector<Position> roots = changed_;
+	std::sort(roots.begin(), roots.end(), [](Position lhs, Position rhs) {
+		return std::tie(lhs.col, lhs.row) < std::tie(rhs.col, rhs.row);
+	});
+	std::vector<const Cell*> order;
+	std::unordered_set<const Cell*> visited;
+	for (Position pos : roots) {
+		if (const Cell* cell = FindCell(pos)) {
+			cell->CollectStaleCells(order, visited);
+		}
+	}
+	state.total.store(order.size(), std::memory_order_relaxed);
+
+	for (const Cell* cell : order) {
+		if (state.cancelled.load(std::memory_order_relaxed)) {
+			return RecalculationStatus::CANCELLED;
+		}
+		// precedents come first, so each evaluation only reads cached values
+		if (!cell->IsCacheValid()) {
+			ComputeRun(*cell);
+		}
+		state.done.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (state.cancelled.load(std::memory_order_relaxed)) {
+		return RecalculationStatus::CANCELLED;
+	}
+
+	state.version = Publish();
+	return RecalculationStatus::COMPLETED;
+}
+
+void Sheet::ForEachNumber(Position top_left, Size size, const std::function<void(Position, double)>& visitor) const {
+	ScanValues(top_left, size, [&visitor](Position pos, ValueStore::State state, double value) {
+		if (state != ValueStore::State::FORMULA_ERROR) {
+			visitor(pos, value);
+		}
+	});
+}
+
+NumericSummary Sheet::Summarize(Position top_left, Size size) const {
+	NumericSummary summary;
+	ScanValues(top_left, size, [&summary](Position, ValueStore::State state, double value) {
+		if (state == ValueStore::State::FORMULA_ERROR) {
+			++summary.errors;
+			return;
+		}
+		++summary.count;
+		summary.sum += value;
+		summary.min = std::min(summary.min, value);
+		summary.max = std::max(summary.max, value);
+	});
+	return summary;
+}
+
+void Sheet::ScanValues(Position top_left, Size size, const ValueVisitor& visitor) const {
+	const int last_row = top_left.row + size.rows;
+	for (int col = top_left.col; col < top_left.col + size.cols; ++col) {
+		if (base_) {
+			// the cells a fork has not copied are only in its base
+			for (int row = top_left.row; row < last_row; ++row) {
+				VisitCellValue({row, col}, visitor);
+			}
+			continue;
+		}
+		values_.Scan(col, top_left.row, last_row, [this, col, &visitor](int row, ValueStore::State state, double value) {
+			switch (state) {
+			case ValueStore::State::NUMBER:
+			case ValueStore::State::VALUE:
+			case ValueStore::State::FORMULA_ERROR:
+				visitor({row, col}, state, value);
+				break;
+			case ValueStore::State::DIRTY:
+			case ValueStore::State::COMPUTING:
+				VisitCellValue({row, col}, visitor);
+				break;
+			default:
+				break;
+			}
+		}, [this, col, &visitor](int first_row, int end_row) {
+			for (int row = first_row; row < end_row; ++row) {
+				VisitCellValue({row, col}, visitor);
+			}
+		});
+	}
+}
+
+void Sheet::VisitCellValue(Position pos, const ValueVisitor& visitor) const {
+	const CellInterface* cell = LookupCell(pos);
+	if (!cell) {
+		return;
+	}
+	CellInterface::ValueView value = cell->GetValueView();
+	if (const double* number = std::get_if<double>(&value)) {
+		// empty cells read as zero as well
+		if (*number != 0.0 || !cell->GetTextView().empty()) {
+			visitor(pos, ValueStore::State::VALUE, *number);
+		}
+	}
+	else if (const std::string_view* text = std::get_if<std::string_view>(&value)) {
+		if (auto parsed = ParseNumber(*text)) {
+			visitor(pos, ValueStore::State::NUMBER, *parsed);
+		}
+	}
+	else {
+		visitor(pos, ValueStore::State::FORMULA_ERROR, static_cast<double>(std::get<FormulaError>(value).GetCategory()));
+	}
+}
+
+void Sheet::ComputeRun(const Cell& first) const {
+	// the cells below a formula that have its shape and whose precedents are computed
+	std::shared_ptr<const FormulaInterface> formula = first.GetFormula();
+	const Position pos = first.GetPosition();
+	std::array<const Cell*, FORMULA_BATCH_SIZE> run{&first};
+	size_t size = 1;
+	if (formula) {
+		// cells referring to their own column might depend on each other
+		Span<Position> references = formula->GetReferencedCellsView();
+		bool independent = std::none_of(references.begin(), references.end(), [&pos](Position reference) {
+			return reference.col == pos.col;
+		});
+		for (int row = pos.row + 1; independent && size < run.size(); ++row) {
+			const Cell* cell = FindCell({row, pos.col});
+			if (!cell || cell->IsCacheValid()) {
+				break;
+			}
+			std::shared_ptr<const FormulaInterface> cell_formula = cell->GetFormula();
+			Span<const Cell*> precedents = cell->GetPrecedents();
+			if (!cell_formula || !HaveSameShape(*formula, *cell_formula)
+				|| std::any_of(precedents.begin(), precedents.end(), [](const Cell* precedent) {
+					return !precedent->IsCacheValid();
+				})) {
+				break;
+			}
+			run[size++] = cell;
+		}
+	}
+
+	if (size == 1) {
+		first.GetValue();
+	} else {
+		Cell::ComputeBatch(run.data(), size);
+	}
+}
+
+RecalculationSlice Sheet::RecalculateFor(std::chrono::nanoseconds budget, std::optional<Viewport> viewport) {
+	ApiScope scope(statistics_, SheetStatistics::Api::Recalculate);
+	TRACE_SPAN("Sheet::RecalculateFor");
+	const auto deadline = std::chrono::steady_clock::now() + budget;
+	if (recalculation_.state_) {
+		StopOwnRecalculation();
+	}
+
+	auto for_each_stale_in_viewport = [this, &viewport](const auto& function) {
+		for (int row = viewport->top_left.row; row < viewport->top_left.row + viewport->size.rows; ++row) {
+			for (int col = viewport->top_left.col; col < viewport->top_left.col + viewport->size.cols; ++col) {
+				const Cell* cell = FindCell({row, col});
+				if (cell && !cell->IsCacheValid()) {
+					function(Position{row, col}, cell);
+				}
+			}
+		}
+	};
+
+	bool same_viewport = viewport && walked_viewport_ && viewport->top_left == walked_viewport_->top_left
+		&& viewport->size == walked_viewport_->size;
+	if (!same_viewport) {
+		viewport_walk_.clear();
+		walked_viewport_ = viewport;
+		if (viewport) {
+			for_each_stale_in_viewport([this](Position, const Cell* cell) {
+				viewport_walk_.push_back({cell, false});
+			});
+			// the top left cell is walked first
+			std::reverse(viewport_walk_.begin(), viewport_walk_.end());
+		}
+	}
+
+	RecalculationSlice result;
+	do {
+		if (!RecalculationStep(result.computed)) {
+			result.complete = true;
+			break;
+		}
+	} while (std::chrono::steady_clock::now() < deadline);
+
+	if (viewport) {
+		for_each_stale_in_viewport([&result](Position pos, const Cell*) {
+			result.stale_in_viewport.push_back(pos);
+		});
+	}
+	return result;
+}
+
+std::vector<Position> Sheet::GetStaleCells() {
+	// a background recalculation sorts and clears changed_
+	if (recalculation_.state_) {
+		StopOwnRecalculation();
+	}
+	// every formula invalidated since the last publication is in changed_
+	std::vector<Position> result = changed_;
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	result.erase(std::remove_if(result.begin(), result.end(), [this](Position pos) {
+		const Cell* cell = FindCell(pos);
+		return !cell || cell->IsCacheValid();
+	}), result.end());
+	return result;
+}
+
+void Sheet::StopRecalculation() {
+	// an edit may invalidate cells of every sheet that refers to this one
+	if (workbook_) {
+		workbook_->StopRecalculations();
+	} else {
+		StopOwnRecalculation();
+	}
+}
+
+void Sheet::StopOwnRecalculation() {
+	ResetIncrementalRecalculation();
+	if (!recalculation_.state_) {
+		return;
+	}
+	recalculation_.Cancel();
+	recalculation_.future_.wait();
+	recalculation_ = {};
+}
+
+bool Sheet::RecalculationStep(size_t& computed) {
+	WalkStack& walk = viewport_walk_.empty() ? background_walk_ : viewport_walk_;
+	if (walk.empty()) {
+		// take the next position of changed_; stale cells are never outside of it
+		if (changed_cursor_ == changed_.size()) {
+			return false;
+		}
+		const Cell* cell = FindCell(changed_[changed_cursor_++]);
+		if (cell && !cell->IsCacheValid()) {
+			walk.push_back({cell, false});
+		}
+		return true;
+	}
+
+	auto [cell, expanded] = walk.back();
+	walk.pop_back();
+	// a cell may be pushed by several dependents or by both walks
+	if (cell->IsCacheValid()) {
+		return true;
+	}
+	if (expanded) {
+		// precedents have been computed, so this evaluates a single formula
+		cell->GetValue();
+		++computed;
+		return true;
+	}
+	walk.push_back({cell, true});
+	for (const Cell* precedent : cell->GetPrecedents()) {
+		if (!precedent->IsCacheValid()) {
+			walk.push_back({precedent, false});
+		}
+	}
+	return true;
+}
+
+void Sheet::AddSheetLink(const Sheet& precedent) {
+	++precedent_sheets_[&precedent];
+}
+
+void Sheet::RemoveSheetLink(const Sheet& precedent) {
+	if (auto it = precedent_sheets_.find(&precedent); --it->second == 0) {
+		precedent_sheets_.erase(it);
+	}
+}
+
+void Sheet::ResetIncrementalRecalculation() {
+	viewport_walk_.clear();
+	walked_viewport_.reset();
+	background_walk_.clear();
+	changed_cursor_ = 0;
+}
+
 void Sheet::OptionalTableResize(Position pos) {
 	if (static_cast<size_t>(pos.row) >= table_.size()) {
+		table_bytes_ -= table_.capacity() * sizeof(Table::value_type);
 		table_.resize(static_cast<size_t>(pos.row) + 1);
+		table_bytes_ += table_.capacity() * sizeof(Table::value_type);
+	}
+
+	auto& row = table_[pos.row];
+	if (static_cast<size_t>(pos.col) >= row.size()) {
+		table_bytes_ -= row.capacity() * sizeof(Cell*);
+		row.resize(static_cast<size_t>(pos.col) + 1);
+		table_bytes_ += row.capacity() * sizeof(Cell*);
+	}
+}
+
+void Sheet::MarkChanged(Position pos) {
+	changed_.push_back(pos);
+	// keep the list proportional to the number of distinct positions between publications
+	if (changed_.size() >= 2 * changed_unique_count_ + 1024) {
+		DeduplicateChanged();
+	}
+}
+
+void Sheet::DeduplicateChanged() {
+	std::sort(changed_.begin(), changed_.end());
+	changed_.erase(std::unique(changed_.begin(), changed_.end()), changed_.end());
+	changed_unique_count_ = changed_.size();
+}
+
+Cell* Sheet::FindCell(Position pos) const {
+	if (static_cast<size_t>(pos.row) >= table_.size() || static_cast<size_t>(pos.col) >= table_[pos.row].size()) {
+		return nullptr;
+	}
+	return table_[pos.row][pos.col];
+}
+
+void Sheet::RemoveCell(Position pos) {
+	cells_.Destroy(std::exchange(table_[pos.row][pos.col], nullptr));
+}
+
+bool Sheet::RemoveIfUnused(Position pos) {
+	const Cell* cell = FindCell(pos);
+	if (!cell || cell->content_.index() != Cell::EMPTY || cell->IsReferenced() || (base_ && base_->GetCell(pos))) {
+		return false;
+	}
+	RemoveCell(pos);
+	return true;
+}
+
+void Sheet::RecordEdit(Position pos, Cell::Content previous) {
+	LogEdit(pos);
+	journal_.Record(JournalEntry{pos, std::move(previous)}, [this](JournalEntry& entry) {
+		ReleaseJournalEntry(entry);
+	});
+}
+
+void Sheet::ApplyJournalEntry(JournalEntry& entry) {
+	const Position pos = entry.pos;
+	Cell* cell = FindCell(pos);
+	if (!cell) {
+		cell = Materialize(pos);
+	}
+	// cleared and removed since, unless referred to
+	const bool created = !cell;
+	if (created) {
+		OptionalTableResize(pos);
+		cell = cells_.Create(*this, pos);
+		table_[pos.row][pos.col] = cell;
+	}
+	try {
+		cell->Swap(entry.content);
+	}
+	catch (...) {
+		if (created) {
+			RemoveCell(pos);
+		}
+		throw;
+	}
+	LogEdit(pos);
+	RemoveIfUnused(pos);
+}
+
+void Sheet::LogEdit(Position pos) {
+	if (checkpoints_) {
+		checkpoints_->MarkDirty(pos);
+	}
+	if (!edit_log_) {
+		return;
+	}
+	const Cell* cell = FindCell(pos);
+	std::string_view text = cell ? cell->GetTextView() : std::string_view{};
+	if (text.empty()) {
+		edit_log_->AppendClear(pos);
+	} else {
+		edit_log_->AppendSet(pos, text);
+	}
+}
+
+bool Sheet::HasCircularDependency() const {
+	// a cell is marked false while the walk is below it, true once all its precedents are visited
+	std::unordered_map<const Cell*, bool> visited;
+	visited.reserve(cells_.GetSize());
+	// cells with the index of their next precedent to visit
+	std::vector<std::pair<const Cell*, size_t>> path;
+	for (const auto& row : table_) {
+		for (const Cell* root : row) {
+			if (!root || !visited.try_emplace(root, false).second) {
+				continue;
+			}
+			path.emplace_back(root, 0);
+			while (!path.empty()) {
+				auto& [cell, next] = path.back();
+				Span<const Cell*> precedents = cell->GetPrecedents();
+				if (next == precedents.size()) {
+					visited[cell] = true;
+					path.pop_back();
+					continue;
+				}
+				const Cell* precedent = precedents[next++];
+				perf::Add(perf::Counter::GraphNodesVisited);
+				if (auto [it, inserted] = visited.try_emplace(precedent, false); inserted) {
+					path.emplace_back(precedent, 0);
+				} else if (!it->second) {
+					return true;
+				}
+			}
+		}
 	}
+	return false;
+}
+
+void Sheet::ReleaseJournalEntry(JournalEntry& entry) {
+	if (const auto* text = std::get_if<Cell::TextContent>(&entry.content)) {
+		text_pool_.Release(text->id);
+	}
+}
+
+const CellInterface* Sheet::LookupCell(Position pos) const {
+	if (const Cell* cell = FindCell(pos)) {
+		return cell;
+	}
+	return base_ ? base_->GetCell(pos) : nullptr;
+}
+
+Cell* Sheet::Materialize(Position pos) {
+	const SheetSnapshot::CellData* data = base_ ? base_->GetCell(pos) : nullptr;
+	if (!data) {
+		return nullptr;
+	}
+
+	// the content and value stay those of the base, so the cell is not marked as changed
+	OptionalTableResize(pos);
+	Cell* cell = cells_.Create(*this, pos);
+	table_[pos.row][pos.col] = cell;
+	cell->Restore(*data);
+	return cell;
+}
 
-	if (static_cast<size_t>(pos.col) >= table_.at(pos.row).size()) {
-		table_[pos.row].resize(static_cast<size_t>(pos.col) + 1);
+Cell* Sheet::MaterializeDependent(Position pos) {
+	Cell* cell = FindCell(pos);
+	if (!cell) {
+		cell = Materialize(pos);
+	}
+	// the value is about to be invalidated, and recomputing it needs the precedents linked
+	if (cell) {
+		cell->CompleteLinks();
 	}
+	return cell;
+}
+
+const std::vector<Position>& Sheet::GetBaseDependents(Position pos) const {
+	static const std::vector<Position> none;
+	const SheetSnapshot::CellData* data = base_ ? base_->GetCell(pos) : nullptr;
+	return data ? data->dependents : none;
 }
 
 void Sheet::PrintTable(std::ostream& output, const PrintFunction& print_function) const {
@@ -99,8 +1006,8 @@ void Sheet::PrintTable(std::ostream& output, const PrintFunction& print_function
 			if (col != 0) {
 				output << '\t';
 			}
-			if (static_cast<size_t>(col) < table_[row].size() && table_[row][col]) {
-				print_function(table_[row][col]);
+			if (const CellInterface* cell = LookupCell({row, col})) {
+				print_function(*cell);
 			}
 		}
 		output << '\n';
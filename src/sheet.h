@@ -2,14 +2,64 @@
 
 #include "cell.h"
 #include "common.h"
+#include "epoch.h"
+#include "journal.h"
+#include "recalculation.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "statistics.h"
+#include "string_pool.h"
+#include "thread_pool.h"
+#include "value_store.h"
+#include <atomic>
+#include <chrono>
 #include <ostream>
 #include <functional>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 
+class CheckpointStore;
+class EditLog;
+class Workbook;
+
+// The numbers of a rectangle of cells, see Sheet::Summarize.
+struct NumericSummary {
+    size_t count = 0;
+    double sum = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    // formulas evaluating to an error
+    size_t errors = 0;
+};
+
+// The outcome of one Sheet::Compact call.
+struct CompactionSlice {
+    // the decrease of the sheet's MemoryUsage during the call
+    size_t released_bytes = 0;
+    // true if compaction went through the whole sheet; the next call starts over
+    bool complete = false;
+};
+
+// Modifications must come from one thread at a time. Reading methods (GetCell, GetPrintableSize,
+// Print*, and GetValue/GetText/GetReferencedCells of the cells) may be called from several threads
+// at once as long as no modification runs concurrently; formula values are then computed once
+// and shared. Snapshots (ReadSnapshot) can be read even while the writer is editing.
+// A background recalculation (RecalculateAsync) counts as a reader; modifications made by the writer
+// cancel it and wait for it to stop first. The sheets of a Workbook share one writer.
 class Sheet : public SheetInterface {
 public:
-    using Table = std::vector<std::vector<std::unique_ptr<CellInterface>>>;
+    // the cells live in the slabs of the sheet
+    using Table = std::vector<std::vector<Cell*>>;
+    Sheet();
     ~Sheet();
 
+    // Empty unless the sheet belongs to a workbook.
+    const std::string& GetName() const {
+        return name_;
+    }
+
     void SetCell(Position pos, std::string text) override;
 
     const CellInterface* GetCell(Position pos) const override;
@@ -17,16 +67,241 @@ public:
 
     void ClearCell(Position pos) override;
 
+    // Sets many cells of a sheet without content at once; cells left empty by other sheets' references
+    // may exist. Ends as SetCell for each text in order would, the last text of a position winning, but
+    // the formulas are linked without walking the graph for each: the sheet is checked for a cycle once,
+    // and no dependents are invalidated, as every formula is stale anyway. Throws like SetCell,
+    // InvalidPositionException before anything is set and the other exceptions with the sheet left
+    // without content again; std::logic_error for a fork or a sheet with content. Not journaled.
+    void Load(std::vector<std::pair<Position, std::string>> cells);
+
+    // Calls visitor for every cell with a non-empty text, row by row; only for those in area if given,
+    // visiting no more positions than it holds.
+    void ForEachText(const std::function<void(Position, std::string_view)>& visitor,
+        std::optional<Viewport> area = std::nullopt) const;
+
+    // Appends every change of a cell's text to log from now on, the edits undone and redone and the
+    // cells loaded included; nullptr stops it. The records are buffered by the log until committed.
+    void SetEditLog(EditLog* log) {
+        edit_log_ = log;
+    }
+
+    // Marks the tile of every cell whose text changes dirty in checkpoints from now on, like
+    // SetEditLog; nullptr stops it. Set it after restoring the sheet from them, so that the cells
+    // loaded are not written again.
+    void SetCheckpoints(CheckpointStore* checkpoints) {
+        checkpoints_ = checkpoints;
+    }
+
     Size GetPrintableSize() const override;
 
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
 
+    // Returns a logically independent copy of the sheet. The fork shares the compiled formulas,
+    // the dependency structure and the values of the current state with its parent; it copies
+    // only the cells it edits and those it has to recompute downstream of them. Unchanged cells are
+    // read from the shared base, but the non-const GetCell copies the cell, as the caller may modify it.
+    // Publishes a snapshot of the parent first; forks can be forked again. Throws std::logic_error
+    // for a sheet whose formulas refer to other sheets.
+    std::unique_ptr<Sheet> Fork();
+
+    // Sheets of the same workbook by name; a standalone sheet finds nothing.
+    const Sheet* FindSheet(std::string_view name) const override;
+    Sheet* FindSheet(std::string_view name);
+
+    // Calls and allocations per public API since creation or the last reset.
+    SheetStatistics GetStatistics() const;
+    void ResetStatistics();
+
+    // Makes the current state visible to snapshot readers as a new immutable version and
+    // returns its number. Only the tiles holding cells changed since the previous version are copied;
+    // the values of those cells are computed here. Must be called by the writer thread.
+    std::uint64_t PublishSnapshot();
+
+    // Pins the latest published version. Unlike the rest of the interface it may be called
+    // from any thread while the writer keeps editing; the version stays valid until the reader is destroyed.
+    SnapshotReader ReadSnapshot() const;
+
+    // Computes the values of the cells changed since the last published version on executor,
+    // dependencies first, and publishes them as a new version when done. Meanwhile readers see
+    // the last published version through ReadSnapshot, or block in GetValue of a particular cell
+    // until it is computed. A newer edit, publication or recalculation supersedes this one.
+    RecalculationHandle RecalculateAsync(ThreadPool& executor = ThreadPool::Shared());
+
+    // Computes stale formula values on the calling thread until budget runs out: the cells of
+    // viewport and their precedents first, then the rest. The next call resumes where this one
+    // stopped, and any modification starts over. Each call takes at least one step, and a step never
+    // evaluates more than one formula, so the budget is exceeded by at most one evaluation.
+    RecalculationSlice RecalculateFor(std::chrono::nanoseconds budget, std::optional<Viewport> viewport = std::nullopt);
+
+    // Formula cells whose values have to be computed again, in row-major order. Must be called by
+    // the writer: it stops a background recalculation first, as that works on the same list.
+    std::vector<Position> GetStaleCells();
+
+    // Calls visitor for every cell of the rectangle holding a number, column by column: the values of
+    // formulas and the texts formulas read as numbers. Stale formulas are computed on the way.
+    // Reads the sheet's columnar value store rather than the cells, and may be called by several readers at once.
+    void ForEachNumber(Position top_left, Size size, const std::function<void(Position, double)>& visitor) const;
+
+    // The count, sum, minimum and maximum of the numbers of a rectangle, as visited by ForEachNumber.
+    NumericSummary Summarize(Position top_left, Size size) const;
+
+    // The distinct texts of the sheet's text cells; a fork keeps its own pool for the cells it copies.
+    const StringPool& GetTextPool() const {
+        return text_pool_;
+    }
+
+    // Bytes held by the sheet, by component. The counts are kept up to date by the modifications,
+    // so this takes constant time; it is a reading method. A fork counts what it copied or created,
+    // not its base, and formulas count towards the sheet that parsed them.
+    SheetMemoryUsage MemoryUsage() const;
+
+    // Keeps the value store (the Values component of MemoryUsage) within budget bytes, if possible,
+    // by evicting chunks of cached formula values; nullopt, the default, keeps every value. Cold chunks
+    // go first, and chunks whose values took many evaluations to compute are kept longer. The first
+    // read of an evicted value brings its chunk back, so values read again are cached again, and the
+    // store may exceed the budget until it is enforced again: here and after each SetCell.
+    void SetValueBudget(std::optional<size_t> bytes);
+    ValueCacheStatistics GetValueCacheStatistics() const;
+
+    // Releases memory that edits left unused: empty places at the ends of rows and empty rows at the end
+    // of the table, empty cells no formula refers to any more (as ClearCell would), unused capacity of
+    // the links of cells, chunks of the value store without values, oversized hash tables, the bytes of
+    // texts no cell holds any more (see StringPool::Shrink), and slabs whose cells fit into the free
+    // places of the other slabs, where they are moved. Works in steps until budget runs out, or to the
+    // end without a budget; a step handles one row, one column of the value store or one slab, so the
+    // writer is never stalled for long. The next call resumes where this one stopped. Must be called
+    // by the writer; cells obtained by GetCell before may have moved, and text views taken before
+    // (GetTextView, and GetValueView of text cells) may have been invalidated.
+    CompactionSlice Compact(std::optional<std::chrono::nanoseconds> budget = std::nullopt);
+
+    // Undoes the newest edit not undone yet, made by SetCell, ClearCell or Set of a cell, and returns
+    // false if there is none. The journal keeps the previous content of the edited cell, sharing its
+    // compiled formula, so undoing an edit is as cheap as an edit that needs no parsing. Throws
+    // CircularDependencyException, leaving the sheet and the journal as they were, if the content to put
+    // back refers to cells that refer to the edited one by now, as edits of other sheets may cause.
+    bool Undo();
+    // Redoes the newest edit undone, the same way; a new edit drops the undone ones.
+    bool Redo();
+
+    // Edits to undo and undone edits to redo are kept up to depth together, the oldest are dropped
+    // beyond. The journal is off, with a depth of 0, until a depth is set, as it keeps the previous
+    // texts and formulas of the cells alive.
+    void SetJournalDepth(size_t depth);
+    size_t GetJournalDepth() const {
+        return journal_.GetDepth();
+    }
+
 private:
-    using PrintFunction = std::function<void(const std::unique_ptr<CellInterface>&)>;
+    friend class Cell;
+    friend class Workbook;
+
+    Sheet(Workbook& workbook, std::string name);
+
+    using PrintFunction = std::function<void(const CellInterface&)>;
+    // receives cells in the NUMBER, VALUE and FORMULA_ERROR states only
+    using ValueVisitor = std::function<void(Position, ValueStore::State, double)>;
+    // declared before the cells, which clear their slots and release their texts when destroyed
+    StringPool text_pool_;
+    ValueStore values_;
+    Slab<Cell> cells_;
     Table table_;
+    // the capacities of table_ and of the links of the cells, in bytes
+    size_t table_bytes_ = 0;
+    size_t link_bytes_ = 0;
+    std::optional<size_t> value_budget_;
+    ValueCacheStatistics value_cache_statistics_;
+    // counted by readers
+    mutable std::atomic<std::uint64_t> uncached_evaluations_{0};
+    mutable std::atomic<std::uint64_t> readmitted_chunks_{0};
+    // the parent's version a fork started from; the cells not in table_ are read from it
+    std::shared_ptr<const SheetSnapshot> base_;
+    Workbook* workbook_ = nullptr;
+    std::string name_;
+    // sheets this sheet's formulas refer to, with the number of such links
+    std::unordered_map<const Sheet*, size_t> precedent_sheets_;
+    mutable StatisticsTracker statistics_;
+    // compiled formulas shared by the cells of filled-down rows and columns
+    FormulaTemplates formula_templates_;
+
+    // the other content of an edited cell: the previous one for an edit to undo, the next one for an
+    // edit to redo; a text keeps its reference to the pool
+    struct JournalEntry {
+        Position pos;
+        Cell::Content content;
+    };
+    EditJournal<JournalEntry> journal_{0};
+    EditLog* edit_log_ = nullptr;
+    CheckpointStore* checkpoints_ = nullptr;
+
+    // positions whose text or value changed since the last published version (with duplicates)
+    std::vector<Position> changed_;
+    size_t changed_unique_count_ = 0;
+    std::shared_ptr<const SheetSnapshot> current_snapshot_;
+    std::atomic<const SheetSnapshot*> published_snapshot_;
+    mutable EpochManager epochs_;
+    RecalculationHandle recalculation_;
+
+    // Resumable post-order walks of RecalculateFor; a cell marked true has had its precedents pushed.
+    // The viewport walk goes first and restarts when the viewport changes.
+    using WalkStack = std::vector<std::pair<const Cell*, bool>>;
+    WalkStack viewport_walk_;
+    std::optional<Viewport> walked_viewport_;
+    WalkStack background_walk_;
+    // how far the background walk has looked through changed_
+    size_t changed_cursor_ = 0;
+
+    // where Compact resumes: the rows of the table one by one, then the table itself and the
+    // hash tables, the columns of the value store one by one, then the slabs
+    enum class CompactionPhase { ROWS, VALUES, SLABS };
+    CompactionPhase compaction_phase_ = CompactionPhase::ROWS;
+    size_t compaction_cursor_ = 0;
 
     /* Auxiliary functions */
 	void OptionalTableResize(Position pos);
+	// The slot of the cell at pos in values_; creating an evicted chunk again activates its other cells.
+	ValueStore::Slot GetValueSlot(Position pos);
+	// The slot of a formula cell whose chunk has been evicted, created again by a reader so that
+	// its value and those of its neighbours are cached again; no slot if that fails.
+	ValueStore::Slot ReadmitValueSlot(Position pos);
+	void EnforceValueBudget();
+	void MarkChanged(Position pos);
+	void DeduplicateChanged();
+	Cell* FindCell(Position pos) const;
+	// Destroys the cell of the position and leaves its place in the table empty.
+	void RemoveCell(Position pos);
+	// Removes the cell of the position if it is empty, no formula refers to it and it does not hide
+	// a cell of the base; returns true if it did.
+	bool RemoveIfUnused(Position pos);
+	// Takes over the previous content of a cell just edited, and logs the edit.
+	void RecordEdit(Position pos, Cell::Content previous);
+	// Appends the text of the cell of the position to the edit log and marks its tile dirty in
+	// the checkpoints, if any.
+	void LogEdit(Position pos);
+	// True if some cell of the sheet refers to itself, through other sheets' cells as well.
+	bool HasCircularDependency() const;
+	// Swaps the content of the entry with that of its cell.
+	void ApplyJournalEntry(JournalEntry& entry);
+	void ReleaseJournalEntry(JournalEntry& entry);
+	const CellInterface* LookupCell(Position pos) const;
+	Cell* Materialize(Position pos);
+	Cell* MaterializeDependent(Position pos);
+	const std::vector<Position>& GetBaseDependents(Position pos) const;
+	std::uint64_t Publish();
+	RecalculationStatus Recalculate(RecalculationHandle::State& state);
+	void ComputeRun(const Cell& first) const;
+	void StopRecalculation();
+	void StopOwnRecalculation();
+	void AddSheetLink(const Sheet& precedent);
+	void RemoveSheetLink(const Sheet& precedent);
+	bool RecalculationStep(size_t& computed);
+	void ResetIncrementalRecalculation();
+	// Returns false, and starts over next time, once there is nothing left to compact.
+	bool CompactionStep();
+	void CompactRow(int row);
+	void CompactTable();
     void PrintTable(std::ostream& output, const PrintFunction& print_function) const;
+	void ScanValues(Position top_left, Size size, const ValueVisitor& visitor) const;
+	void VisitCellValue(Position pos, const ValueVisitor& visitor) const;
 };
\ No newline at end of file
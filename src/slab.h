@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Storage for objects of one type in slabs of SLAB_SIZE places, so that creating one is not a heap
+// allocation of its own and objects created one after another are close in memory.
+// Objects never move unless the owner frees slabs with ReleaseSparsest; the places of destroyed
+// ones are reused first. The owner has to destroy every object before the slab goes away.
+// Not thread-safe.
+template <typename T, size_t SLAB_SIZE = 256>
+class Slab {
+public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    template <typename... Args>
+    T* Create(Args&&... args) {
+        if (!free_) {
+            AddSlab();
+        }
+        Place* place = free_;
+        free_ = place->next;
+        T* object;
+        try {
+            object = new (place->bytes) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            place->next = free_;
+            free_ = place;
+            throw;
+        }
+        ++size_;
+        return object;
+    }
+
+    // The object must have been created by this slab.
+    void Destroy(T* object) {
+        object->~T();
+        Place* place = reinterpret_cast<Place*>(object);
+        place->next = free_;
+        free_ = place;
+        --size_;
+    }
+
+    // Live objects.
+    size_t GetSize() const {
+        return size_;
+    }
+
+    // Bytes taken by the slabs, free places included.
+    size_t GetCapacityBytes() const {
+        return slabs_.size() * SLAB_SIZE * sizeof(Place);
+    }
+
+    // Frees the slab with the fewest objects if they fit into the free places of the other slabs,
+    // that is if a slab's worth of places is free, and returns true. Its objects are move-constructed
+    // there; relocate(from, to) is called for each before the object moved from is destroyed, so that
+    // the owner can redirect its pointers. T has to be nothrow move constructible.
+    // Takes time proportional to the free places and SLAB_SIZE.
+    template <typename Relocate>
+    bool ReleaseSparsest(Relocate relocate);
+
+private:
+    // a free place links to the next one
+    union Place {
+        Place* next;
+        alignas(T) std::byte bytes[sizeof(T)];
+    };
+
+    void AddSlab() {
+        // not value-initialized: the places are written when used
+        slabs_.emplace_back(new Place[SLAB_SIZE]);
+        Place* places = slabs_.back().get();
+        for (size_t i = SLAB_SIZE; i > 0; --i) {
+            places[i - 1].next = free_;
+            free_ = &places[i - 1];
+        }
+    }
+
+    std::vector<std::unique_ptr<Place[]>> slabs_;
+    Place* free_ = nullptr;
+    size_t size_ = 0;
+};
+
+template <typename T, size_t SLAB_SIZE>
+template <typename Relocate>
+bool Slab<T, SLAB_SIZE>::ReleaseSparsest(Relocate relocate) {
+    static_assert(std::is_nothrow_move_constructible_v<T>);
+    if (slabs_.size() * SLAB_SIZE - size_ < SLAB_SIZE) {
+        return false;
+    }
+
+    // the slabs by address, to find the slab of a free place
+    std::vector<std::pair<const Place*, size_t>> starts;
+    starts.reserve(slabs_.size());
+    for (size_t i = 0; i < slabs_.size(); ++i) {
+        starts.emplace_back(slabs_[i].get(), i);
+    }
+    std::sort(starts.begin(), starts.end(), [](const auto& lhs, const auto& rhs) {
+        return std::less<const Place*>{}(lhs.first, rhs.first);
+    });
+    auto slab_of = [&starts](const Place* place) {
+        auto it = std::upper_bound(starts.begin(), starts.end(), place, [](const Place* place, const auto& start) {
+            return std::less<const Place*>{}(place, start.first);
+        });
+        return std::prev(it)->second;
+    };
+    std::vector<size_t> free_places(slabs_.size());
+    for (const Place* place = free_; place; place = place->next) {
+        ++free_places[slab_of(place)];
+    }
+    const size_t sparsest = std::max_element(free_places.begin(), free_places.end()) - free_places.begin();
+
+    // the free list loses the places of the sparsest slab, keeping its order otherwise
+    Place* places = slabs_[sparsest].get();
+    std::vector<bool> is_free(SLAB_SIZE);
+    Place* kept = nullptr;
+    Place** tail = &kept;
+    for (Place* place = free_; place;) {
+        Place* next = place->next;
+        if (slab_of(place) == sparsest) {
+            is_free[place - places] = true;
+        } else {
+            *tail = place;
+            tail = &place->next;
+        }
+        place = next;
+    }
+    *tail = nullptr;
+    free_ = kept;
+
+    for (size_t i = 0; i < SLAB_SIZE; ++i) {
+        if (is_free[i]) {
+            continue;
+        }
+        T* from = std::launder(reinterpret_cast<T*>(places[i].bytes));
+        Place* place = free_;
+        free_ = place->next;
+        T* to = new (place->bytes) T(std::move(*from));
+        relocate(from, to);
+        from->~T();
+    }
+    slabs_.erase(slabs_.begin() + sparsest);
+    return true;
+}
@@ -0,0 +1,89 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <ostream>
+
+const SheetSnapshot::CellData* SheetSnapshot::GetCell(Position pos) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("Invalid position");
+    }
+
+    size_t tile_row = pos.row / TILE_ROWS;
+    size_t tile_col = pos.col / TILE_COLS;
+    if (tile_row >= tile_rows_.size() || !tile_rows_[tile_row]) {
+        return nullptr;
+    }
+
+    const TileRow& row = *tile_rows_[tile_row];
+    if (tile_col >= row.tiles.size() || !row.tiles[tile_col]) {
+        return nullptr;
+    }
+
+    return row.tiles[tile_col]->cells[(pos.row % TILE_ROWS) * TILE_COLS + pos.col % TILE_COLS].get();
+}
+
+void SheetSnapshot::PrintValues(std::ostream& output) const {
+    PrintTable(output, [&output](const CellData& cell) {
+        std::visit([&output](const auto& value) {
+            output << value;
+        }, cell.value);
+    });
+}
+
+void SheetSnapshot::PrintTexts(std::ostream& output) const {
+    PrintTable(output, [&output](const CellData& cell) {
+        output << cell.text;
+    });
+}
+
+template <typename PrintFunction>
+void SheetSnapshot::PrintTable(std::ostream& output, const PrintFunction& print_function) const {
+    for (int row = 0; row < printable_size_.rows; ++row) {
+        for (int col = 0; col < printable_size_.cols; ++col) {
+            if (col != 0) {
+                output << '\t';
+            }
+            if (const CellData* cell = GetCell({row, col})) {
+                print_function(*cell);
+            }
+        }
+        output << '\n';
+    }
+}
+
+void SheetSnapshot::Tile::UpdatePrintableSize() {
+    printable_size = {0, 0};
+    for (int row = 0; row < TILE_ROWS; ++row) {
+        for (int col = 0; col < TILE_COLS; ++col) {
+            const auto& cell = cells[row * TILE_COLS + col];
+            if (cell && !cell->text.empty()) {
+                printable_size.rows = std::max(printable_size.rows, row + 1);
+                printable_size.cols = std::max(printable_size.cols, col + 1);
+            }
+        }
+    }
+}
+
+void SheetSnapshot::TileRow::UpdatePrintableSize() {
+    printable_size = {0, 0};
+    for (size_t tile_col = 0; tile_col < tiles.size(); ++tile_col) {
+        if (!tiles[tile_col] || tiles[tile_col]->printable_size.rows == 0) {
+            continue;
+        }
+        const Size& tile_size = tiles[tile_col]->printable_size;
+        printable_size.rows = std::max(printable_size.rows, tile_size.rows);
+        printable_size.cols = std::max(printable_size.cols, static_cast<int>(tile_col) * TILE_COLS + tile_size.cols);
+    }
+}
+
+void SheetSnapshot::UpdatePrintableSize() {
+    printable_size_ = {0, 0};
+    for (size_t tile_row = 0; tile_row < tile_rows_.size(); ++tile_row) {
+        if (!tile_rows_[tile_row]) {
+            continue;
+        }
+        const Size extent = GetRowExtent(tile_row, tile_rows_[tile_row]->printable_size);
+        printable_size_.rows = std::max(printable_size_.rows, extent.rows);
+        printable_size_.cols = std::max(printable_size_.cols, extent.cols);
+    }
+}
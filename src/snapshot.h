@@ -0,0 +1,206 @@
+#pragma once
+
+#include "common.h"
+#include "epoch.h"
+#include "formula.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+// An immutable, consistent version of a sheet: the text and the computed value of every cell.
+// Cells are grouped into fixed-size tiles which are shared between versions,
+// so publishing a new version copies only the tiles that contain changed cells.
+// The compiled formulas and the dependents of the cells are kept as well, so that forks
+// of the sheet can use a version as their base.
+class SheetSnapshot {
+public:
+    // A read-only cell; Set throws std::logic_error.
+    struct CellData final : CellInterface {
+        CellData(std::string text, Value value, std::shared_ptr<const FormulaInterface> formula = nullptr,
+                 std::vector<Position> dependents = {})
+            : text(std::move(text))
+            , value(std::move(value))
+            , formula(std::move(formula))
+            , dependents(std::move(dependents)) {
+        }
+
+        void Set(std::string) override {
+            throw std::logic_error("Snapshot cells are read-only");
+        }
+        ValueView GetValueView() const override {
+            return View(value);
+        }
+        std::string_view GetTextView() const override {
+            return text;
+        }
+        Span<Position> GetReferencedCellsView() const override {
+            return formula ? formula->GetReferencedCellsView() : Span<Position>{};
+        }
+
+        std::string text;
+        Value value;
+        // null unless the cell holds a formula
+        std::shared_ptr<const FormulaInterface> formula;
+        // cells of the same sheet whose formulas refer to this one; may contain a few that no longer do
+        std::vector<Position> dependents;
+    };
+
+    static constexpr int TILE_ROWS = 16;
+    static constexpr int TILE_COLS = 16;
+
+    SheetSnapshot() = default;
+
+    std::uint64_t GetVersion() const {
+        return version_;
+    }
+
+    // Returns nullptr if there was no cell at the position.
+    const CellData* GetCell(Position pos) const;
+
+    Size GetPrintableSize() const {
+        return printable_size_;
+    }
+
+    // Same output format as SheetInterface::PrintValues/PrintTexts.
+    void PrintValues(std::ostream& output) const;
+    void PrintTexts(std::ostream& output) const;
+
+    // Builds the next version from this one.
+    // Every listed position gets the data from cell_data (nullptr removes the cell).
+    template <typename CellDataGetter>
+    std::unique_ptr<SheetSnapshot> Update(const std::vector<Position>& changed_positions,
+                                          const CellDataGetter& cell_data) const;
+
+private:
+    struct Tile {
+        std::array<std::shared_ptr<const CellData>, TILE_ROWS * TILE_COLS> cells;
+        // bounding box of the cells with non-empty text, relative to the tile
+        Size printable_size;
+
+        void UpdatePrintableSize();
+    };
+    struct TileRow {
+        std::vector<std::shared_ptr<const Tile>> tiles;
+        // bounding box of the cells with non-empty text, relative to the first row of the tile row
+        // and to the first column of the sheet
+        Size printable_size;
+
+        void UpdatePrintableSize();
+    };
+
+    std::uint64_t version_ = 0;
+    Size printable_size_;
+    std::vector<std::shared_ptr<const TileRow>> tile_rows_;
+
+    template <typename PrintFunction>
+    void PrintTable(std::ostream& output, const PrintFunction& print_function) const;
+    // Takes the sheet-wide size from the tile rows, after one whose bounding box reached the edge
+    // of the sheet has shrunk.
+    void UpdatePrintableSize();
+
+    // The bounding box of a tile row within the sheet.
+    static Size GetRowExtent(size_t tile_row, const Size& row_size) {
+        return row_size.rows == 0 ? Size{0, 0} : Size{static_cast<int>(tile_row) * TILE_ROWS + row_size.rows, row_size.cols};
+    }
+};
+
+// Keeps a published version alive while it is being read.
+class SnapshotReader {
+public:
+    SnapshotReader(EpochManager::Guard guard, const SheetSnapshot* snapshot)
+        : guard_(std::move(guard))
+        , snapshot_(snapshot) {
+    }
+
+    const SheetSnapshot& operator*() const {
+        return *snapshot_;
+    }
+
+    const SheetSnapshot* operator->() const {
+        return snapshot_;
+    }
+
+private:
+    EpochManager::Guard guard_;
+    const SheetSnapshot* snapshot_;
+};
+
+template <typename CellDataGetter>
+std::unique_ptr<SheetSnapshot> SheetSnapshot::Update(const std::vector<Position>& changed_positions,
+                                                     const CellDataGetter& cell_data) const {
+    auto result = std::make_unique<SheetSnapshot>(*this);
+    ++result->version_;
+
+    // grouped by tile, so that each tile row and each tile is copied once
+    std::vector<Position> positions = changed_positions;
+    std::sort(positions.begin(), positions.end(), [](Position lhs, Position rhs) {
+        return std::make_tuple(lhs.row / TILE_ROWS, lhs.col / TILE_COLS, lhs.row, lhs.col)
+            < std::make_tuple(rhs.row / TILE_ROWS, rhs.col / TILE_COLS, rhs.row, rhs.col);
+    });
+
+    std::shared_ptr<TileRow> tile_row;
+    std::shared_ptr<Tile> tile;
+    Position tile_pos = Position::NONE;
+    // the size only grows unless a changed row reaching the edge of the sheet shrinks
+    Size size = printable_size_;
+    bool shrunk = false;
+    auto flush_tile = [&] {
+        if (tile) {
+            tile->UpdatePrintableSize();
+            tile_row->tiles[tile_pos.col] = std::move(tile);
+        }
+    };
+    auto flush_row = [&] {
+        flush_tile();
+        if (!tile_row) {
+            return;
+        }
+        const Size before = GetRowExtent(tile_pos.row, tile_row->printable_size);
+        tile_row->UpdatePrintableSize();
+        const Size after = GetRowExtent(tile_pos.row, tile_row->printable_size);
+        if ((after.rows < before.rows && before.rows == printable_size_.rows)
+            || (after.cols < before.cols && before.cols == printable_size_.cols)) {
+            shrunk = true;
+        }
+        size.rows = std::max(size.rows, after.rows);
+        size.cols = std::max(size.cols, after.cols);
+    };
+
+    for (Position pos : positions) {
+        Position current{pos.row / TILE_ROWS, pos.col / TILE_COLS};
+        if (current.row != tile_pos.row) {
+            flush_row();
+            if (static_cast<size_t>(current.row) >= result->tile_rows_.size()) {
+                result->tile_rows_.resize(current.row + 1);
+            }
+            auto& shared_row = result->tile_rows_[current.row];
+            tile_row = shared_row ? std::make_shared<TileRow>(*shared_row) : std::make_shared<TileRow>();
+            shared_row = tile_row;
+            tile_pos = {current.row, Position::NONE.col};
+        }
+        if (!(current == tile_pos)) {
+            flush_tile();
+            if (static_cast<size_t>(current.col) >= tile_row->tiles.size()) {
+                tile_row->tiles.resize(current.col + 1);
+            }
+            const auto& shared_tile = tile_row->tiles[current.col];
+            tile = shared_tile ? std::make_shared<Tile>(*shared_tile) : std::make_shared<Tile>();
+            tile_pos = current;
+        }
+        tile->cells[(pos.row % TILE_ROWS) * TILE_COLS + pos.col % TILE_COLS] = cell_data(pos);
+    }
+    flush_row();
+
+    if (shrunk) {
+        result->UpdatePrintableSize();
+    } else {
+        result->printable_size_ = size;
+    }
+    return result;
+}
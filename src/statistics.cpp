@@ -0,0 +1,100 @@
+#include "statistics.h"
+
+#include <functional>
+#include <thread>
+
+using namespace std::literals;
+
+std::string_view SheetStatistics::ApiName(Api api) {
+    switch (api) {
+    case Api::SetCell:
+        return "SetCell"sv;
+    case Api::GetCell:
+        return "GetCell"sv;
+    case Api::ClearCell:
+        return "ClearCell"sv;
+    case Api::GetPrintableSize:
+        return "GetPrintableSize"sv;
+    case Api::PrintValues:
+        return "PrintValues"sv;
+    case Api::PrintTexts:
+        return "PrintTexts"sv;
+    case Api::GetValue:
+        return "GetValue"sv;
+    case Api::GetText:
+        return "GetText"sv;
+    case Api::GetReferencedCells:
+        return "GetReferencedCells"sv;
+    case Api::GetValueView:
+        return "GetValueView"sv;
+    case Api::GetTextView:
+        return "GetTextView"sv;
+    case Api::GetReferencedCellsView:
+        return "GetReferencedCellsView"sv;
+    case Api::PublishSnapshot:
+        return "PublishSnapshot"sv;
+    case Api::Recalculate:
+        return "Recalculate"sv;
+    case Api::Compact:
+        return "Compact"sv;
+    case Api::Undo:
+        return "Undo"sv;
+    case Api::Redo:
+        return "Redo"sv;
+    case Api::Load:
+        return "Load"sv;
+    case Api::COUNT:
+        break;
+    }
+    return ""sv;
+}
+
+std::string_view SheetMemoryUsage::ComponentName(Component component) {
+    switch (component) {
+    case Component::Table:
+        return "table_bytes"sv;
+    case Component::Cells:
+        return "cell_bytes"sv;
+    case Component::Formulas:
+        return "formula_bytes"sv;
+    case Component::Links:
+        return "link_bytes"sv;
+    case Component::Values:
+        return "value_bytes"sv;
+    case Component::Texts:
+        return "text_bytes"sv;
+    case Component::COUNT:
+        break;
+    }
+    return ""sv;
+}
+
+void StatisticsTracker::Add(SheetStatistics::Api api, alloc::Usage usage) {
+    thread_local size_t shard = std::hash<std::thread::id>{}(std::this_thread::get_id()) % SHARDS;
+    Entry& entry = shards_[shard].entries[static_cast<size_t>(api)];
+    entry.calls.fetch_add(1, std::memory_order_relaxed);
+    entry.allocations.fetch_add(usage.allocations, std::memory_order_relaxed);
+    entry.allocated_bytes.fetch_add(usage.bytes, std::memory_order_relaxed);
+}
+
+SheetStatistics StatisticsTracker::Get() const {
+    SheetStatistics result;
+    for (const Shard& shard : shards_) {
+        for (size_t i = 0; i < shard.entries.size(); ++i) {
+            result.entries[i].calls += shard.entries[i].calls.load(std::memory_order_relaxed);
+            result.entries[i].allocations += shard.entries[i].allocations.load(std::memory_order_relaxed);
+            result.entries[i].allocated_bytes += shard.entries[i].allocated_bytes.load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+void StatisticsTracker::Reset() {
+    for (Shard& shard : shards_) {
+        for (Entry& entry : shard.entries) {
+            entry.calls.store(0, std::memory_order_relaxed);
+            entry.allocations.store(0, std::memory_order_relaxed);
+            entry.allocated_bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+}
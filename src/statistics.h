@@ -0,0 +1,168 @@
+#pragma once
+
+#include "alloc_tracker.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// Per-sheet usage statistics of the public API.
+// Allocations are attributed to the outermost API call of a thread, so the internal
+// SetCell calls made while creating referenced cells count towards the outer SetCell.
+// Without SPREADSHEET_ALLOC_TRACKING nothing is recorded.
+struct SheetStatistics {
+    enum class Api {
+        SetCell,
+        GetCell,
+        ClearCell,
+        GetPrintableSize,
+        PrintValues,
+        PrintTexts,
+        GetValue,
+        GetText,
+        GetReferencedCells,
+        GetValueView,
+        GetTextView,
+        GetReferencedCellsView,
+        PublishSnapshot,
+        Recalculate,
+        Compact,
+        Undo,
+        Redo,
+        Load,
+        COUNT,
+    };
+
+    struct Entry {
+        std::uint64_t calls = 0;
+        std::uint64_t allocations = 0;
+        std::uint64_t allocated_bytes = 0;
+    };
+
+    std::array<Entry, static_cast<size_t>(Api::COUNT)> entries;
+
+    const Entry& operator[](Api api) const {
+        return entries[static_cast<size_t>(api)];
+    }
+
+    static std::string_view ApiName(Api api);
+};
+
+// Bytes held by a sheet, by component, as returned by Sheet::MemoryUsage. Every component is kept
+// up to date as the sheet changes, so reading them costs nothing. Hash tables are estimated from
+// their sizes, see EstimateHashTableBytes; memory shared by several sheets is counted by each of them.
+struct SheetMemoryUsage {
+    enum class Component {
+        Table,     // the rows of cell pointers
+        Cells,     // the cell objects, in their slabs
+        Formulas,  // compiled formulas with their AST nodes and the formula objects of the cells
+        Links,     // the links between precedents and dependents
+        Values,    // the columnar store of numbers and cached formula values
+        Texts,     // the interned texts of text cells
+        COUNT,
+    };
+
+    std::array<size_t, static_cast<size_t>(Component::COUNT)> bytes{};
+
+    size_t operator[](Component component) const {
+        return bytes[static_cast<size_t>(component)];
+    }
+
+    size_t GetTotal() const {
+        size_t total = 0;
+        for (size_t component_bytes : bytes) {
+            total += component_bytes;
+        }
+        return total;
+    }
+
+    // A name for metrics exporters, like "table_bytes".
+    static std::string_view ComponentName(Component component);
+};
+
+// What keeping a sheet's value store within its budget did, see Sheet::SetValueBudget.
+struct ValueCacheStatistics {
+    // chunks of the value store dropped, and the computed formula values they held
+    std::uint64_t evicted_chunks = 0;
+    std::uint64_t evicted_values = 0;
+    // evicted chunks created again by edits of their cells
+    std::uint64_t restored_chunks = 0;
+    // evicted chunks created again by reads of their values
+    std::uint64_t readmitted_chunks = 0;
+    // reads of formulas that had to be computed as their values were evicted and could not be
+    // brought back
+    std::uint64_t uncached_evaluations = 0;
+};
+
+// The bytes of an unordered map or set: a pointer per bucket and a node per element,
+// which holds the element, a link to the next node and its hash. A single bucket is
+// usually stored in the table itself.
+template <typename HashTable>
+size_t EstimateHashTableBytes(const HashTable& table) {
+    return (table.bucket_count() > 1 ? table.bucket_count() * sizeof(void*) : 0)
+        + table.size() * (sizeof(typename HashTable::value_type) + sizeof(void*) + sizeof(size_t));
+}
+
+// Frees the buckets of an unordered map or set if there are more than twice as many as its elements need.
+template <typename HashTable>
+void ShrinkHashTable(HashTable& table) {
+    if (table.bucket_count() > 1 && table.bucket_count() > 2 * table.size() / table.max_load_factor()) {
+        table.rehash(0);
+    }
+}
+
+// Counters are sharded by thread so that concurrent readers do not contend on one cache line.
+class StatisticsTracker {
+public:
+    void Add(SheetStatistics::Api api, alloc::Usage usage);
+    SheetStatistics Get() const;
+    void Reset();
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Entry {
+        std::atomic<std::uint64_t> calls{0};
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> allocated_bytes{0};
+    };
+
+    struct alignas(64) Shard {
+        std::array<Entry, static_cast<size_t>(SheetStatistics::Api::COUNT)> entries;
+    };
+
+    std::array<Shard, SHARDS> shards_;
+};
+
+// Records one call of an API together with the allocations made until the end of the scope.
+class ApiScope {
+public:
+    ApiScope(StatisticsTracker& tracker, SheetStatistics::Api api) {
+        if constexpr (alloc::ENABLED) {
+            if (depth_++ == 0) {
+                tracker_ = &tracker;
+                api_ = api;
+                start_ = alloc::ThreadUsage();
+            }
+        }
+    }
+
+    ApiScope(const ApiScope&) = delete;
+    ApiScope& operator=(const ApiScope&) = delete;
+
+    ~ApiScope() {
+        if constexpr (alloc::ENABLED) {
+            if (--depth_ == 0) {
+                tracker_->Add(api_, alloc::ThreadUsage() - start_);
+            }
+        }
+    }
+
+private:
+    static inline thread_local int depth_ = 0;
+
+    StatisticsTracker* tracker_ = nullptr;
+    SheetStatistics::Api api_ = SheetStatistics::Api::COUNT;
+    alloc::Usage start_;
+};
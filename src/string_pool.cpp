@@ -0,0 +1,109 @@
+#include "string_pool.h"
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+StringPool::Id StringPool::Intern(std::string_view text) {
+    if (auto it = ids_.find(text); it != ids_.end()) {
+        ++entries_[it->second].references;
+        return it->second;
+    }
+
+    Id id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    } else {
+        if (entries_.size() > std::numeric_limits<Id>::max()) {
+            throw std::length_error("Too many distinct strings in a pool");
+        }
+        id = static_cast<Id>(entries_.size());
+        entries_.emplace_back();
+    }
+    Entry& entry = entries_[id];
+    entry.text = Store(text);
+    entry.references = 1;
+    live_bytes_ += text.size();
+    ids_.emplace(entry.text, id);
+    return id;
+}
+
+void StringPool::Release(Id id) {
+    Entry& entry = entries_[id];
+    if (--entry.references == 0) {
+        ids_.erase(entry.text);
+        live_bytes_ -= entry.text.size();
+        entry.text = {};
+        free_ids_.push_back(id);
+    }
+}
+
+size_t StringPool::GetMemoryUsage() const {
+    return arena_bytes_ + entries_.capacity() * sizeof(Entry) + free_ids_.capacity() * sizeof(Id)
+        + blocks_.capacity() * sizeof(blocks_[0]) + EstimateHashTableBytes(ids_);
+}
+
+void StringPool::Shrink() {
+    // a single first block has nothing to give back
+    if (arena_bytes_ > FIRST_BLOCK_SIZE && live_bytes_ < arena_bytes_ / 2) {
+        Relocate();
+    }
+    ShrinkHashTable(ids_);
+    if (free_ids_.capacity() > 2 * free_ids_.size()) {
+        free_ids_.shrink_to_fit();
+    }
+}
+
+void StringPool::Relocate() {
+    // the old blocks stay alive until every live string is copied out of them
+    std::vector<std::unique_ptr<char[]>> old_blocks = std::move(blocks_);
+    blocks_.clear();
+    block_size_ = 0;
+    block_end_ = nullptr;
+    block_free_ = 0;
+    arena_bytes_ = 0;
+    // the keys view the old blocks
+    ids_.clear();
+    for (size_t id = 0; id < entries_.size(); ++id) {
+        Entry& entry = entries_[id];
+        if (entry.references > 0) {
+            entry.text = Store(entry.text);
+            ids_.emplace(entry.text, static_cast<Id>(id));
+        }
+    }
+    if (blocks_.capacity() > 2 * blocks_.size()) {
+        blocks_.shrink_to_fit();
+    }
+}
+
+std::string_view StringPool::Store(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    if (text.size() > MAX_BLOCK_SIZE) {
+        blocks_.push_back(std::make_unique<char[]>(text.size()));
+        arena_bytes_ += text.size();
+        std::memcpy(blocks_.back().get(), text.data(), text.size());
+        return {blocks_.back().get(), text.size()};
+    }
+    if (text.size() > block_free_) {
+        // the rest of the previous block is left unused
+        block_size_ = std::clamp(block_size_ * 2, FIRST_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        while (block_size_ < text.size()) {
+            block_size_ *= 2;
+        }
+        blocks_.push_back(std::make_unique<char[]>(block_size_));
+        arena_bytes_ += block_size_;
+        block_end_ = blocks_.back().get();
+        block_free_ = block_size_;
+    }
+    char* data = block_end_;
+    std::memcpy(data, text.data(), text.size());
+    block_end_ += text.size();
+    block_free_ -= text.size();
+    return {data, text.size()};
+}
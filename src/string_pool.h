@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Distinct strings of a sheet, each stored once in an arena of large blocks and referred to
+// by a 32-bit id. Interning a string that is already in the pool returns its id and counts
+// one more reference; an id is freed and reused once every reference has been released.
+// The bytes of freed strings stay in the arena until Shrink moves the live strings into fresh
+// blocks. Only the writer of the sheet may intern and release strings; views may be read by
+// several readers at once.
+class StringPool {
+public:
+    using Id = std::uint32_t;
+
+    // Blocks double in size from the first to the largest one;
+    // strings longer than the largest block get a block of their own.
+    static constexpr size_t FIRST_BLOCK_SIZE = 1024;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    StringPool() = default;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Id Intern(std::string_view text);
+    void Release(Id id);
+
+    // Valid until the last reference to the id is released, or until Shrink moves the strings.
+    std::string_view View(Id id) const {
+        return entries_[id].text;
+    }
+
+    // Distinct strings currently referenced.
+    size_t GetSize() const {
+        return ids_.size();
+    }
+
+    // Bytes taken by the arena blocks, including the strings freed since.
+    size_t GetArenaBytes() const {
+        return arena_bytes_;
+    }
+
+    // Bytes of the strings currently referenced.
+    size_t GetLiveBytes() const {
+        return live_bytes_;
+    }
+
+    // The arena together with the entries and the index of the strings.
+    size_t GetMemoryUsage() const;
+
+    // Frees the unused capacity of the index and of the list of free ids. Once freed strings take
+    // more than half of the arena, copies the live strings into fresh blocks and frees the old
+    // ones, which invalidates every view taken before; ids stay valid.
+    void Shrink();
+
+private:
+    struct Entry {
+        std::string_view text;
+        size_t references = 0;
+    };
+
+    std::string_view Store(std::string_view text);
+    void Relocate();
+
+    std::vector<Entry> entries_;
+    std::vector<Id> free_ids_;
+    // the keys view the arena
+    std::unordered_map<std::string_view, Id> ids_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    // the size of the last regular block and the free space at its end
+    size_t block_size_ = 0;
+    char* block_end_ = nullptr;
+    size_t block_free_ = 0;
+    size_t arena_bytes_ = 0;
+    size_t live_bytes_ = 0;
+};
@@ -1,82 +1,66 @@
 #include "common.h"
 
-#include <cctype>
-#include <sstream>
-#include <algorithm>
-
-const int LETTERS = 26;
-const int MAX_POSITION_LENGTH = 17;
-const int MAX_POS_LETTER_COUNT = 3;
-
-const Position Position::NONE = {-1, -1};
-
-bool Position::operator==(const Position rhs) const {
-    return row == rhs.row && col == rhs.col;
-}
-
-bool Position::operator<(const Position rhs) const {
-    return std::tie(row, col) < std::tie(rhs.row, rhs.col);
-}
-
-bool Position::IsValid() const {
-    return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
-}
+#include <tuple>
 
 std::string Position::ToString() const {
-    if (!IsValid()) {
-        return "";
-    }
+    char buffer[MAX_STRING_LENGTH];
+    auto [end, ec] = PositionToChars(buffer, buffer + MAX_STRING_LENGTH, *this);
+    return ec == std::errc{} ? std::string(buffer, end) : std::string();
+}
 
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
+std::from_chars_result PositionsFromChars(const char* first, const char* last, char separator,
+                                          std::vector<Position>& positions) {
+    while (first != last) {
+        Position pos;
+        auto result = PositionFromChars(first, last, pos);
+        if (result.ec != std::errc{}) {
+            return result;
+        }
+        positions.push_back(pos);
+        first = result.ptr;
+        if (first == last || *first != separator) {
+            break;
+        }
+        ++first;
     }
-
-    result += std::to_string(row + 1);
-
-    return result;
+    return {first, std::errc{}};
 }
 
-Position Position::FromString(std::string_view str) {
-    auto it = std::find_if(str.begin(), str.end(), [](const char c) {
-        return !(std::isalpha(c) && std::isupper(c));
-    });
-    auto letters = str.substr(0, it - str.begin());
-    auto digits = str.substr(it - str.begin());
-
-    if (letters.empty() || digits.empty()) {
-        return Position::NONE;
-    }
-    if (letters.size() > MAX_POS_LETTER_COUNT) {
-        return Position::NONE;
+std::to_chars_result PositionsToChars(char* first, char* last, const Position* positions, size_t count,
+                                      char separator) {
+    for (size_t i = 0; i < count; ++i) {
+        if (i != 0) {
+            if (first == last) {
+                return {last, std::errc::value_too_large};
+            }
+            *first++ = separator;
+        }
+        auto result = PositionToChars(first, last, positions[i]);
+        if (result.ec != std::errc{}) {
+            return result;
+        }
+        first = result.ptr;
     }
+    return {first, std::errc{}};
+}
 
-    if (!std::isdigit(digits[0])) {
-        return Position::NONE;
-    }
+static_assert(Position::FromString("XFD16384") == Position{Position::MAX_ROWS - 1, Position::MAX_COLS - 1});
+static_assert(!Position::FromString("XFE1").IsValid());
+static_assert(PositionKey(Position{2, 1}) < PositionKey(Position{2, 3}));
+static_assert(PositionKey(Position{2, 3}) < PositionKey(Position{3, 0}));
 
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
-        return Position::NONE;
-    }
+bool SheetPosition::operator==(const SheetPosition& rhs) const {
+    return sheet == rhs.sheet && pos == rhs.pos;
+}
 
-    int col = 0;
-    for (char ch : letters) {
-        col *= LETTERS;
-        col += ch - 'A' + 1;
-    }
+bool SheetPosition::operator<(const SheetPosition& rhs) const {
+    return std::tie(sheet, pos) < std::tie(rhs.sheet, rhs.pos);
+}
 
-    return {row - 1, col - 1};
+std::string SheetPosition::ToString() const {
+    return sheet + '!' + pos.ToString();
 }
 
 bool Size::operator==(Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
-}
-
-Size Size::operator= (Size rhs) {
-    return Size{ rhs.rows,rhs.cols };
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed-size pool of worker threads executing submitted tasks in FIFO order.
+class ThreadPool {
+public:
+    // Zero means one thread per hardware thread.
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Function>
+    std::future<std::invoke_result_t<Function>> Submit(Function function);
+
+    size_t Size() const {
+        return workers_.size();
+    }
+
+    // The process-wide pool used when no executor is given explicitly.
+    static ThreadPool& Shared();
+
+private:
+    void Enqueue(std::function<void()> task);
+    void Work();
+
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+template <typename Function>
+std::future<std::invoke_result_t<Function>> ThreadPool::Submit(Function function) {
+    // std::function needs a copyable callable
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Function>()>>(std::move(function));
+    auto future = task->get_future();
+    Enqueue([task] {
+        (*task)();
+    });
+    return future;
+}
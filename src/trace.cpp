@@ -0,0 +1,151 @@
+#include "trace.h"
+
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<std::int64_t> start_ns{0};
+    std::atomic<std::int64_t> end_ns{0};
+};
+
+// Single-producer ring: only the owning thread advances head,
+// readers detect overwritten slots by re-reading head after copying.
+struct ThreadBuffer {
+    std::uint32_t tid = 0;
+    std::atomic<std::uint64_t> head{0};
+    std::atomic<std::uint64_t> tail{0};
+    std::array<Event, RING_CAPACITY> events;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+Registry& GetRegistry() {
+    static Registry registry;
+    return registry;
+}
+
+ThreadBuffer& LocalBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto result = std::make_shared<ThreadBuffer>();
+        Registry& registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        result->tid = static_cast<std::uint32_t>(registry.buffers.size() + 1);
+        registry.buffers.push_back(result);
+        return result;
+    }();
+    return *buffer;
+}
+
+const std::chrono::steady_clock::time_point PROCESS_START = std::chrono::steady_clock::now();
+
+void WriteEscaped(std::ostream& output, const char* text) {
+    for (; *text; ++text) {
+        if (*text == '"' || *text == '\\') {
+            output << '\\';
+        }
+        output << *text;
+    }
+}
+
+// trace-event timestamps are microseconds; keep the nanosecond part as a fraction
+void WriteMicroseconds(std::ostream& output, std::int64_t ns) {
+    output << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+}
+
+}  // namespace
+
+namespace detail {
+
+std::atomic<bool> enabled{false};
+
+std::int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - PROCESS_START).count();
+}
+
+void Record(const char* name, std::int64_t start_ns, std::int64_t end_ns) {
+    ThreadBuffer& buffer = LocalBuffer();
+    std::uint64_t index = buffer.head.load(std::memory_order_relaxed);
+    Event& event = buffer.events[index % RING_CAPACITY];
+    // pairs with the fence of DumpChromeTrace: a reader seeing any of the fields below also sees
+    // the head that marks the slot as being overwritten
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.start_ns.store(start_ns, std::memory_order_relaxed);
+    event.end_ns.store(end_ns, std::memory_order_relaxed);
+    buffer.head.store(index + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+void Enable(bool enabled) {
+    detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Clear() {
+    Registry& registry = GetRegistry();
+    std::lock_guard lock(registry.mutex);
+    for (const auto& buffer : registry.buffers) {
+        buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+void DumpChromeTrace(std::ostream& output) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        Registry& registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        buffers = registry.buffers;
+    }
+
+    output << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& buffer : buffers) {
+        std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+        std::uint64_t begin = buffer->tail.load(std::memory_order_relaxed);
+        if (head - begin > RING_CAPACITY) {
+            begin = head - RING_CAPACITY;
+        }
+
+        for (std::uint64_t index = begin; index < head; ++index) {
+            const Event& event = buffer->events[index % RING_CAPACITY];
+            const char* name = event.name.load(std::memory_order_relaxed);
+            std::int64_t start_ns = event.start_ns.load(std::memory_order_relaxed);
+            std::int64_t end_ns = event.end_ns.load(std::memory_order_relaxed);
+            // keeps the loads of the fields before the check below
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // the owner may have wrapped around while we were reading the slot
+            if (buffer->head.load(std::memory_order_relaxed) - index >= RING_CAPACITY) {
+                continue;
+            }
+
+            if (!first) {
+                output << ',';
+            }
+            first = false;
+            output << "{\"name\":\"";
+            WriteEscaped(output, name);
+            output << "\",\"cat\":\"sheet\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":";
+            WriteMicroseconds(output, start_ns);
+            output << ",\"dur\":";
+            WriteMicroseconds(output, end_ns - start_ns);
+            output << '}';
+        }
+    }
+    output << "],\"displayTimeUnit\":\"ns\"}";
+}
+
+}  // namespace trace
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+// Lightweight scoped tracing of the sheet pipeline.
+// Every thread writes finished spans into its own fixed-size ring buffer without taking locks;
+// when the buffer is full the oldest spans are overwritten.
+// The collected spans can be dumped as Chrome trace-event JSON, which opens in
+// chrome://tracing or the Perfetto UI (https://ui.perfetto.dev).
+// Tracing is disabled by default and can be switched on and off at any time.
+namespace trace {
+
+// The number of spans each thread keeps before overwriting the oldest ones.
+inline constexpr std::uint64_t RING_CAPACITY = 1 << 14;
+
+namespace detail {
+extern std::atomic<bool> enabled;
+std::int64_t NowNs();
+void Record(const char* name, std::int64_t start_ns, std::int64_t end_ns);
+}  // namespace detail
+
+inline bool IsEnabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+void Enable(bool enabled);
+
+// Drops all spans recorded so far by every thread.
+void Clear();
+
+// Writes the recorded spans of all threads as a Chrome trace-event JSON object.
+void DumpChromeTrace(std::ostream& output);
+
+// Records the time between its construction and destruction under the given name.
+// The name must be a string literal (or otherwise outlive the dump).
+class Span {
+public:
+    explicit Span(const char* name)
+        : name_(name)
+        , start_ns_(IsEnabled() ? detail::NowNs() : -1) {
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+        if (start_ns_ >= 0) {
+            detail::Record(name_, start_ns_, detail::NowNs());
+        }
+    }
+
+private:
+    const char* name_;
+    std::int64_t start_ns_;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SPAN(name) ::trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
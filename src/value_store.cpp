@@ -0,0 +1,188 @@
+#include "value_store.h"
+
+static_assert(std::atomic<double>::is_always_lock_free);
+
+namespace {
+// Sweeps a chunk survives without being read, by the cost of computing its values:
+// none for formulas reading cached values only, more for long chains of them.
+std::uint8_t GetEvictionWeight(std::uint32_t cost) {
+    std::uint8_t weight = 0;
+    for (std::uint32_t nested = cost > 0 ? cost - 1 : 0; nested > 0 && weight < ValueStore::MAX_EVICTION_WEIGHT; nested /= 2) {
+        ++weight;
+    }
+    return weight;
+}
+}  // namespace
+
+ValueStore::Slot ValueStore::At(Position pos) {
+    if (static_cast<size_t>(pos.col) >= columns_.size()) {
+        memory_usage_ -= columns_.capacity() * sizeof(Column);
+        columns_.resize(static_cast<size_t>(pos.col) + 1);
+        memory_usage_ += columns_.capacity() * sizeof(Column);
+    }
+    Column& column = columns_[pos.col];
+    size_t index = static_cast<size_t>(pos.row) / CHUNK_ROWS;
+    if (index >= column.chunks.size()) {
+        memory_usage_ -= column.chunks.capacity() * sizeof(column.chunks[0]);
+        column.chunks.resize(index + 1);
+        column.evicted.resize(index + 1);
+        memory_usage_ += column.chunks.capacity() * sizeof(column.chunks[0]);
+    }
+    if (!column.chunks[index]) {
+        // value-initialized: every cell is EMPTY
+        column.chunks[index].Reset(new Chunk());
+        column.evicted[index] = false;
+        memory_usage_ += sizeof(Chunk);
+        // a new chunk is not evicted before it could be read
+        column.chunks[index].Get()->usage.referenced.store(true, std::memory_order_relaxed);
+        clock_.emplace_back(pos.col, index);
+    }
+    Chunk& chunk = *column.chunks[index].Get();
+    return Slot(chunk.values[pos.row % CHUNK_ROWS], chunk.states[pos.row % CHUNK_ROWS], chunk.usage);
+}
+
+bool ValueStore::Readmit(Position pos, const std::function<void(Position, Slot)>& activate) {
+    if (!IsEvicted(pos)) {
+        return false;
+    }
+    auto chunk = std::make_unique<Chunk>();
+    chunk->usage.referenced.store(true, std::memory_order_relaxed);
+    const int first_row = pos.row / CHUNK_ROWS * CHUNK_ROWS;
+    for (int i = 0; i < CHUNK_ROWS; ++i) {
+        activate({first_row + i, pos.col}, Slot(chunk->values[i], chunk->states[i], chunk->usage));
+    }
+    size_t index = static_cast<size_t>(pos.row) / CHUNK_ROWS;
+    if (!columns_[pos.col].chunks[index].Publish(chunk.get())) {
+        return false;
+    }
+    chunk.release();
+    memory_usage_ += sizeof(Chunk);
+    std::lock_guard lock(readmitted_mutex_);
+    readmitted_.emplace_back(pos.col, index);
+    return true;
+}
+
+bool ValueStore::IsEvicted(Position pos) const {
+    size_t index = static_cast<size_t>(pos.row) / CHUNK_ROWS;
+    return static_cast<size_t>(pos.col) < columns_.size() && index < columns_[pos.col].evicted.size()
+        && columns_[pos.col].evicted[index] && !columns_[pos.col].chunks[index];
+}
+
+void ValueStore::AdoptReadmitted() {
+    std::lock_guard lock(readmitted_mutex_);
+    for (auto [col, index] : readmitted_) {
+        columns_[col].evicted[index] = false;
+        clock_.emplace_back(col, index);
+    }
+    readmitted_.clear();
+}
+
+void ValueStore::Clear(Position pos) {
+    if (Slot slot = Find(pos)) {
+        slot.GetState().store(State::EMPTY, std::memory_order_release);
+    }
+}
+
+void ValueStore::Compact(int col) {
+    if (col < 0 || static_cast<size_t>(col) >= columns_.size()) {
+        return;
+    }
+    AdoptReadmitted();
+    Column& column = columns_[col];
+    bool freed = false;
+    for (auto& chunk : column.chunks) {
+        if (chunk && std::all_of(chunk.Get()->states.begin(), chunk.Get()->states.end(), [](const auto& state) {
+            return state.load(std::memory_order_relaxed) == State::EMPTY;
+        })) {
+            chunk.Reset();
+            memory_usage_ -= sizeof(Chunk);
+            freed = true;
+        }
+    }
+    if (freed) {
+        clock_.erase(std::remove_if(clock_.begin(), clock_.end(), [this, col](const auto& entry) {
+            return entry.first == col && !columns_[col].chunks[entry.second];
+        }), clock_.end());
+    }
+
+    // evicted chunks are kept track of, as their cells are not empty
+    while (!column.chunks.empty() && !column.chunks.back() && !column.evicted.back()) {
+        column.chunks.pop_back();
+        column.evicted.pop_back();
+    }
+    if (column.chunks.capacity() > 2 * column.chunks.size()) {
+        memory_usage_ -= column.chunks.capacity() * sizeof(column.chunks[0]);
+        column.chunks.shrink_to_fit();
+        column.evicted.shrink_to_fit();
+        memory_usage_ += column.chunks.capacity() * sizeof(column.chunks[0]);
+    }
+    if (static_cast<size_t>(col) + 1 == columns_.size()) {
+        while (!columns_.empty() && columns_.back().chunks.empty()) {
+            memory_usage_ -= columns_.back().chunks.capacity() * sizeof(ChunkPointer);
+            columns_.pop_back();
+        }
+        if (columns_.capacity() > 2 * columns_.size()) {
+            memory_usage_ -= columns_.capacity() * sizeof(Column);
+            columns_.shrink_to_fit();
+            memory_usage_ += columns_.capacity() * sizeof(Column);
+        }
+    }
+    if (clock_.capacity() > 2 * clock_.size()) {
+        clock_.shrink_to_fit();
+    }
+}
+
+ValueStore::EvictionResult ValueStore::Evict(size_t budget) {
+    AdoptReadmitted();
+    EvictionResult result;
+    // every chunk is visited at most once more than its credits allow
+    size_t visits_left = clock_.size() * (MAX_EVICTION_WEIGHT + 2);
+    while (GetMemoryUsage() > budget && !clock_.empty() && visits_left-- > 0) {
+        hand_ %= clock_.size();
+        auto [col, index] = clock_[hand_];
+        Chunk& chunk = *columns_[col].chunks[index].Get();
+        if (chunk.usage.referenced.exchange(false, std::memory_order_relaxed)) {
+            chunk.usage.credits = GetEvictionWeight(chunk.usage.cost.load(std::memory_order_relaxed));
+            ++hand_;
+            continue;
+        }
+        if (chunk.usage.credits > 0) {
+            --chunk.usage.credits;
+            ++hand_;
+            continue;
+        }
+
+        // only chunks caching formula values are worth evicting
+        bool formulas = false;
+        size_t values = 0;
+        for (const auto& state : chunk.states) {
+            switch (state.load(std::memory_order_relaxed)) {
+            case State::VALUE:
+            case State::FORMULA_ERROR:
+                ++values;
+                formulas = true;
+                break;
+            case State::DIRTY:
+            case State::COMPUTING:
+                formulas = true;
+                break;
+            default:
+                break;
+            }
+        }
+        if (!formulas) {
+            ++hand_;
+            continue;
+        }
+
+        columns_[col].chunks[index].Reset();
+        columns_[col].evicted[index] = true;
+        memory_usage_ -= sizeof(Chunk);
+        ++result.chunks;
+        result.values += values;
+        // the order of the clock does not matter, the hand moves on to the last chunk
+        clock_[hand_] = clock_.back();
+        clock_.pop_back();
+    }
+    return result;
+}
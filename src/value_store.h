@@ -0,0 +1,253 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// The values of a sheet's cells, kept column by column: numbers in contiguous arrays of doubles
+// and a state byte per cell telling what the cell holds. Scans of a column read dense memory
+// instead of visiting the cells one by one.
+// The cache of a formula lives here as well, so its state follows the compute-once protocol of
+// the cell: readers may load and claim slots concurrently, while only the writer of the sheet
+// may create them.
+// To stay within a memory budget the writer may evict chunks holding formula values (see Evict).
+// The cells of an evicted chunk have no slot until the chunk is created again, by the writer when
+// one of its cells is edited, or by the first reader of one of its values (see Readmit).
+class ValueStore {
+public:
+    enum class State : std::uint8_t {
+        EMPTY,          // no cell, or an empty one
+        TEXT,           // a text formulas cannot read as a number
+        NUMBER,         // a text formulas read as a number
+        DIRTY,          // a formula whose value has to be computed
+        COMPUTING,      // a formula being computed by some thread
+        VALUE,          // a formula with its computed value
+        FORMULA_ERROR,  // a formula evaluating to an error; the value holds the category
+    };
+
+    static constexpr int CHUNK_ROWS = 256;
+    // a chunk survives this many more sweeps of the clock than a cold one at most
+    static constexpr std::uint8_t MAX_EVICTION_WEIGHT = 7;
+
+    // How recently and how expensively the values of a chunk were computed, see Evict.
+    struct Usage {
+        // set by reads of cached values, cleared by the clock
+        std::atomic<bool> referenced{false};
+        // the most formulas evaluated to compute one value of the chunk, including its own
+        std::atomic<std::uint32_t> cost{0};
+        // sweeps left before the chunk is evicted; only the writer touches it
+        std::uint8_t credits = 0;
+    };
+
+    // The value and the state of one cell; valid as long as its chunk. A default one is no slot.
+    class Slot {
+    public:
+        Slot() = default;
+
+        Slot(std::atomic<double>& value, std::atomic<State>& state, Usage& usage)
+            : value_(&value)
+            , state_(&state)
+            , usage_(&usage) {
+        }
+
+        explicit operator bool() const {
+            return state_ != nullptr;
+        }
+
+        std::atomic<double>& Value() const {
+            return *value_;
+        }
+
+        std::atomic<State>& GetState() const {
+            return *state_;
+        }
+
+        // Publishes a number (or an error category) together with its state.
+        void Store(State state, double value = 0.0) const {
+            value_->store(value, std::memory_order_relaxed);
+            state_->store(state, std::memory_order_release);
+        }
+
+        // Records a read of the cached value. Readers only write the flag when it is clear,
+        // so hot chunks are not written over and over.
+        void Touch() const {
+            if (!usage_->referenced.load(std::memory_order_relaxed)) {
+                usage_->referenced.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        // Records that computing the value evaluated this many formulas.
+        void AddCost(std::uint32_t evaluations) const {
+            std::uint32_t cost = usage_->cost.load(std::memory_order_relaxed);
+            while (cost < evaluations && !usage_->cost.compare_exchange_weak(cost, evaluations, std::memory_order_relaxed)) {
+            }
+        }
+
+    private:
+        std::atomic<double>* value_ = nullptr;
+        std::atomic<State>* state_ = nullptr;
+        Usage* usage_ = nullptr;
+    };
+
+    struct EvictionResult {
+        size_t chunks = 0;
+        // the computed values the chunks held
+        size_t values = 0;
+    };
+
+    ValueStore() = default;
+    ValueStore(const ValueStore&) = delete;
+    ValueStore& operator=(const ValueStore&) = delete;
+
+    // Creates the chunk of the position if needed; only the writer of the sheet may call it.
+    Slot At(Position pos);
+
+    // Creates the evicted chunk of the position again, calling activate for the position and the slot
+    // of every cell of the chunk to set its state, and returns true; false if the chunk is not evicted.
+    // Readers may call it: the first one to complete the chunk publishes it, the others drop theirs.
+    // The chunk counts towards the memory usage at once, and is handed to the clock by the next Evict.
+    bool Readmit(Position pos, const std::function<void(Position, Slot)>& activate);
+
+    // The slot of a position At has been called for, or no slot if its chunk has been evicted
+    // since; readers may call it.
+    Slot Find(Position pos) const {
+        size_t index = static_cast<size_t>(pos.row) / CHUNK_ROWS;
+        if (static_cast<size_t>(pos.col) >= columns_.size() || index >= columns_[pos.col].chunks.size()) {
+            return {};
+        }
+        Chunk* chunk = columns_[pos.col].chunks[index].Get();
+        if (!chunk) {
+            return {};
+        }
+        return Slot(chunk->values[pos.row % CHUNK_ROWS], chunk->states[pos.row % CHUNK_ROWS], chunk->usage);
+    }
+
+    // True if the chunk of the position has been evicted and not created again.
+    bool IsEvicted(Position pos) const;
+
+    // Marks the cell as empty, if its chunk exists.
+    void Clear(Position pos);
+
+    // Evicts chunks holding formula values until the store takes at most budget bytes, or no more
+    // can be evicted. Chunks are visited in turn by a clock: one whose values have been read since
+    // its last visit, or which still has credits, is skipped, so the coldest go first. A read gives
+    // a chunk credits by the cost of computing its values, so expensive values stay longer.
+    // Only the writer may call it, while no reader is running.
+    EvictionResult Evict(size_t budget);
+
+    // Frees the chunks of a column whose cells are all EMPTY, and the unused end of the column.
+    // The slots of those cells are gone until At is called for them again; only the writer may call it,
+    // while no reader is running.
+    void Compact(int col);
+
+    // One more than the last column holding chunks.
+    int GetColumnCount() const {
+        return static_cast<int>(columns_.size());
+    }
+
+    // Bytes taken by the chunks and the vectors holding them.
+    size_t GetMemoryUsage() const {
+        return memory_usage_.load(std::memory_order_relaxed) + clock_.capacity() * sizeof(clock_[0]);
+    }
+
+    // Calls function(row, state, value) in order for every cell of rows [first_row, last_row)
+    // of a column whose state is not EMPTY, and evicted(first, last) for the rows of evicted chunks,
+    // whose cells have to be read from elsewhere.
+    template <typename Function, typename Evicted>
+    void Scan(int col, int first_row, int last_row, Function function, Evicted evicted) const;
+
+private:
+    struct Chunk {
+        std::array<std::atomic<double>, CHUNK_ROWS> values;
+        std::array<std::atomic<State>, CHUNK_ROWS> states;
+        Usage usage;
+    };
+
+    // Owns a chunk; readers may set it once evicted, see Readmit.
+    class ChunkPointer {
+    public:
+        ChunkPointer() = default;
+
+        // only for the writer to grow the column
+        ChunkPointer(ChunkPointer&& other) noexcept
+            : chunk_(other.chunk_.exchange(nullptr, std::memory_order_relaxed)) {
+        }
+
+        ~ChunkPointer() {
+            delete chunk_.load(std::memory_order_relaxed);
+        }
+
+        Chunk* Get() const {
+            return chunk_.load(std::memory_order_acquire);
+        }
+
+        explicit operator bool() const {
+            return Get() != nullptr;
+        }
+
+        void Reset(Chunk* chunk = nullptr) {
+            delete chunk_.exchange(chunk, std::memory_order_acq_rel);
+        }
+
+        // Takes chunk if there is none; returns false otherwise, leaving chunk to the caller.
+        bool Publish(Chunk* chunk) {
+            Chunk* expected = nullptr;
+            return chunk_.compare_exchange_strong(expected, chunk, std::memory_order_release, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<Chunk*> chunk_{nullptr};
+    };
+
+    struct Column {
+        std::vector<ChunkPointer> chunks;
+        // set for the chunks evicted since the writer last created them; a chunk readmitted
+        // by a reader keeps it until the next Evict
+        std::vector<bool> evicted;
+    };
+
+    // Hands the chunks readmitted since the last call to the clock.
+    void AdoptReadmitted();
+
+    std::vector<Column> columns_;
+    // readers add the chunks they readmit
+    std::atomic<size_t> memory_usage_{0};
+    // the column and the index of every chunk, in the order the clock visits them
+    std::vector<std::pair<int, size_t>> clock_;
+    size_t hand_ = 0;
+    std::mutex readmitted_mutex_;
+    std::vector<std::pair<int, size_t>> readmitted_;
+};
+
+template <typename Function, typename Evicted>
+void ValueStore::Scan(int col, int first_row, int last_row, Function function, Evicted evicted) const {
+    if (col < 0 || static_cast<size_t>(col) >= columns_.size()) {
+        return;
+    }
+    const auto& chunks = columns_[col].chunks;
+    for (int row = std::max(first_row, 0); row < last_row;) {
+        size_t index = static_cast<size_t>(row) / CHUNK_ROWS;
+        int chunk_end = static_cast<int>(index + 1) * CHUNK_ROWS;
+        if (index >= chunks.size()) {
+            return;
+        }
+        if (const Chunk* chunk = chunks[index].Get()) {
+            for (int end = std::min(chunk_end, last_row); row < end; ++row) {
+                State state = chunk->states[row % CHUNK_ROWS].load(std::memory_order_acquire);
+                if (state != State::EMPTY) {
+                    function(row, state, chunk->values[row % CHUNK_ROWS].load(std::memory_order_relaxed));
+                }
+            }
+        } else if (columns_[col].evicted[index]) {
+            evicted(row, std::min(chunk_end, last_row));
+        }
+        row = chunk_end;
+    }
+}
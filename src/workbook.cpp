@@ -0,0 +1,125 @@
+#include "workbook.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include <stdexcept>
+#include <unordered_set>
+
+using namespace std::literals;
+
+namespace {
+bool IsValidSheetName(std::string_view name) {
+    auto is_name_char = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    };
+    return !name.empty() && !std::isdigit(static_cast<unsigned char>(name.front()))
+        && std::all_of(name.begin(), name.end(), is_name_char);
+}
+}  // namespace
+
+Workbook::~Workbook() {
+    // workers may read cells of any sheet
+    StopRecalculations();
+}
+
+Sheet& Workbook::AddSheet(std::string name) {
+    if (!IsValidSheetName(name)) {
+        throw std::invalid_argument("Invalid sheet name: "s + name);
+    }
+    if (sheets_by_name_.count(name)) {
+        throw std::invalid_argument("Duplicate sheet name: "s + name);
+    }
+
+    sheets_.push_back(std::unique_ptr<Sheet>(new Sheet(*this, std::move(name))));
+    Sheet& sheet = *sheets_.back();
+    sheets_by_name_.emplace(sheet.GetName(), &sheet);
+    return sheet;
+}
+
+Sheet* Workbook::GetSheet(std::string_view name) {
+    auto it = sheets_by_name_.find(name);
+    return it == sheets_by_name_.end() ? nullptr : it->second;
+}
+
+const Sheet* Workbook::GetSheet(std::string_view name) const {
+    return const_cast<Workbook*>(this)->GetSheet(name);
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const {
+    std::vector<std::string> result;
+    result.reserve(sheets_.size());
+    for (const auto& sheet : sheets_) {
+        result.push_back(sheet->GetName());
+    }
+    return result;
+}
+
+void Workbook::Recalculate(ThreadPool& executor) {
+    TRACE_SPAN("Workbook::Recalculate");
+    StopRecalculations();
+
+    // Kahn's algorithm over the sheets: each wave holds the sheets whose precedent sheets are done
+    std::unordered_map<const Sheet*, size_t> waiting_for;
+    std::unordered_map<const Sheet*, std::vector<Sheet*>> dependent_sheets;
+    for (const auto& sheet : sheets_) {
+        for (const auto& [precedent, links] : sheet->precedent_sheets_) {
+            ++waiting_for[sheet.get()];
+            dependent_sheets[precedent].push_back(sheet.get());
+        }
+    }
+
+    std::unordered_set<const Sheet*> scheduled;
+    std::vector<Sheet*> wave;
+    for (const auto& sheet : sheets_) {
+        if (!waiting_for.count(sheet.get())) {
+            wave.push_back(sheet.get());
+        }
+    }
+
+    while (scheduled.size() < sheets_.size()) {
+        if (wave.empty()) {
+            // only sheets in cycles are left
+            for (const auto& sheet : sheets_) {
+                if (!scheduled.count(sheet.get())) {
+                    wave.push_back(sheet.get());
+                }
+            }
+        }
+
+        std::vector<std::future<RecalculationStatus>> results;
+        results.reserve(wave.size());
+        for (Sheet* sheet : wave) {
+            scheduled.insert(sheet);
+            results.push_back(executor.Submit([sheet] {
+                RecalculationHandle::State state;
+                return sheet->Recalculate(state);
+            }));
+        }
+        // every task has to finish before an exception leaves this function
+        for (auto& result : results) {
+            result.wait();
+        }
+        for (auto& result : results) {
+            result.get();
+        }
+
+        std::vector<Sheet*> next_wave;
+        for (const Sheet* sheet : wave) {
+            for (Sheet* dependent : dependent_sheets[sheet]) {
+                if (--waiting_for[dependent] == 0 && !scheduled.count(dependent)) {
+                    next_wave.push_back(dependent);
+                }
+            }
+        }
+        wave = std::move(next_wave);
+    }
+}
+
+void Workbook::StopRecalculations() {
+    for (const auto& sheet : sheets_) {
+        sheet->StopOwnRecalculation();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Owns sheets whose formulas may refer to each other's cells, as in Sheet2!B3.
+// Dependencies are tracked across sheets: editing a cell invalidates its dependents on every sheet.
+// The threading contract of Sheet applies to the workbook as a whole, so modifications of any
+// of its sheets must come from one thread at a time.
+class Workbook {
+public:
+    Workbook() = default;
+    ~Workbook();
+
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    // Adds an empty sheet. Throws std::invalid_argument unless the name is unique
+    // and matches [A-Za-z_][A-Za-z0-9_]*, as formulas must be able to refer to it.
+    Sheet& AddSheet(std::string name);
+
+    // nullptr if there is no such sheet
+    Sheet* GetSheet(std::string_view name);
+    const Sheet* GetSheet(std::string_view name) const;
+
+    // In the order the sheets were added.
+    std::vector<std::string> GetSheetNames() const;
+
+    // Computes every stale formula and publishes a snapshot of each sheet.
+    // A sheet is computed after the sheets it refers to; sheets that do not depend on each other
+    // are computed in parallel on executor. Sheets referring to each other in a cycle are computed
+    // side by side as well, relying on formula values being computed once.
+    void Recalculate(ThreadPool& executor = ThreadPool::Shared());
+
+private:
+    friend class Sheet;
+
+    // cancels the background recalculations of all sheets before an edit
+    void StopRecalculations();
+
+    std::vector<std::unique_ptr<Sheet>> sheets_;
+    // the keys view the names owned by the sheets
+    std::unordered_map<std::string_view, Sheet*> sheets_by_name_;
+};